@@ -0,0 +1,104 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <stdexcept>
+
+#include "arena.h"
+
+using namespace std;
+
+namespace {
+    // Round 'p' up to the next multiple of 'alignment'.
+    inline char *align_up(char *p, size_t alignment) {
+        size_t offset(reinterpret_cast<size_t>(p) & (alignment - 1));
+        return offset ? p + (alignment - offset) : p;
+    }
+
+    // Leave enough room for a block header while keeping the usable part
+    // of each block suitably aligned for anything.
+    const size_t header_size = 16;
+}
+
+arena_block_pool::~arena_block_pool() {
+    for (size_t i = 0; i < m_free.size(); ++i)
+        ::operator delete(m_free[i]);
+}
+
+char *arena_block_pool::acquire() {
+    if (m_free.empty())
+        return static_cast<char *>(::operator new(m_block_size));
+    char *block(m_free.back());
+    m_free.pop_back();
+    return block;
+}
+
+void arena_block_pool::release(char *block) {
+    m_free.push_back(block);
+}
+
+void *arena::allocate_large(size_t size) {
+    char *mem(static_cast<char *>(::operator new(header_size + size)));
+    block_header *header(reinterpret_cast<block_header *>(mem));
+    header->previous = m_large_blocks;
+    m_large_blocks = header;
+    return mem + header_size;
+}
+
+void *arena::allocate(size_t size, size_t alignment) {
+    if (alignment > header_size)
+        throw runtime_error("Arena cannot satisfy alignment");
+    m_bytes_allocated += size;
+
+    char *p(align_up(m_next, alignment));
+    if (m_next != NULL && p + size <= m_end) {
+        m_next = p + size;
+        return p;
+    }
+
+    // Big requests would waste most of a block, so give them their own
+    // memory.  These are rare.
+    size_t usable(m_pool.block_size() - header_size);
+    if (size > usable / 4)
+        return allocate_large(size);
+
+    char *mem(m_pool.acquire());
+    block_header *header(reinterpret_cast<block_header *>(mem));
+    header->previous = m_blocks;
+    m_blocks = header;
+    m_next = mem + header_size + size;
+    m_end = mem + m_pool.block_size();
+    return mem + header_size;
+}
+
+void arena::reset() {
+    while (m_blocks) {
+        block_header *previous(m_blocks->previous);
+        m_pool.release(reinterpret_cast<char *>(m_blocks));
+        m_blocks = previous;
+    }
+    while (m_large_blocks) {
+        block_header *previous(m_large_blocks->previous);
+        ::operator delete(m_large_blocks);
+        m_large_blocks = previous;
+    }
+    m_next = m_end = NULL;
+    m_bytes_allocated = 0;
+}
@@ -0,0 +1,140 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#include <boost/utility.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+
+/// A free list of fixed-size memory blocks, shared by many arenas.  Once
+/// we've warmed up, arenas get all their blocks from here instead of from
+/// the heap.
+class arena_block_pool : boost::noncopyable {
+    size_t m_block_size;
+    std::vector<char *> m_free;
+
+public:
+    explicit arena_block_pool(size_t block_size = 8 * 1024)
+        : m_block_size(block_size) {}
+    ~arena_block_pool();
+
+    size_t block_size() const { return m_block_size; }
+    size_t free_blocks() const { return m_free.size(); }
+
+    char *acquire();
+    void release(char *block);
+};
+
+/// A monotonic memory resource.  Memory is never freed piecemeal; instead,
+/// everything allocated from an arena is released at once when the arena
+/// is reset or destroyed.
+class arena : boost::noncopyable {
+    // Each block starts with a pointer to the previous block.
+    struct block_header { block_header *previous; };
+
+    arena_block_pool &m_pool;
+    block_header *m_blocks;
+    block_header *m_large_blocks;
+    char *m_next;
+    char *m_end;
+    size_t m_bytes_allocated;
+
+    void *allocate_large(size_t size);
+
+public:
+    explicit arena(arena_block_pool &pool)
+        : m_pool(pool), m_blocks(NULL), m_large_blocks(NULL),
+          m_next(NULL), m_end(NULL), m_bytes_allocated(0) {}
+    ~arena() { reset(); }
+
+    /// Allocate 'size' bytes aligned to 'alignment', which must be a power
+    /// of two.
+    void *allocate(size_t size, size_t alignment);
+
+    /// Release everything allocated from this arena.
+    void reset();
+
+    /// The total number of bytes handed out since the last reset.
+    size_t bytes_allocated() const { return m_bytes_allocated; }
+};
+
+/// An STL allocator which gets memory from an arena.  A default-constructed
+/// arena_allocator falls back to the ordinary heap, which allows
+/// containers using it to work without an arena.
+template <typename T>
+class arena_allocator {
+    template <typename U> friend class arena_allocator;
+    arena *m_arena;
+
+public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef T &reference;
+    typedef const T &const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <typename U> struct rebind { typedef arena_allocator<U> other; };
+
+    arena_allocator() : m_arena(NULL) {}
+    explicit arena_allocator(arena *a) : m_arena(a) {}
+    template <typename U>
+    arena_allocator(const arena_allocator<U> &other)
+        : m_arena(other.m_arena) {}
+
+    arena *get_arena() const { return m_arena; }
+
+    pointer address(reference r) const { return &r; }
+    const_pointer address(const_reference r) const { return &r; }
+    size_type max_size() const { return size_type(-1) / sizeof(T); }
+
+    pointer allocate(size_type n, const void * = NULL) {
+        if (m_arena)
+            return static_cast<pointer>(
+                m_arena->allocate(n * sizeof(T),
+                                  boost::alignment_of<T>::value));
+        return static_cast<pointer>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(pointer p, size_type) {
+        // Arena memory is released all at once, by the arena.
+        if (!m_arena)
+            ::operator delete(p);
+    }
+
+    void construct(pointer p, const T &value) { new (p) T(value); }
+    void destroy(pointer p) { p->~T(); }
+
+    template <typename U>
+    bool operator==(const arena_allocator<U> &other) const
+        { return m_arena == other.m_arena; }
+    template <typename U>
+    bool operator!=(const arena_allocator<U> &other) const
+        { return m_arena != other.m_arena; }
+};
+
+#endif // ARENA_H
@@ -0,0 +1,100 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cassert>
+#include <map>
+#include <string>
+
+#include "arena.h"
+
+using namespace std;
+
+void arena_should_allocate_aligned_memory_from_pool_blocks() {
+    arena_block_pool pool(1024);
+    arena a(pool);
+
+    char *c(static_cast<char *>(a.allocate(1, 1)));
+    double *d(static_cast<double *>(a.allocate(sizeof(double), 8)));
+    assert(0 == reinterpret_cast<size_t>(d) % 8);
+    assert(reinterpret_cast<char *>(d) > c);
+    assert(reinterpret_cast<char *>(d) - c < 16);
+    assert(1 + sizeof(double) == a.bytes_allocated());
+}
+
+void arena_should_return_blocks_to_pool_on_reset() {
+    arena_block_pool pool(1024);
+    {
+        arena a(pool);
+        for (int i = 0; i < 100; ++i)
+            a.allocate(100, 8);
+        assert(0 == pool.free_blocks());
+        a.reset();
+        assert(0 == a.bytes_allocated());
+        size_t freed(pool.free_blocks());
+        assert(freed >= 10);
+
+        // Reusing the arena should not need any new blocks.
+        for (int i = 0; i < 100; ++i)
+            a.allocate(100, 8);
+        assert(0 == pool.free_blocks());
+        a.reset();
+        assert(freed == pool.free_blocks());
+    }
+}
+
+void arena_should_handle_large_allocations_separately() {
+    arena_block_pool pool(1024);
+    arena a(pool);
+    char *big(static_cast<char *>(a.allocate(10000, 8)));
+    big[9999] = 'x';
+    a.reset();
+    assert(0 == pool.free_blocks());
+}
+
+void arena_allocator_should_work_with_standard_containers() {
+    typedef pair<const int, string> value;
+    typedef map<int, string, less<int>, arena_allocator<value> > arena_map;
+
+    arena_block_pool pool;
+    arena a(pool);
+    {
+        arena_map m((less<int>()), arena_allocator<value>(&a));
+        for (int i = 0; i < 100; ++i)
+            m[i] = "value";
+        assert(100 == m.size());
+        assert("value" == m[42]);
+        assert(a.bytes_allocated() > 0);
+    }
+
+    // Without an arena, we should fall back to the heap.
+    arena_map heap_map;
+    heap_map[1] = "one";
+    assert("one" == heap_map[1]);
+}
+
+int arena_spec(int argc, char **argv) {
+    arena_should_allocate_aligned_memory_from_pool_blocks();
+    arena_should_return_blocks_to_pool_on_reset();
+    arena_should_handle_large_allocations_separately();
+    arena_allocator_should_work_with_standard_containers();
+
+    return 0;
+}
@@ -0,0 +1,225 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <boost/any.hpp>
+
+#include "document.h"
+#include "dedup.h"
+#include "text_index.h"
+
+using namespace std;
+using boost::any;
+using boost::any_cast;
+using namespace boost::filesystem;
+
+namespace {
+    const char dedup_magic[] = "PPDD";
+    const char dedup_version = 1;
+
+    // Always leave room for this many messages in our Bloom filter, so
+    // that a new database doesn't fill up its filter right away.
+    const size_t min_bloom_capacity = 1 << 20;
+
+    // References are short paths, so anything longer means corruption.
+    const uint64_t max_reference_length = 4096;
+
+    string string_tag(const document &d, const string &name) {
+        const any *value(d.find_tag(name));
+        if (value == NULL || value->empty())
+            return string();
+        return to_std_string(any_cast<const tag_string &>(*value));
+    }
+}
+
+bool fingerprint_message(const document &d, message_fingerprint &fp) {
+    string message_id(string_tag(d, "#MessageID"));
+    if (message_id.empty())
+        return false;
+
+    // Normalize away differences in case, punctuation and whitespace, which
+    // mail clients like to tinker with.
+    vector<string> terms;
+    split_terms(string_tag(d, "#Subject"), terms);
+    if (d.has_text())
+        split_terms(d.text(), terms);
+
+    string content(message_id);
+    for (size_t i = 0; i < terms.size(); ++i) {
+        content += ' ';
+        content += terms[i];
+    }
+    fp = md5_bytes(reinterpret_cast<const uint8_t *>(content.data()),
+                   content.size());
+    return true;
+}
+
+bloom_filter::bloom_filter(size_t capacity)
+    : m_bit_count(max(uint64_t(capacity) * 10, uint64_t(64))),
+      m_hash_count(7) {
+    m_bits.resize((m_bit_count + 63) / 64);
+}
+
+uint64_t bloom_filter::half(const message_fingerprint &fp, size_t offset) {
+    uint64_t result;
+    memcpy(&result, fp.data() + offset, sizeof(result));
+    return result;
+}
+
+void bloom_filter::add(const message_fingerprint &fp) {
+    uint64_t h1(half(fp, 0)), h2(half(fp, 8));
+    for (int i = 0; i < m_hash_count; ++i) {
+        uint64_t bit((h1 + i * h2) % m_bit_count);
+        m_bits[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+}
+
+bool bloom_filter::may_contain(const message_fingerprint &fp) const {
+    uint64_t h1(half(fp, 0)), h2(half(fp, 8));
+    for (int i = 0; i < m_hash_count; ++i) {
+        uint64_t bit((h1 + i * h2) % m_bit_count);
+        if (!(m_bits[bit / 64] & (uint64_t(1) << (bit % 64))))
+            return false;
+    }
+    return true;
+}
+
+namespace {
+    void write_varint(ostream &out, uint64_t value) {
+        while (value >= 0x80) {
+            out.put(char(0x80 | (value & 0x7f)));
+            value >>= 7;
+        }
+        out.put(char(value));
+    }
+
+    bool read_varint(istream &in, uint64_t &value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            int c(in.get());
+            if (c == EOF)
+                return false;
+            value |= uint64_t(c & 0x7f) << shift;
+            if (!(c & 0x80))
+                return true;
+        }
+        return false;
+    }
+}
+
+size_t dedup_db::fingerprint_hash::operator()(
+    const message_fingerprint &fp) const
+{
+    size_t result;
+    memcpy(&result, fp.data(), sizeof(result));
+    return result;
+}
+
+dedup_db::dedup_db(const path &p) {
+    if (!exists(p)) {
+        ofstream create(p.file_string().c_str(),
+                        ios_base::out | ios_base::binary);
+        create.write(dedup_magic, 4);
+        create.put(dedup_version);
+        if (!create)
+            throw runtime_error("Could not create dedup database");
+    }
+
+    m_file.open(p.file_string().c_str(),
+                ios_base::in | ios_base::out | ios_base::binary);
+    char header[5];
+    m_file.read(header, sizeof(header));
+    if (!m_file || memcmp(header, dedup_magic, 4) != 0 ||
+        header[4] != dedup_version)
+        throw runtime_error("Not a dedup database: " + p.file_string());
+
+    // Index every record.  A truncated final record, left by a crash, is
+    // ignored, and overwritten by the next record we add.
+    m_end = m_file.tellg();
+    for (;;) {
+        entry e;
+        e.offset = m_end;
+        uint64_t length;
+        if (!m_file.read(reinterpret_cast<char *>(e.fp.data()), e.fp.size()) ||
+            !read_varint(m_file, length) || length > max_reference_length ||
+            !m_file.ignore(length) || m_file.gcount() != streamsize(length))
+            break;
+        m_entries.push_back(e);
+        m_end = m_file.tellg();
+    }
+    m_file.clear();
+
+    sort(m_entries.begin(), m_entries.end());
+    m_filter = bloom_filter(max(m_entries.size() * 2, min_bloom_capacity));
+    for (size_t i = 0; i < m_entries.size(); ++i)
+        m_filter.add(m_entries[i].fp);
+}
+
+string dedup_db::read_reference(uint64_t offset) {
+    m_file.seekg(offset + message_fingerprint().size());
+    uint64_t length;
+    if (!read_varint(m_file, length) || length > max_reference_length)
+        throw runtime_error("Dedup database is corrupt");
+    string reference(size_t(length), '\0');
+    if (!m_file.read(&reference[0], length))
+        throw runtime_error("Dedup database is truncated");
+    return reference;
+}
+
+bool dedup_db::find(const message_fingerprint &fp, string &reference) {
+    if (!m_filter.may_contain(fp))
+        return false;
+
+    uint64_t offset;
+    entry key;
+    key.fp = fp;
+    vector<entry>::const_iterator found(
+        lower_bound(m_entries.begin(), m_entries.end(), key));
+    if (found != m_entries.end() && found->fp == fp) {
+        offset = found->offset;
+    } else {
+        unordered_map<message_fingerprint, uint64_t, fingerprint_hash>
+            ::const_iterator added(m_added.find(fp));
+        if (added == m_added.end())
+            return false;
+        offset = added->second;
+    }
+    reference = read_reference(offset);
+    return true;
+}
+
+void dedup_db::add(const message_fingerprint &fp, const string &reference) {
+    uint64_t offset(m_end);
+    m_file.seekp(offset);
+    m_file.write(reinterpret_cast<const char *>(fp.data()), fp.size());
+    write_varint(m_file, reference.size());
+    m_file << reference;
+    m_file.flush();
+    if (!m_file)
+        throw runtime_error("Could not write dedup database");
+    m_end = m_file.tellp();
+
+    m_added.insert(make_pair(fp, offset));
+    m_filter.add(fp);
+}
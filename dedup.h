@@ -0,0 +1,109 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <unordered_map>
+#include <cstdint>
+#include <boost/utility.hpp>
+#include <boost/filesystem.hpp>
+
+#include "utilities.h"
+
+class document;
+
+/// Identifies a message by its Internet Message-ID and a hash of its
+/// normalized subject and text.
+typedef md5_digest message_fingerprint;
+
+/// Calculate the fingerprint of 'd'.  Returns false if 'd' has no
+/// Message-ID, because we can't safely dedup messages without one.
+extern bool fingerprint_message(const document &d, message_fingerprint &fp);
+
+/// A set of fingerprints which may report false positives, but never false
+/// negatives.  We use double hashing, so the fingerprints we store must
+/// already be well-distributed hashes.
+class bloom_filter {
+    std::vector<uint64_t> m_bits;
+    uint64_t m_bit_count;
+    int m_hash_count;
+
+    static uint64_t half(const message_fingerprint &fp, size_t offset);
+
+public:
+    /// Create a filter with roughly a 1% false positive rate for up to
+    /// 'capacity' fingerprints.
+    explicit bloom_filter(size_t capacity = 0);
+
+    void add(const message_fingerprint &fp);
+    bool may_contain(const message_fingerprint &fp) const;
+};
+
+/// A persistent set of message fingerprints, shared across runs and PSTs,
+/// which remembers where we wrote the first copy of each message.  The
+/// file holds "PPDD" 0x01, followed by one record per message: the 16-byte
+/// fingerprint, a varint reference length, and the reference.
+///
+/// We only keep a Bloom filter and a sorted array of (fingerprint, file
+/// offset) pairs in memory, and read references from disk when we find a
+/// duplicate.
+class dedup_db : boost::noncopyable {
+    struct entry {
+        message_fingerprint fp;
+        uint64_t offset;
+
+        bool operator<(const entry &other) const { return fp < other.fp; }
+    };
+
+    struct fingerprint_hash {
+        size_t operator()(const message_fingerprint &fp) const;
+    };
+
+    std::fstream m_file;
+    uint64_t m_end;
+    bloom_filter m_filter;
+    std::vector<entry> m_entries;
+    std::unordered_map<message_fingerprint, uint64_t, fingerprint_hash>
+        m_added;
+
+    std::string read_reference(uint64_t offset);
+
+public:
+    /// Open the database at 'p', creating it if it doesn't exist.
+    explicit dedup_db(const boost::filesystem::path &p);
+
+    /// The number of messages we know about.
+    size_t size() const { return m_entries.size() + m_added.size(); }
+
+    /// If we've already seen a message with 'fp', set 'reference' to where
+    /// we wrote its first copy and return true.
+    bool find(const message_fingerprint &fp, std::string &reference);
+
+    /// Remember that we wrote the first copy of the message with 'fp' to
+    /// 'reference'.
+    void add(const message_fingerprint &fp, const std::string &reference);
+};
+
+#endif // DEDUP_H
@@ -0,0 +1,136 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cassert>
+#include <fstream>
+
+#include "document.h"
+#include "dedup.h"
+
+using namespace std;
+using namespace boost::filesystem;
+
+namespace {
+    document message(const string &message_id, const string &subject,
+                     const string &text) {
+        document d;
+        d.set_type(document::message);
+        if (!message_id.empty())
+            d.set_string("#MessageID", message_id);
+        d.set_string("#Subject", subject);
+        d.set_text(text);
+        return d;
+    }
+
+    message_fingerprint fingerprint_of(const document &d) {
+        message_fingerprint fp;
+        bool found(fingerprint_message(d, fp));
+        assert(found);
+        return fp;
+    }
+
+    message_fingerprint numbered_fingerprint(uint32_t n) {
+        message_fingerprint fp;
+        fp.fill(0);
+        for (size_t i = 0; i < fp.size(); ++i)
+            fp[i] = uint8_t((n * 2654435761U) >> (8 * (i % 4))) ^ uint8_t(i);
+        return fp;
+    }
+}
+
+void fingerprint_message_should_normalize_content() {
+    message_fingerprint fp;
+    assert(!fingerprint_message(message("", "Hi", "Hello"), fp));
+
+    message_fingerprint original(
+        fingerprint_of(message("<1@example.com>", "Lunch?", "Noon, at Joe's")));
+    assert(original == fingerprint_of(
+        message("<1@example.com>", "LUNCH", "noon  at\r\nJoe's")));
+    assert(original != fingerprint_of(
+        message("<2@example.com>", "Lunch?", "Noon, at Joe's")));
+    assert(original != fingerprint_of(
+        message("<1@example.com>", "Lunch?", "One, at Joe's")));
+}
+
+void bloom_filter_should_never_forget_fingerprints() {
+    bloom_filter filter(1000);
+    for (uint32_t i = 0; i < 1000; ++i)
+        filter.add(numbered_fingerprint(i));
+    for (uint32_t i = 0; i < 1000; ++i)
+        assert(filter.may_contain(numbered_fingerprint(i)));
+
+    size_t false_positives(0);
+    for (uint32_t i = 1000; i < 11000; ++i)
+        if (filter.may_contain(numbered_fingerprint(i)))
+            ++false_positives;
+    assert(false_positives < 300);
+}
+
+void dedup_db_should_remember_messages_across_runs() {
+    path db_path("dedup_spec.db");
+    remove(db_path);
+    message_fingerprint a(numbered_fingerprint(1)), b(numbered_fingerprint(2));
+    string reference;
+    {
+        dedup_db db(db_path);
+        assert(0 == db.size());
+        assert(!db.find(a, reference));
+        db.add(a, "custodian1/d0000001");
+        assert(db.find(a, reference));
+        assert("custodian1/d0000001" == reference);
+    }
+    {
+        dedup_db db(db_path);
+        assert(1 == db.size());
+        assert(db.find(a, reference));
+        assert("custodian1/d0000001" == reference);
+        assert(!db.find(b, reference));
+        db.add(b, "custodian2/d0000007");
+    }
+
+    // Simulate a crash in the middle of writing a record.
+    {
+        ofstream out(db_path.file_string().c_str(),
+                     ios_base::out | ios_base::app | ios_base::binary);
+        out.write("\x01\x02\x03", 3);
+    }
+    {
+        dedup_db db(db_path);
+        assert(2 == db.size());
+        assert(db.find(b, reference));
+        assert("custodian2/d0000007" == reference);
+        db.add(numbered_fingerprint(3), "custodian3/d0000002");
+    }
+    {
+        dedup_db db(db_path);
+        assert(db.find(numbered_fingerprint(3), reference));
+        assert("custodian3/d0000002" == reference);
+        assert(db.find(a, reference));
+    }
+    remove(db_path);
+}
+
+int dedup_spec(int argc, char **argv) {
+    fingerprint_message_should_normalize_content();
+    bloom_filter_should_never_forget_fingerprints();
+    dedup_db_should_remember_messages_across_runs();
+    return 0;
+}
@@ -0,0 +1,373 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#ifdef HAVE_OPENSSL
+#  include <openssl/evp.h>
+#else
+#  include "md5.h"
+#endif
+
+#include "digest.h"
+
+using namespace std;
+
+digest_set parse_digest_set(const string &names) {
+    digest_set result(0);
+    string::size_type start = 0;
+    for (;;) {
+        string::size_type comma(names.find(',', start));
+        string name(names.substr(start, comma == string::npos ?
+                                 string::npos : comma - start));
+        if (name == "md5")
+            result |= digest_md5;
+        else if (name == "sha1")
+            result |= digest_sha1;
+        else if (name == "sha256")
+            result |= digest_sha256;
+        else
+            throw runtime_error("Unknown digest algorithm: " + name);
+        if (comma == string::npos)
+            break;
+        start = comma + 1;
+    }
+    return result;
+}
+
+namespace {
+    // How much data we pass to each digest before moving on to the next.
+    // This should comfortably fit in the CPU's cache.
+    const size_t chunk_size = 32 * 1024;
+}
+
+#ifdef HAVE_OPENSSL
+
+// OpenSSL picks the fastest implementation for the current CPU at
+// runtime, including the SHA extensions and AVX2 code paths.
+struct multi_digest::impl {
+    struct context_deleter {
+        void operator()(EVP_MD_CTX *ctx) const { EVP_MD_CTX_destroy(ctx); }
+    };
+
+    // Each context frees itself, even if a later one fails to initialize.
+    typedef std::unique_ptr<EVP_MD_CTX, context_deleter> context_ptr;
+
+    digest_set algorithms;
+    context_ptr md5;
+    context_ptr sha1;
+    context_ptr sha256;
+
+    static context_ptr create(const EVP_MD *type) {
+        context_ptr ctx(EVP_MD_CTX_create());
+        if (!ctx || !EVP_DigestInit_ex(ctx.get(), type, NULL))
+            throw runtime_error("Unable to initialize digest");
+        return ctx;
+    }
+
+    static void finish(EVP_MD_CTX *ctx, uint8_t *out) {
+        unsigned int length;
+        EVP_DigestFinal_ex(ctx, out, &length);
+    }
+
+    explicit impl(digest_set a) : algorithms(a) {
+        if (algorithms & digest_md5)
+            md5 = create(EVP_md5());
+        if (algorithms & digest_sha1)
+            sha1 = create(EVP_sha1());
+        if (algorithms & digest_sha256)
+            sha256 = create(EVP_sha256());
+    }
+
+    void update(const uint8_t *data, size_t size) {
+        if (md5)
+            EVP_DigestUpdate(md5.get(), data, size);
+        if (sha1)
+            EVP_DigestUpdate(sha1.get(), data, size);
+        if (sha256)
+            EVP_DigestUpdate(sha256.get(), data, size);
+    }
+
+    void finish(file_digests &result) {
+        if (md5)
+            finish(md5.get(), result.md5.data());
+        if (sha1)
+            finish(sha1.get(), result.sha1.data());
+        if (sha256)
+            finish(sha256.get(), result.sha256.data());
+    }
+};
+
+#else // !HAVE_OPENSSL
+
+namespace {
+    inline uint32_t rotate_left(uint32_t x, int n) {
+        return (x << n) | (x >> (32 - n));
+    }
+
+    inline uint32_t rotate_right(uint32_t x, int n) {
+        return (x >> n) | (x << (32 - n));
+    }
+
+    inline uint32_t load_big_endian(const uint8_t *p) {
+        return ((uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+                (uint32_t(p[2]) << 8) | uint32_t(p[3]));
+    }
+
+    inline void store_big_endian(uint8_t *p, uint32_t x) {
+        p[0] = uint8_t(x >> 24);
+        p[1] = uint8_t(x >> 16);
+        p[2] = uint8_t(x >> 8);
+        p[3] = uint8_t(x);
+    }
+
+    // The block buffering and padding shared by SHA-1 and SHA-256, which
+    // differ only in their compression functions and state sizes.
+    template <typename Derived, size_t StateWords>
+    class sha_base {
+    protected:
+        uint32_t m_state[StateWords];
+        uint8_t m_block[64];
+        size_t m_block_used;
+        uint64_t m_length;
+
+        sha_base() : m_block_used(0), m_length(0) {}
+
+    public:
+        void update(const uint8_t *data, size_t size) {
+            m_length += size;
+            if (m_block_used > 0) {
+                size_t n(min(size, 64 - m_block_used));
+                memcpy(m_block + m_block_used, data, n);
+                m_block_used += n;
+                data += n;
+                size -= n;
+                if (m_block_used < 64)
+                    return;
+                static_cast<Derived *>(this)->transform(m_block);
+                m_block_used = 0;
+            }
+            for (; size >= 64; data += 64, size -= 64)
+                static_cast<Derived *>(this)->transform(data);
+            memcpy(m_block, data, size);
+            m_block_used = size;
+        }
+
+        void finish(uint8_t *out) {
+            uint64_t bit_length(m_length * 8);
+            uint8_t padding[72];
+            memset(padding, 0, sizeof(padding));
+            padding[0] = 0x80;
+            size_t pad_length(m_block_used < 56 ?
+                              56 - m_block_used : 120 - m_block_used);
+            update(padding, pad_length);
+            uint8_t length_bytes[8];
+            store_big_endian(length_bytes, uint32_t(bit_length >> 32));
+            store_big_endian(length_bytes + 4, uint32_t(bit_length));
+            update(length_bytes, 8);
+            for (size_t i = 0; i < StateWords; ++i)
+                store_big_endian(out + 4*i, m_state[i]);
+        }
+    };
+
+    class sha1_state : public sha_base<sha1_state, 5> {
+    public:
+        sha1_state() {
+            m_state[0] = 0x67452301;
+            m_state[1] = 0xEFCDAB89;
+            m_state[2] = 0x98BADCFE;
+            m_state[3] = 0x10325476;
+            m_state[4] = 0xC3D2E1F0;
+        }
+
+        void transform(const uint8_t *block) {
+            uint32_t w[80];
+            for (int i = 0; i < 16; ++i)
+                w[i] = load_big_endian(block + 4*i);
+            for (int i = 16; i < 80; ++i)
+                w[i] = rotate_left(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+            uint32_t a(m_state[0]), b(m_state[1]), c(m_state[2]),
+                d(m_state[3]), e(m_state[4]);
+            for (int i = 0; i < 80; ++i) {
+                uint32_t f, k;
+                if (i < 20) {
+                    f = (b & c) | (~b & d);
+                    k = 0x5A827999;
+                } else if (i < 40) {
+                    f = b ^ c ^ d;
+                    k = 0x6ED9EBA1;
+                } else if (i < 60) {
+                    f = (b & c) | (b & d) | (c & d);
+                    k = 0x8F1BBCDC;
+                } else {
+                    f = b ^ c ^ d;
+                    k = 0xCA62C1D6;
+                }
+                uint32_t t(rotate_left(a, 5) + f + e + k + w[i]);
+                e = d;
+                d = c;
+                c = rotate_left(b, 30);
+                b = a;
+                a = t;
+            }
+            m_state[0] += a;
+            m_state[1] += b;
+            m_state[2] += c;
+            m_state[3] += d;
+            m_state[4] += e;
+        }
+    };
+
+    const uint32_t sha256_k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+        0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+        0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+        0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+        0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+        0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+        0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+        0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+        0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+
+    class sha256_state : public sha_base<sha256_state, 8> {
+    public:
+        sha256_state() {
+            m_state[0] = 0x6a09e667;
+            m_state[1] = 0xbb67ae85;
+            m_state[2] = 0x3c6ef372;
+            m_state[3] = 0xa54ff53a;
+            m_state[4] = 0x510e527f;
+            m_state[5] = 0x9b05688c;
+            m_state[6] = 0x1f83d9ab;
+            m_state[7] = 0x5be0cd19;
+        }
+
+        void transform(const uint8_t *block) {
+            uint32_t w[64];
+            for (int i = 0; i < 16; ++i)
+                w[i] = load_big_endian(block + 4*i);
+            for (int i = 16; i < 64; ++i) {
+                uint32_t s0(rotate_right(w[i-15], 7) ^
+                            rotate_right(w[i-15], 18) ^ (w[i-15] >> 3));
+                uint32_t s1(rotate_right(w[i-2], 17) ^
+                            rotate_right(w[i-2], 19) ^ (w[i-2] >> 10));
+                w[i] = w[i-16] + s0 + w[i-7] + s1;
+            }
+
+            uint32_t s[8];
+            memcpy(s, m_state, sizeof(s));
+            for (int i = 0; i < 64; ++i) {
+                uint32_t S1(rotate_right(s[4], 6) ^ rotate_right(s[4], 11) ^
+                            rotate_right(s[4], 25));
+                uint32_t ch((s[4] & s[5]) ^ (~s[4] & s[6]));
+                uint32_t t1(s[7] + S1 + ch + sha256_k[i] + w[i]);
+                uint32_t S0(rotate_right(s[0], 2) ^ rotate_right(s[0], 13) ^
+                            rotate_right(s[0], 22));
+                uint32_t maj((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+                uint32_t t2(S0 + maj);
+                s[7] = s[6];
+                s[6] = s[5];
+                s[5] = s[4];
+                s[4] = s[3] + t1;
+                s[3] = s[2];
+                s[2] = s[1];
+                s[1] = s[0];
+                s[0] = t1 + t2;
+            }
+            for (int i = 0; i < 8; ++i)
+                m_state[i] += s[i];
+        }
+    };
+}
+
+// Our portable fallback, for systems without OpenSSL.
+struct multi_digest::impl {
+    digest_set algorithms;
+    md5_state_t md5;
+    sha1_state sha1;
+    sha256_state sha256;
+
+    explicit impl(digest_set a) : algorithms(a) {
+        md5_init(&md5);
+    }
+
+    void update(const uint8_t *data, size_t size) {
+        if (algorithms & digest_md5)
+            md5_append(&md5, data, static_cast<int>(size));
+        if (algorithms & digest_sha1)
+            sha1.update(data, size);
+        if (algorithms & digest_sha256)
+            sha256.update(data, size);
+    }
+
+    void finish(file_digests &result) {
+        if (algorithms & digest_md5)
+            md5_finish(&md5, result.md5.data());
+        if (algorithms & digest_sha1)
+            sha1.finish(result.sha1.data());
+        if (algorithms & digest_sha256)
+            sha256.finish(result.sha256.data());
+    }
+};
+
+#endif // !HAVE_OPENSSL
+
+multi_digest::multi_digest(digest_set algorithms)
+    : m_impl(new impl(algorithms)) {
+}
+
+multi_digest::~multi_digest() {
+}
+
+void multi_digest::update(const void *data, size_t size) {
+    if (!m_impl)
+        throw runtime_error("Cannot update a finished digest");
+    const uint8_t *p(static_cast<const uint8_t *>(data));
+    while (size > 0) {
+        size_t n(min(size, chunk_size));
+        m_impl->update(p, n);
+        p += n;
+        size -= n;
+    }
+}
+
+file_digests multi_digest::finish() {
+    if (!m_impl)
+        throw runtime_error("Digest already finished");
+    file_digests result;
+    result.algorithms = m_impl->algorithms;
+    m_impl->finish(result);
+    m_impl.reset();
+    return result;
+}
+
+file_digests calculate_digests(digest_set algorithms,
+                               const void *data, size_t size) {
+    multi_digest digest(algorithms);
+    digest.update(data, size);
+    return digest.finish();
+}
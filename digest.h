@@ -0,0 +1,85 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <string>
+
+#include <boost/utility.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include "utilities.h"
+
+/// The digest algorithms we know how to compute.  These may be combined
+/// into a digest_set using bitwise OR.
+enum digest_algorithm {
+    digest_md5 = 1,
+    digest_sha1 = 2,
+    digest_sha256 = 4
+};
+typedef unsigned int digest_set;
+
+typedef std::array<uint8_t, 20> sha1_digest;
+typedef std::array<uint8_t, 32> sha256_digest;
+
+/// The digests computed for a single file.  Only the digests in
+/// 'algorithms' are meaningful.
+struct file_digests {
+    digest_set algorithms;
+    md5_digest md5;
+    sha1_digest sha1;
+    sha256_digest sha256;
+
+    file_digests() : algorithms(0) {}
+};
+
+/// Parse a comma-separated list of algorithm names ("md5,sha1,sha256").
+/// Throws an exception if any name is unknown.
+extern digest_set parse_digest_set(const std::string &names);
+
+/// Computes any combination of digests in a single pass over the data.
+/// We feed each chunk of input to every digest in turn, so the data only
+/// needs to come from main memory once.
+class multi_digest : boost::noncopyable {
+    struct impl;
+    boost::scoped_ptr<impl> m_impl;
+
+public:
+    explicit multi_digest(digest_set algorithms);
+    ~multi_digest();
+
+    /// Add more data to the digests.  This may be called repeatedly as data
+    /// streams past.
+    void update(const void *data, size_t size);
+
+    /// Finish computing our digests.  No more data may be added.
+    file_digests finish();
+};
+
+/// Calculate all the digests in 'algorithms' for the specified data.
+extern file_digests calculate_digests(digest_set algorithms,
+                                      const void *data, size_t size);
+
+#endif // DIGEST_H
@@ -0,0 +1,103 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "digest.h"
+
+using namespace std;
+
+namespace {
+    template <size_t N>
+    string hex_string(const std::array<uint8_t, N> &digest) {
+        return string(hex_digest(digest).data());
+    }
+}
+
+void parse_digest_set_should_parse_algorithm_names() {
+    assert(digest_md5 == parse_digest_set("md5"));
+    assert((digest_sha1 | digest_sha256) == parse_digest_set("sha256,sha1"));
+
+    bool caught_exception(false);
+    try {
+        parse_digest_set("md5,crc32");
+    } catch (std::exception &) {
+        caught_exception = true;
+    }
+    assert(caught_exception);
+}
+
+void calculate_digests_should_compute_all_requested_digests() {
+    file_digests d(calculate_digests(digest_md5 | digest_sha1 | digest_sha256,
+                                     "abc", 3));
+    assert((digest_md5 | digest_sha1 | digest_sha256) == d.algorithms);
+    assert("900150983cd24fb0d6963f7d28e17f72" == hex_string(d.md5));
+    assert("a9993e364706816aba3e25717850c26c9cd0d89d" == hex_string(d.sha1));
+    assert("ba7816bf8f01cfea414140de5dae2223"
+           "b00361a396177a9cb410ff61f20015ad" == hex_string(d.sha256));
+
+    file_digests empty(calculate_digests(digest_sha256, "", 0));
+    assert(digest_sha256 == empty.algorithms);
+    assert("e3b0c44298fc1c149afbf4c8996fb924"
+           "27ae41e4649b934ca495991b7852b855" == hex_string(empty.sha256));
+}
+
+void multi_digest_should_give_same_result_when_data_arrives_in_pieces() {
+    // Feed in a million 'a' characters in odd-sized pieces, so that we
+    // cross plenty of block boundaries.
+    string a(1000, 'a');
+    multi_digest digest(digest_md5 | digest_sha1 | digest_sha256);
+    size_t remaining = 1000000;
+    for (size_t piece = 1; remaining > 0; piece = piece % 997 + 1) {
+        size_t n(min(piece, remaining));
+        digest.update(a.data(), n);
+        remaining -= n;
+    }
+    file_digests d(digest.finish());
+    assert("7707d6ae4e027c70eea2a935c2296f21" == hex_string(d.md5));
+    assert("34aa973cd4c4daa4f61eeb2bdbad27316534016f" == hex_string(d.sha1));
+    assert("cdc76e5c9914fb9281a1c7e284d73e67"
+           "f1809a48a497200e046d39ccc7112cd0" == hex_string(d.sha256));
+}
+
+void multi_digest_should_handle_input_larger_than_a_chunk() {
+    vector<uint8_t> data(256 * 300);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = uint8_t(i);
+    file_digests d(calculate_digests(digest_sha1 | digest_sha256,
+                                     data.data(), data.size()));
+    assert("a95b7b1b4576c981b236d7dbfc57c0baeeaf04ec" == hex_string(d.sha1));
+    assert("f8b0585eb91f58c007a5634362c9f90d"
+           "8543822c113f702523bc7b73408a9392" == hex_string(d.sha256));
+}
+
+int digest_spec(int argc, char **argv) {
+    parse_digest_set_should_parse_algorithm_names();
+    calculate_digests_should_compute_all_requested_digests();
+    multi_digest_should_give_same_result_when_data_arrives_in_pieces();
+    multi_digest_should_handle_input_larger_than_a_chunk();
+
+    return 0;
+}
@@ -19,16 +19,23 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <cstdint>
+#include <utility>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/lexical_cast.hpp>
 #include <pstsdk/pst.h>
 
 #include "utilities.h"
 #include "rfc822.h"
+#include "rtf.h"
+#include "html.h"
+#include "header_fields.h"
+#include "field_selection.h"
 #include "document.h"
+#include "trace.h"
 
 using namespace std;
 using boost::any;
+using boost::any_cast;
 using boost::lexical_cast;
 using namespace boost::posix_time;
 using namespace pstsdk;
@@ -46,42 +53,118 @@ namespace {
         }
     }
 
+    // Read a string property, converting it to UTF-8.  We read the raw
+    // bytes and convert them ourselves, which spares pstsdk from building
+    // a wstring, at four bytes per character, along the way.
+    string read_utf8_prop(const const_property_object &props, prop_id id) {
+        vector<byte> bytes(props.read_prop<vector<byte> >(id));
+        bool unicode(props.get_prop_type(id) == prop_type_unicode);
+        string utf8;
+        pst_string_to_utf8_append(utf8, bytes.data(), bytes.size(), unicode);
+        return utf8;
+    }
+
     // Do out best to extract something resembling an RFC822 email
     // address.
-    wstring extract_address(const const_property_object *props,
-                            prop_id name_prop, prop_id smtp_address_prop,
-                            prop_id email_address_prop) {
-        wstring display_name;
+    string extract_address(const const_property_object *props,
+                           prop_id name_prop, prop_id smtp_address_prop,
+                           prop_id email_address_prop) {
+        string display_name;
         if (props->prop_exists(name_prop))
-            display_name = props->read_prop<wstring>(name_prop);
+            display_name = read_utf8_prop(*props, name_prop);
 
         // Email addresses may be stored as either an SMTP address or a
         // generic email address.  The latter may or may not be SMTP.
-        wstring email;
+        string email;
         if (props->prop_exists(smtp_address_prop))
-            email = props->read_prop<wstring>(smtp_address_prop);
+            email = read_utf8_prop(*props, smtp_address_prop);
         else if (props->prop_exists(email_address_prop))
-            email = props->read_prop<wstring>(email_address_prop);
+            email = read_utf8_prop(*props, email_address_prop);
 
         return rfc822_email(display_name, email);
     }
 
-    wstring recipient_address(const recipient &r) {
-        const_table_row props(r.get_property_row());
-        // PidTagDisplayName, PidTagPrimarySmtpAddress, PidTagEmailAddress.
-        return extract_address(&props, 0x3001, 0x39fe, 0x3003);
+    // Should we read 'tag'?  No selection means everything.
+    bool wants(const field_selection *fields, const char *tag) {
+        return fields == NULL || fields->reads_tag(tag);
+    }
+
+    // A string column of a table, which we look up once for the whole
+    // table instead of once per row.
+    class string_column {
+        const table &m_table;
+        prop_id m_id;
+        bool m_present;
+        bool m_unicode;
+
+    public:
+        string_column(const table &t, prop_id id)
+            : m_table(t), m_id(id), m_present(false), m_unicode(false) {
+            try {
+                prop_type type(t.get_prop_type(id));
+                m_present = (type == prop_type_unicode ||
+                             type == prop_type_string);
+                m_unicode = (type == prop_type_unicode);
+            } catch (key_not_found<prop_id> &) {
+                // This table doesn't have this column at all.
+            }
+        }
+
+        // Set 'out' to the UTF-8 value of this column in 'row'.  Returns
+        // false if the cell is empty.
+        bool read(pstsdk::ulong row, string &out) const {
+            out.clear();
+            if (!m_present || !m_table.prop_exists(row, m_id))
+                return false;
+            vector<byte> bytes(m_table.read_cell(row, m_id));
+            pst_string_to_utf8_append(out, bytes.data(), bytes.size(),
+                                      m_unicode);
+            return true;
+        }
+    };
+
+    // Read every recipient's address in one sweep over the columns of the
+    // recipient table, without building a recipient and a property row
+    // for each one.  Distribution lists may have thousands of recipients.
+    void read_recipients(const message &m, vector<string> &to,
+                         vector<string> &cc, vector<string> &bcc) {
+        const table &t(m.get_recipient_table());
+        string_column display_name(t, 0x3001);  // PidTagDisplayName
+        string_column smtp_address(t, 0x39fe);  // PidTagPrimarySmtpAddress
+        string_column email_address(t, 0x3003); // PidTagEmailAddress
+
+        string name, email;
+        pstsdk::ulong count(t.size());
+        for (pstsdk::ulong row = 0; row < count; ++row) {
+            display_name.read(row, name);
+            // Email addresses may be stored as either an SMTP address or
+            // a generic email address.  The latter may or may not be SMTP.
+            if (!smtp_address.read(row, email))
+                email_address.read(row, email);
+
+            string address(rfc822_email(name, email));
+            // PidTagRecipientType
+            switch (slong(t.get_cell_value(row, 0x0c15))) {
+                case mapi_to:  to.push_back(std::move(address));  break;
+                case mapi_cc:  cc.push_back(std::move(address));  break;
+                case mapi_bcc: bcc.push_back(std::move(address)); break;
+                default:
+                    throw runtime_error("Unknown recipient type");
+                    break;
+            }
+        }
     }
 
-    wstring attachment_name(const attachment &a) {
+    string attachment_name(const attachment &a) {
         if (a.is_message()) {
             message m(a.open_as_message());
             if (has_prop(m, &message::get_subject))
-                return m.get_subject();
+                return wstring_to_utf8(m.get_subject());
         } else {
             if (has_prop(a, &attachment::get_filename))
-                return a.get_filename();
+                return wstring_to_utf8(a.get_filename());
         }
-        return L"(no name)";
+        return "(no name)";
     }
 }
 
@@ -94,153 +177,247 @@ void document::initialize_fields() {
     m_has_html = false;
 }
 
-void document::initialize_from_message(const pstsdk::message &m) {
+void document::initialize_from_message(const pstsdk::message &m,
+                                       const field_selection *fields) {
     property_bag props(m.get_property_bag());
 
     set_type(document::message);
 
-    vector<wstring> from;
+    vector<string> from;
     // Maybe we should use these as 'From', and SentRepresenting as 'Sender'?
     // PidTagSentRepresentingName, , PidTagSentRepresentingEmailAddress
     // 0x0042, ???, 0x0065
     // PidTagSenderName PidTagSenderSmtpAddress PidTagSenderEmailAddress
-    if (props.prop_exists(0x0c1a))
+    if (wants(fields, "#From") && props.prop_exists(0x0c1a))
         from.push_back(extract_address(&props, 0x0c1a, 0x5d01, 0x0c1f));
     if (!from.empty())
-        (*this)[L"#From"] = from;
-
-    vector<wstring> to;
-    vector<wstring> cc;
-    vector<wstring> bcc;
-    if (m.get_recipient_count() > 0) {
-        message::recipient_iterator i(m.recipient_begin());
-        for (; i != m.recipient_end(); ++i) {
-            recipient r(*i);
-            wstring address(recipient_address(r));
-            switch (r.get_type()) {
-                case mapi_to:  to.push_back(address);  break;
-                case mapi_cc:  cc.push_back(address);  break;
-                case mapi_bcc: bcc.push_back(address); break;
-                default:
-                    throw runtime_error("Unknown recipient type");
-                    break;
-            }
-        }
-    }
+        set_strings("#From", from);
+
+    vector<string> to;
+    vector<string> cc;
+    vector<string> bcc;
+    // Reading the recipient table is relatively expensive.
+    bool want_recipients(wants(fields, "#To") || wants(fields, "#CC") ||
+                         wants(fields, "#BCC"));
+    if (want_recipients && m.get_recipient_count() > 0)
+        read_recipients(m, to, cc, bcc);
     if (!to.empty())
-        (*this)[L"#To"] = to;
+        set_strings("#To", to);
     if (!cc.empty())
-        (*this)[L"#CC"] = cc;
+        set_strings("#CC", cc);
     if (!bcc.empty())
-        (*this)[L"#BCC"] = bcc;
-
-    if (has_prop(m, &message::get_subject))
-        (*this)[L"#Subject"] = wstring(m.get_subject());
-
-    if (props.prop_exists(0x007d)) // PidTagTransportMessageHeaders
-        (*this)[L"#Header"] = props.read_prop<wstring>(0x007d);
-
-    if (props.prop_exists(0x0039)) // PidTagClientSubmitTime
-        (*this)[L"#DateSent"] = from_time_t(props.read_time_t_prop(0x0039));
-
-    if (props.prop_exists(0x0e06)) // PidTagMessageDeliveryTime
-        (*this)[L"#DateReceived"] = from_time_t(props.read_time_t_prop(0x0e06));
-
-    if (m.get_attachment_count() == 0) {
-        (*this)[L"#HasAttachments"] = false;
-        (*this)[L"#AttachmentCount"] = int32_t(0);
-    } else {
-        (*this)[L"#HasAttachments"] = true;
-        (*this)[L"#AttachmentCount"] = int32_t(m.get_attachment_count());
-
-        vector<wstring> names;
-        message::attachment_iterator i(m.attachment_begin());
-        for (; i != m.attachment_end(); ++i) {
-            names.push_back(attachment_name(*i));
+        set_strings("#BCC", bcc);
+
+    if (wants(fields, "#Subject") && has_prop(m, &message::get_subject))
+        set_string("#Subject", wstring_to_utf8(m.get_subject()));
+
+    // We promote a few fields from the transport headers once we know
+    // what we already have, and then store them as #Header.  We only
+    // need them for the IDs if the properties are missing.  We tokenize
+    // the UTF-8 conversion rather than pstsdk's UTF-16 bytes, because
+    // #Header and the promoted values all need to be UTF-8 anyway.
+    bool want_headers(wants(fields, "#Header") ||
+                      wants(fields, "#References") ||
+                      wants(fields, "#ReceivedHops") ||
+                      wants(fields, "#OriginatingIP") ||
+                      (wants(fields, "#InReplyTo") &&
+                       !props.prop_exists(0x1042)) ||
+                      (wants(fields, "#MessageID") &&
+                       !props.prop_exists(0x1035)));
+    bool has_headers(want_headers && props.prop_exists(0x007d));
+    string headers;
+    if (has_headers) // PidTagTransportMessageHeaders
+        headers = read_utf8_prop(props, 0x007d);
+
+    if (wants(fields, "#DateSent") &&
+        props.prop_exists(0x0039)) // PidTagClientSubmitTime
+        (*this)["#DateSent"] = from_time_t(props.read_time_t_prop(0x0039));
+
+    if (wants(fields, "#DateReceived") &&
+        props.prop_exists(0x0e06)) // PidTagMessageDeliveryTime
+        (*this)["#DateReceived"] = from_time_t(props.read_time_t_prop(0x0e06));
+
+    // Counting attachments reads the attachment table, and naming them
+    // means opening every attachment.
+    bool want_names(wants(fields, "#AttachmentNames"));
+    if (wants(fields, "#HasAttachments") ||
+        wants(fields, "#AttachmentCount") || want_names) {
+        size_t count(m.get_attachment_count());
+        if (wants(fields, "#HasAttachments"))
+            (*this)["#HasAttachments"] = (count > 0);
+        if (wants(fields, "#AttachmentCount"))
+            (*this)["#AttachmentCount"] = int32_t(count);
+
+        if (want_names && count > 0) {
+            vector<string> names;
+            message::attachment_iterator i(m.attachment_begin());
+            for (; i != m.attachment_end(); ++i) {
+                names.push_back(attachment_name(*i));
+            }
+            set_strings("#AttachmentNames", names);
         }
-        (*this)[L"#AttachmentNames"] = names;
     }
 
-    if (props.prop_exists(0x0e07)) // PidTagMessageFlags
-        (*this)[L"#ReadFlag"] =
+    if (wants(fields, "#ReadFlag") &&
+        props.prop_exists(0x0e07)) // PidTagMessageFlags
+        (*this)["#ReadFlag"] =
             (props.read_prop<int32_t>(0x0e07) & 0x1) ? true : false;
 
-    if (props.prop_exists(0x0017)) // PidTagImportance
-        (*this)[L"#ImportanceFlag"] =
+    if (wants(fields, "#ImportanceFlag") &&
+        props.prop_exists(0x0017)) // PidTagImportance
+        (*this)["#ImportanceFlag"] =
             (props.read_prop<int32_t>(0x0017) > 1) ? true : false;
 
-    if (props.prop_exists(0x001a)) // PidTagMessageClass
-        (*this)[L"#MessageClass"] = props.read_prop<wstring>(0x001a);
+    if (wants(fields, "#MessageClass") &&
+        props.prop_exists(0x001a)) // PidTagMessageClass
+        set_string("#MessageClass", read_utf8_prop(props, 0x001a));
 
-    if (props.prop_exists(0x1090)) // PidTagFlagStatus
-        (*this)[L"#FlagStatus"] =
-            lexical_cast<wstring>(props.read_prop<int32_t>(0x1090));
+    if (wants(fields, "#FlagStatus") &&
+        props.prop_exists(0x1090)) // PidTagFlagStatus
+        set_string("#FlagStatus",
+                   lexical_cast<string>(props.read_prop<int32_t>(0x1090)));
 
-    if (props.prop_exists(0x1035)) // PidTagInternetMessageId
-        (*this)[L"#MessageID"] =  props.read_prop<wstring>(0x1035);
+    if (wants(fields, "#MessageID") &&
+        props.prop_exists(0x1035)) // PidTagInternetMessageId
+        set_string("#MessageID", read_utf8_prop(props, 0x1035));
+
+    if (wants(fields, "#InReplyTo") &&
+        props.prop_exists(0x1042)) // PidTagInReplyToId
+        set_string("#InReplyTo", read_utf8_prop(props, 0x1042));
+
+    if (has_headers) {
+        trace_span span("parse headers", "Size", headers.size());
+        promote_header_fields(headers, *this);
+        set_string("#Header", headers);
+    }
 
-    if (has_prop(m, &message::get_entry_id))
-        (*this)[L"#EntryID"] =
-            string_to_wstring(bytes_to_hex_string(m.get_entry_id()));
+    if (wants(fields, "#EntryID") && has_prop(m, &message::get_entry_id))
+        set_string("#EntryID", bytes_to_hex_string(m.get_entry_id()));
+
+    // Bodies are usually the largest part of a message by far.
+    if (fields != NULL && !fields->wants_bodies())
+        return;
 
     if (has_prop(m, &message::get_body))
-        set_text(m.get_body());
+        set_text(wstring_to_utf8(m.get_body()));
 
-    if (props.prop_exists(0x1013)) { // PidTagBodyHtml
+    // We only need the HTML for our EML files, unless it's all we have.
+    bool want_html(fields == NULL || fields->native_files() || !has_text());
+    if (want_html && props.prop_exists(0x1013)) { // PidTagBodyHtml
         // This may be either a string or a binary field, but we always read
         // it as binary.  It appears to be 8-bit data in an unknown encoding.
         set_html(props.read_prop<vector<byte> >(0x1013));
     }
+
+    // Older messages may only have a compressed RTF body, so recover what
+    // we can from that.
+    if (!has_text() && !has_html() &&
+        props.prop_exists(0x1009)) { // PidTagRtfCompressed
+        trace_span span("decompress RTF");
+        try {
+            vector<uint8_t> rtf(lzfu_decompress(
+                props.read_prop<vector<byte> >(0x1009)));
+            if (!has_html() && rtf_has_encapsulated_html(rtf))
+                set_html(rtf_to_html(rtf));
+            set_text(rtf_to_text(rtf));
+        } catch (runtime_error &) {
+            // The RTF is corrupt, so this message has no body.
+        }
+    }
+
+    // If all we have is HTML, extract the text from it, so that we always
+    // have something to index.
+    if (!has_text() && has_html()) {
+        trace_span span("extract HTML text");
+        string charset;
+        set_text(html_to_text(html(), &charset));
+        if (!charset.empty() && wants(fields, "#TextCharset"))
+            set_string("#TextCharset", charset);
+    }
 }
 
-document::document(const pstsdk::message &m) {
+document::document(const pstsdk::message &m,
+                   const field_selection *fields, arena *ar)
+    : m_tags(tag_map::key_compare(), tag_map::allocator_type(ar)) {
     initialize_fields();
-    initialize_from_message(m);
+    initialize_from_message(m, fields);
 }
 
-document::document(const pstsdk::attachment &a) {
+document::document(const pstsdk::attachment &a, bool extract_native,
+                   const field_selection *fields, arena *ar)
+    : m_tags(tag_map::key_compare(), tag_map::allocator_type(ar)) {
     initialize_fields();
     if (a.is_message()) {
-        initialize_from_message(a.open_as_message());
+        initialize_from_message(a.open_as_message(), fields);
     } else {
         property_bag props(a.get_property_bag());
         set_type(document::file);
     
-        wstring filename(a.get_filename());
-        wstring extension;
-        wstring::size_type dotpos(filename.rfind(L'.'));
-        if (dotpos != wstring::npos)
-            extension = filename.substr(dotpos + 1, wstring::npos);
+        if (wants(fields, "#FileName") || wants(fields, "#FileExtension")) {
+            string filename(wstring_to_utf8(a.get_filename()));
+            string extension;
+            string::size_type dotpos(filename.rfind('.'));
+            if (dotpos != string::npos)
+                extension = filename.substr(dotpos + 1, string::npos);
+            set_string("#FileName", filename);
+            set_string("#FileExtension", extension);
+        }
  
         // Extract the native file.
-        set_native(a.get_bytes());
+        if (extract_native) {
+            trace_span span("read attachment", "Size", a.content_size());
+            set_native(a.get_bytes());
+            (*this)["#FileSize"] = int64_t(native().size());
+        } else if (wants(fields, "#FileSize")) {
+            (*this)["#FileSize"] = int64_t(a.content_size());
+        }
 
         if (props.prop_exists(0x370e)) // PidTagAttachMimeTag
-            set_content_type(props.read_prop<wstring>(0x370e));
-        (*this)[L"#FileName"] = filename;
-        (*this)[L"#FileExtension"] = extension;
-        (*this)[L"#FileSize"] = int64_t(native().size());
-
-        if (has_prop(a, &attachment::get_entry_id))
-            (*this)[L"#EntryID"] =
-                string_to_wstring(bytes_to_hex_string(a.get_entry_id()));
+            set_content_type(read_utf8_prop(props, 0x370e));
+
+        if (wants(fields, "#EntryID") &&
+            has_prop(a, &attachment::get_entry_id))
+            set_string("#EntryID", bytes_to_hex_string(a.get_entry_id()));
     }
 }
 
-wstring document::type_string() const {
+string document::type_string() const {
     switch (type()) {
-        case message: return L"Message";
-        case file: return L"File";
+        case message: return "Message";
+        case file: return "File";
         default:
             throw runtime_error("Cannot convert document type to string");
     }
 }
 
-any &document::operator[](const wstring &key) {
+any &document::operator[](const string &key) {
     return m_tags[key];
 }
 
-const any document::operator[](const wstring &key) const {
+void document::set_string(const string &key, const string &value) {
+    // Assigning a finished tag_string to an any would copy it a second
+    // time, so build it in place.
+    any &tag(m_tags[key]);
+    tag = tag_string(tag_string::allocator_type(m_tags.get_allocator()));
+    any_cast<tag_string &>(tag).assign(value.data(), value.size());
+}
+
+void document::set_strings(const string &key, const vector<string> &values) {
+    tag_string::allocator_type alloc(m_tags.get_allocator());
+    any &tag(m_tags[key]);
+    tag = tag_string_list(alloc);
+    tag_string_list &list(any_cast<tag_string_list &>(tag));
+    list.reserve(values.size());
+    for (size_t i = 0; i < values.size(); ++i)
+        list.emplace_back(values[i].data(), values[i].size(), alloc);
+}
+
+const any *document::find_tag(const string &key) const {
+    tag_map::const_iterator found(m_tags.find(key));
+    return found == m_tags.end() ? NULL : &found->second;
+}
+
+const any document::operator[](const string &key) const {
     tag_map::const_iterator found(m_tags.find(key));
     if (found == m_tags.end())
         return any();
@@ -253,12 +430,34 @@ void document::set_native(const vector<uint8_t> &native) {
     m_native = native;
 }
 
-void document::set_text(const wstring &text) {
+void document::set_native(vector<uint8_t> &&native) {
+    m_has_native = true;
+    m_native = std::move(native);
+}
+
+void document::set_text(const string &text) {
     m_has_text = true;
     m_text = text;
 }
 
+void document::set_text(string &&text) {
+    m_has_text = true;
+    m_text = std::move(text);
+}
+
 void document::set_html(const vector<uint8_t> &html) {
     m_has_html = true;
     m_html = html;
 }
+
+void document::set_html(vector<uint8_t> &&html) {
+    m_has_html = true;
+    m_html = std::move(html);
+}
+
+void document::discard_native_and_html() {
+    m_has_native = false;
+    vector<uint8_t>().swap(m_native);
+    m_has_html = false;
+    vector<uint8_t>().swap(m_html);
+}
@@ -22,15 +22,35 @@
 #define DOCUMENT_H
 
 #include <map>
+#include <vector>
 #include <string>
+#include <cstdint>
 #include <boost/any.hpp>
 
+#include "arena.h"
+
 namespace pstsdk {
     class message;
     class attachment;
 }
+class field_selection;
+
+/// A string tag value.  These live in their document's arena, if it has
+/// one.
+typedef std::basic_string<char, std::char_traits<char>,
+                          arena_allocator<char> > tag_string;
+
+/// A string list tag value, such as a list of email addresses.
+typedef std::vector<tag_string, arena_allocator<tag_string> > tag_string_list;
+
+/// Copy a string tag value out of its arena.
+inline std::string to_std_string(const tag_string &s) {
+    return std::string(s.data(), s.size());
+}
 
 /// An EDRM Document representing either a message or an ordinary file.
+/// All of our strings, including tag names and values, are UTF-8.  We
+/// convert strings from pstsdk exactly once, when we read them.
 class document {
 public:
     enum document_type {
@@ -40,43 +60,83 @@ public:
     };
 
 private:
-    std::wstring m_id;
+    std::string m_id;
     document_type m_type;
-    std::wstring m_content_type;
+    std::string m_content_type;
 
-    typedef std::map<std::wstring, boost::any> tag_map;
+    typedef std::pair<const std::string, boost::any> tag;
+    typedef std::map<std::string, boost::any, std::less<std::string>,
+                     arena_allocator<tag> > tag_map;
     tag_map m_tags;
 
     bool m_has_native;
     std::vector<uint8_t> m_native;
     bool m_has_text;
-    std::wstring m_text;
+    std::string m_text;
     bool m_has_html;
     std::vector<uint8_t> m_html;
 
     void initialize_fields();
-    void initialize_from_message(const pstsdk::message &m);
+    void initialize_from_message(const pstsdk::message &m,
+                                 const field_selection *fields);
 
 public:
     typedef tag_map::const_iterator tag_iterator;
 
-    document() { initialize_fields(); }
-    explicit document(const pstsdk::message &m);
-    explicit document(const pstsdk::attachment &a);
-
-    std::wstring id() const { return m_id; }
-    document &set_id(const std::wstring &id) { m_id = id; return *this; }
+    /// Create a new document.  If 'ar' is specified, our tags will be
+    /// allocated from it, and the document must be destroyed before the
+    /// arena is reset.
+    explicit document(arena *ar = NULL)
+        : m_tags(tag_map::key_compare(), tag_map::allocator_type(ar))
+        { initialize_fields(); }
+    /// Create a document from a message.  If 'fields' is specified, we
+    /// only read what it selects.
+    explicit document(const pstsdk::message &m,
+                      const field_selection *fields = NULL,
+                      arena *ar = NULL);
+    /// Create a document from an attachment.  If 'extract_native' is
+    /// false, we don't read the attachment's bytes, and the document will
+    /// have no native file.
+    explicit document(const pstsdk::attachment &a,
+                      bool extract_native = true,
+                      const field_selection *fields = NULL,
+                      arena *ar = NULL);
+
+    std::string id() const { return m_id; }
+    document &set_id(const std::string &id) { m_id = id; return *this; }
 
     document_type type() const { return m_type; }
     document &set_type(document_type t) { m_type = t; return *this; }
-    std::wstring type_string() const;
+    std::string type_string() const;
 
-    std::wstring content_type() const { return m_content_type; }
-    document &set_content_type(const std::wstring &ct)
+    std::string content_type() const { return m_content_type; }
+    document &set_content_type(const std::string &ct)
         { m_content_type = ct; return *this; }
 
-    boost::any &operator[](const std::wstring &key);
-    const boost::any operator[](const std::wstring &key) const;
+    boost::any &operator[](const std::string &key);
+    const boost::any operator[](const std::string &key) const;
+
+    /// The tag 'key', or NULL if we don't have it.  Unlike operator[],
+    /// this neither adds the tag nor copies its value.
+    const boost::any *find_tag(const std::string &key) const;
+
+    /// Do we have a non-empty value for the tag 'key'?
+    bool has_tag(const std::string &key) const {
+        const boost::any *value(find_tag(key));
+        return value != NULL && !value->empty();
+    }
+
+    /// Set the tag 'key' to a copy of the string 'value'.  Use this
+    /// instead of operator[] for strings, so that the copy goes into our
+    /// arena.
+    void set_string(const std::string &key, const std::string &value);
+
+    /// Set the tag 'key' to a copy of the string list 'values'.
+    void set_strings(const std::string &key,
+                     const std::vector<std::string> &values);
+
+    /// Remove the tag 'key', if we have it.
+    void erase(const std::string &key) { m_tags.erase(key); }
 
     tag_iterator tag_begin() const { return m_tags.begin(); }
     tag_iterator tag_end() const { return m_tags.end(); }
@@ -84,6 +144,9 @@ public:
     /// Set the native file associated with this document.
     void set_native(const std::vector<uint8_t> &native);
 
+    /// Take ownership of 'native' without copying it.
+    void set_native(std::vector<uint8_t> &&native);
+
     /// Does this document have an associated native file?
     bool has_native() const { return m_has_native; }
 
@@ -92,24 +155,34 @@ public:
     const std::vector<uint8_t> &native() const { return m_native; }
 
     /// Set the plain text associated with this document.
-    void set_text(const std::wstring &text);
+    void set_text(const std::string &text);
+
+    /// Take ownership of 'text' without copying it.
+    void set_text(std::string &&text);
 
     /// Does this document have associated plain text?
     bool has_text() const { return m_has_text; }
 
     /// The plain text associated with this document.
     /// \pre has_text() == true
-    const std::wstring &text() const { return m_text; }
+    const std::string &text() const { return m_text; }
 
     /// Set the HTML associated with this document.
     void set_html(const std::vector<uint8_t> &html);
 
+    /// Take ownership of 'html' without copying it.
+    void set_html(std::vector<uint8_t> &&html);
+
     /// Does this document have associated HTML?
     bool has_html() const { return m_has_html; }
 
     /// An HTML representation of this document.
     /// \pre has_html() == true
     const std::vector<uint8_t> &html() const { return m_html; }
+
+    /// Free our native file and HTML once they've been written out.
+    /// Afterwards, has_native() and has_html() are false.
+    void discard_native_and_html();
 };
 
 #endif // DOCUMENT_H
@@ -25,6 +25,7 @@
 #include <pstsdk/pst.h>
 
 #include "document.h"
+#include "field_selection.h"
 
 using namespace std;
 using boost::any_cast;
@@ -60,12 +61,12 @@ void document_should_have_a_zero_arg_constructor() {
 
 void document_should_have_an_id_a_type_and_a_content_type() {
     document d;
-    d.set_id(L"DOC1").set_type(document::message);
-    assert(L"DOC1" == d.id());
+    d.set_id("DOC1").set_type(document::message);
+    assert("DOC1" == d.id());
     assert(document::message == d.type());
 
-    d.set_content_type(L"message/rfc822");
-    assert(L"message/rfc822" == d.content_type());
+    d.set_content_type("message/rfc822");
+    assert("message/rfc822" == d.content_type());
 }
 
 void document_should_have_native_text_and_html_fields() {
@@ -78,21 +79,53 @@ void document_should_have_native_text_and_html_fields() {
     assert(d.has_native());
     assert(data == d.native());
 
-    d.set_text(L"Hello!");
+    d.set_text("Hello!");
     assert(d.has_text());
-    assert(L"Hello!" == d.text());
+    assert("Hello!" == d.text());
 
     d.set_html(data);
     assert(d.has_html());
     assert(data == d.html());
 }
 
+void document_should_take_ownership_of_temporary_payloads() {
+    document d;
+
+    vector<uint8_t> native(1000, 'x');
+    const uint8_t *native_data(&native[0]);
+    d.set_native(std::move(native));
+    assert(native_data == &d.native()[0]);
+
+    vector<uint8_t> html(1000, 'y');
+    const uint8_t *html_data(&html[0]);
+    d.set_html(std::move(html));
+    assert(html_data == &d.html()[0]);
+
+    string text(1000, 'z');
+    d.set_text(std::move(text));
+    assert(d.has_text());
+    assert(string(1000, 'z') == d.text());
+}
+
+void document_should_discard_native_and_html_but_keep_text() {
+    document d;
+    d.set_native(vector<uint8_t>(10, 'x'));
+    d.set_html(vector<uint8_t>(10, 'y'));
+    d.set_text("Hello!");
+    d.discard_native_and_html();
+    assert(!d.has_native());
+    assert(d.native().empty());
+    assert(!d.has_html());
+    assert(d.html().empty());
+    assert("Hello!" == d.text());
+}
+
 void document_should_be_able_to_translate_type_to_string() {
     document d;
     d.set_type(document::message);
-    assert(L"Message" == d.type_string());
+    assert("Message" == d.type_string());
     d.set_type(document::file);
-    assert(L"File" == d.type_string());
+    assert("File" == d.type_string());
 
     bool caught_exception = false;
     try {
@@ -106,36 +139,58 @@ void document_should_be_able_to_translate_type_to_string() {
 
 void document_tags_should_be_accessible_using_subscript_operator() {
     document d;
-    d[L"#Subject"] = wstring(L"Hello!");
-    assert(L"Hello!" == any_cast<wstring>(d[L"#Subject"]));
-    d[L"#Subject"] = wstring(L"Hello, again!");
-    assert(L"Hello, again!" == any_cast<wstring>(d[L"#Subject"]));
+    d.set_string("#Subject", "Hello!");
+    assert("Hello!" == any_cast<tag_string>(d["#Subject"]));
+    d.set_string("#Subject", "Hello, again!");
+    assert("Hello, again!" == any_cast<tag_string>(d["#Subject"]));
 
     const document &cd(d);
-    assert(L"Hello, again!" == any_cast<wstring>(cd[L"#Subject"]));
+    assert("Hello, again!" == any_cast<tag_string>(cd["#Subject"]));
 }
 
 void document_tags_should_default_to_boost_any_empty() {
     document d;
-    assert(d[L"#Nonexistent"].empty());
+    assert(d["#Nonexistent"].empty());
 
     const document &cd(d);
-    assert(cd[L"#Nonexistent"].empty());
+    assert(cd["#Nonexistent"].empty());
 }
 
 void document_tags_should_support_iteration() {
     document d;
-    d[L"#Subject"] = wstring(L"Hello!");
+    d.set_string("#Subject", "Hello!");
     document::tag_iterator i(d.tag_begin());
     size_t count = 0;
     for (; i != d.tag_end(); ++i) {
-        assert(L"#Subject" == i->first);
-        assert(L"Hello!" == any_cast<wstring>(i->second));
+        assert("#Subject" == i->first);
+        assert("Hello!" == any_cast<tag_string>(i->second));
         ++count;
     }
     assert(1 == count);
 }
 
+void document_tags_should_be_allocated_from_arena_if_supplied() {
+    arena_block_pool pool;
+    arena a(pool);
+    {
+        document d(&a);
+        d.set_string("#Subject", "Hello!");
+        vector<string> to;
+        to.push_back("Foo <foo@example.com>");
+        d.set_strings("#To", to);
+        assert(a.bytes_allocated() > 0);
+        const tag_string &subject(any_cast<const tag_string &>(
+                                      *d.find_tag("#Subject")));
+        assert(&a == subject.get_allocator().get_arena());
+        assert("Hello!" == subject);
+        const tag_string_list &list(any_cast<const tag_string_list &>(
+                                        *d.find_tag("#To")));
+        assert(&a == list[0].get_allocator().get_arena());
+    }
+    a.reset();
+    assert(pool.free_blocks() > 0);
+}
+
 void document_from_message_should_fill_in_basic_edrm_data() {
     pst test_pst(L"test_data/flags_jane_doe.pst");
     message m(find_by_subject(test_pst, L"Unread email (do not open)"));
@@ -144,25 +199,51 @@ void document_from_message_should_fill_in_basic_edrm_data() {
     // DocId
     assert(document::message == d.type());
     // MimeType
-    assert(L"John Doe <pst-test-1@aranetic.com>" ==
-           any_cast<vector<wstring> >(d[L"#From"])[0]);
-    assert(L"Jane Doe <pst-test-2@aranetic.com>" ==
-           any_cast<vector<wstring> >(d[L"#To"])[0]);
-    assert(d[L"#CC"].empty());
-    assert(d[L"#BCC"].empty());
-    assert(L"Unread email (do not open)" == any_cast<wstring>(d[L"#Subject"]));
-    assert(L"Return-Path:" == any_cast<wstring>(d[L"#Header"]).substr(0, 12));
+    assert("John Doe <pst-test-1@aranetic.com>" ==
+           any_cast<tag_string_list>(d["#From"])[0]);
+    assert("Jane Doe <pst-test-2@aranetic.com>" ==
+           any_cast<tag_string_list>(d["#To"])[0]);
+    assert(d["#CC"].empty());
+    assert(d["#BCC"].empty());
+    assert("Unread email (do not open)" ==
+           any_cast<tag_string>(d["#Subject"]));
+    assert("Return-Path:" ==
+           any_cast<tag_string>(d["#Header"]).substr(0, 12));
     assert(from_iso_string("20100624T191617Z") ==
-           any_cast<ptime>(d[L"#DateSent"]));
+           any_cast<ptime>(d["#DateSent"]));
     assert(from_iso_string("20100624T191619Z") ==
-           any_cast<ptime>(d[L"#DateReceived"]));
-    assert(false == any_cast<bool>(d[L"#HasAttachments"]));
-    assert(0 == any_cast<int32_t>(d[L"#AttachmentCount"]));
-    assert(d[L"#AttachmentNames"].empty());
-    assert(false == any_cast<bool>(d[L"#ReadFlag"]));
-    assert(false == any_cast<bool>(d[L"#ImportanceFlag"]));
-    assert(L"IPM.Note" == any_cast<wstring>(d[L"#MessageClass"]));
-    assert(d[L"#FlagStatus"].empty());
+           any_cast<ptime>(d["#DateReceived"]));
+    assert(false == any_cast<bool>(d["#HasAttachments"]));
+    assert(0 == any_cast<int32_t>(d["#AttachmentCount"]));
+    assert(d["#AttachmentNames"].empty());
+    assert(false == any_cast<bool>(d["#ReadFlag"]));
+    assert(false == any_cast<bool>(d["#ImportanceFlag"]));
+    assert("IPM.Note" == any_cast<tag_string>(d["#MessageClass"]));
+    assert(d["#FlagStatus"].empty());
+}
+
+void document_from_message_should_only_read_selected_fields() {
+    pst test_pst(L"test_data/flags_jane_doe.pst");
+    message m(find_by_subject(test_pst, L"Unread email (do not open)"));
+    vector<string> tags, files;
+    tags.push_back("Subject");
+    tags.push_back("#DateSent");
+    files.push_back("none");
+    field_selection fields;
+    fields.select_tags(tags);
+    fields.select_files(files);
+    document d(m, &fields);
+
+    assert("Unread email (do not open)" ==
+           any_cast<tag_string>(d["#Subject"]));
+    assert(from_iso_string("20100624T191617Z") ==
+           any_cast<ptime>(d["#DateSent"]));
+    assert(d["#From"].empty());
+    assert(d["#To"].empty());
+    assert(d["#Header"].empty());
+    assert(d["#HasAttachments"].empty());
+    assert(!d.has_text());
+    assert(!d.has_html());
 }
 
 void document_from_message_should_fill_in_message_id() {
@@ -171,8 +252,8 @@ void document_from_message_should_fill_in_message_id() {
     document d(m);
     
     // Non-standard EDRM tag.
-    assert(L"<004701cb16cf$2a5fe4c0$7f1fae40$@aranetic.com>" ==
-           any_cast<wstring>(d[L"#MessageID"]));
+    assert("<004701cb16cf$2a5fe4c0$7f1fae40$@aranetic.com>" ==
+           any_cast<tag_string>(d["#MessageID"]));
 }
 
 void document_from_message_should_fill_in_mapi_entry_id() {
@@ -182,10 +263,10 @@ void document_from_message_should_fill_in_mapi_entry_id() {
     document a(*m.attachment_begin());
 
     // Non-standard EDRM tag.
-    assert(L"000000006a552b813c43f94384f18b7da2393e9500200024" ==
-           any_cast<wstring>(d[L"#EntryID"]));
-    assert(L"000000006a552b813c43f94384f18b7da2393e9500008025" ==
-           any_cast<wstring>(a[L"#EntryID"]));
+    assert("000000006a552b813c43f94384f18b7da2393e9500200024" ==
+           any_cast<tag_string>(d["#EntryID"]));
+    assert("000000006a552b813c43f94384f18b7da2393e9500008025" ==
+           any_cast<tag_string>(a["#EntryID"]));
 }
 
 void document_from_message_should_handle_alternative_smtp_recipient_info() {
@@ -193,8 +274,8 @@ void document_from_message_should_handle_alternative_smtp_recipient_info() {
     message m(find_by_subject(test_pst, L"Here is a sample message"));
     document d(m);
 
-    assert(L"Terry Mahaffey <terrymah@microsoft.com>" ==
-           any_cast<vector<wstring> >(d[L"#To"])[0]);
+    assert("Terry Mahaffey <terrymah@microsoft.com>" ==
+           any_cast<tag_string_list>(d["#To"])[0]);
 }
 
 void document_from_message_should_handle_various_recipient_types() {
@@ -202,36 +283,36 @@ void document_from_message_should_handle_various_recipient_types() {
     message m(find_by_subject(test_pst, L"Multiple recipients"));
     document d(m);
 
-    vector<wstring> to(any_cast<vector<wstring> >(d[L"#To"]));
+    tag_string_list to(any_cast<tag_string_list>(d["#To"]));
     assert(2 == to.size());
-    assert(L"John Doe <pst-test-1@aranetic.com>" == to[0]);
-    assert(L"Jane Doe <pst-test-2@aranetic.com>" == to[1]);
+    assert("John Doe <pst-test-1@aranetic.com>" == to[0]);
+    assert("Jane Doe <pst-test-2@aranetic.com>" == to[1]);
 
-    vector<wstring> cc(any_cast<vector<wstring> >(d[L"#CC"]));
+    tag_string_list cc(any_cast<tag_string_list>(d["#CC"]));
     assert(2 == cc.size());
-    assert(L"pst-test-3@aranetic.com" == cc[0]);
-    assert(L"pst-test-4@aranetic.com" == cc[1]);
+    assert("pst-test-3@aranetic.com" == cc[0]);
+    assert("pst-test-4@aranetic.com" == cc[1]);
 }
 
 void document_from_message_should_mark_read_messages() {
     pst test_pst(L"test_data/flags_jane_doe.pst");
     message m(find_by_subject(test_pst, L"Needed a response, and has one"));
     document d(m);
-    assert(true == any_cast<bool>(d[L"#ReadFlag"]));
+    assert(true == any_cast<bool>(d["#ReadFlag"]));
 }
 
 void document_from_message_should_mark_important_messages() {
     pst test_pst(L"test_data/flags_jane_doe.pst");
     message m(find_by_subject(test_pst, L"This email is important!"));
     document d(m);
-    assert(true == any_cast<bool>(d[L"#ImportanceFlag"]));
+    assert(true == any_cast<bool>(d["#ImportanceFlag"]));
 }
 
 void document_from_message_should_include_flag_status() {
     pst test_pst(L"test_data/flags_jane_doe.pst");
     message m(find_by_subject(test_pst, L"Needs response"));
     document d(m);
-    assert(L"2" == any_cast<wstring>(d[L"#FlagStatus"]));
+    assert("2" == any_cast<tag_string>(d["#FlagStatus"]));
 }
 
 void document_from_message_should_include_attachment_metadata() {
@@ -239,12 +320,12 @@ void document_from_message_should_include_attachment_metadata() {
     message m(find_by_subject(test_pst, L"Here is a sample message"));
     document d(m);
 
-    assert(true == any_cast<bool>(d[L"#HasAttachments"]));
-    assert(1 == any_cast<int32_t>(d[L"#AttachmentCount"]));
+    assert(true == any_cast<bool>(d["#HasAttachments"]));
+    assert(1 == any_cast<int32_t>(d["#AttachmentCount"]));
 
-    vector<wstring> names(any_cast<vector<wstring> >(d[L"#AttachmentNames"]));
+    tag_string_list names(any_cast<tag_string_list>(d["#AttachmentNames"]));
     assert(1 == names.size());
-    assert(L"leah_thumper.jpg" == names[0]);
+    assert("leah_thumper.jpg" == names[0]);
 }
 
 void document_from_message_should_use_subject_as_message_attachment_filename() {
@@ -252,8 +333,8 @@ void document_from_message_should_use_subject_as_message_attachment_filename() {
     message m(find_by_subject(test_pst, L"Outermost message"));
     document d(m);
 
-    vector<wstring> names(any_cast<vector<wstring> >(d[L"#AttachmentNames"]));
-    assert(L"Middle message" == names[0]);
+    tag_string_list names(any_cast<tag_string_list>(d["#AttachmentNames"]));
+    assert("Middle message" == names[0]);
 }
 
 void document_from_message_should_extract_text_file() {
@@ -261,7 +342,7 @@ void document_from_message_should_extract_text_file() {
     message m(find_by_subject(test_pst, L"Unread email (do not open)"));
     document d(m);
 
-    wstring expected(L"This email has never been read.");
+    string expected("This email has never been read.");
     assert(d.has_text());
     assert(expected == d.text().substr(0, expected.size()));
 }
@@ -291,10 +372,10 @@ void document_from_attachment_should_fill_in_basic_edrm_data() {
 
     // DocId
     assert(document::file == d.type());
-    assert(L"" == d.content_type()); // No MIME types in this file.
-    assert(L"leah_thumper.jpg" == any_cast<wstring>(d[L"#FileName"]));
-    assert(L"jpg" == any_cast<wstring>(d[L"#FileExtension"]));
-    assert(93142 == any_cast<int64_t>(d[L"#FileSize"]));
+    assert("" == d.content_type()); // No MIME types in this file.
+    assert("leah_thumper.jpg" == any_cast<tag_string>(d["#FileName"]));
+    assert("jpg" == any_cast<tag_string>(d["#FileExtension"]));
+    assert(93142 == any_cast<int64_t>(d["#FileSize"]));
     // Unsupported: #DateCreated, #DateAccessed, #DateModified, #DatePrinted
     // (plus Microsoft Office metadata, but that's not our problem for now)
 }
@@ -307,7 +388,7 @@ void document_from_attachment_should_include_mime_type() {
     message m3(m2.attachment_begin()->open_as_message());
     document d(*m3.attachment_begin());
     
-    assert(L"text/plain" == d.content_type());
+    assert("text/plain" == d.content_type());
 }
 
 void document_from_attachment_should_extract_native_file() {
@@ -328,19 +409,24 @@ void document_from_attachment_should_recognize_submessage_attachment() {
     // We only check a few fields, on the assumption this uses the same
     // codepath as regular messages.
     assert(document::message == d.type());
-    assert(L"This is an embedded message" == any_cast<wstring>(d[L"#Subject"]));
+    assert("This is an embedded message" ==
+           any_cast<tag_string>(d["#Subject"]));
 }
 
 int document_spec(int argc, char **argv) {
     document_should_have_a_zero_arg_constructor();
     document_should_have_an_id_a_type_and_a_content_type();
     document_should_have_native_text_and_html_fields();
+    document_should_discard_native_and_html_but_keep_text();
+    document_should_take_ownership_of_temporary_payloads();
 
     document_tags_should_be_accessible_using_subscript_operator();
     document_tags_should_default_to_boost_any_empty();
     document_tags_should_support_iteration();
+    document_tags_should_be_allocated_from_arena_if_supplied();
 
     document_from_message_should_fill_in_basic_edrm_data();
+    document_from_message_should_only_read_selected_fields();
     document_from_message_should_fill_in_message_id();
     document_from_message_should_fill_in_mapi_entry_id();
     // Add PidTagSentRepresenting* fields to #From?
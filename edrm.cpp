@@ -18,13 +18,13 @@
 // You should have received a copy of the GNU Affero General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <cstdio>
 #include <vector>
 #include <sstream>
 
 #include <boost/any.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/foreach.hpp>
-#include <boost/lexical_cast.hpp>
 #include <pstsdk/pst.h>
 
 #include "utilities.h"
@@ -32,102 +32,112 @@
 #include "edrm.h"
 #include "xml_context.h"
 #include "rfc822.h"
+#include "traversal.h"
+#include "trace.h"
 
 using namespace std;
 using boost::any;
 using boost::any_cast;
-using boost::lexical_cast;
 using namespace boost::gregorian;
 using namespace boost::posix_time;
 using namespace boost::filesystem;
 using namespace pstsdk;
 
 /// Return an official EDRM TagDataType string for 'value'.
-wstring edrm_tag_data_type(const any &value) {
-    if (value.type() == typeid(wstring))
-        return L"Text";
-    else if (value.type() == typeid(vector<wstring>))
-        return L"Text";
+string edrm_tag_data_type(const any &value) {
+    if (value.type() == typeid(tag_string))
+        return "Text";
+    else if (value.type() == typeid(tag_string_list))
+        return "Text";
     else if (value.type() == typeid(int32_t))
-        return L"Integer";
+        return "Integer";
     else if (value.type() == typeid(ptime))
-        return L"DateTime";
+        return "DateTime";
     else if (value.type() == typeid(bool))
-        return L"Boolean";
+        return "Boolean";
     else if (value.type() == typeid(int64_t))
-        return L"LongInteger";
+        return "LongInteger";
 
     throw runtime_error("Unable to determine EDRM TagDataType for value");
 }
 
-namespace {
-    template <typename T>
-    wstring to_tag_value(const T& value) {
-        wostringstream out;
-        out << value;
-        return out.str();
-    }
+void edrm_sink::begin() {
+    xml_context &x(loadfile());
+    x.lt("Root").attr("DataInterchangeType", "Update").gt();
+    x.lt("Batch").gt();
+    x.lt("Documents").gt();
+}
 
-    template <>
-    wstring to_tag_value(const vector<wstring> &values) {
-        wstring result;
-        bool first = true;
-        BOOST_FOREACH(wstring v, values) {
-            if (first)
-                first = false;
-            else
-                result += L";";
-            result += v;
-        }
-        return result;
+namespace {
+    void output_tag(xml_context &x, document::tag_iterator kv) {
+        x.lt("Tag")
+            .attr("TagName", kv->first)
+            .attr("TagValue", loadfile_tag_value(kv->second))
+            .attr("TagDataType", edrm_tag_data_type(kv->second))
+            .slash_gt();
     }
 
-    template <>
-    wstring to_tag_value(const ptime &value) {
-        return string_to_wstring(to_iso_extended_string(value)) + L"Z";
-    }
+    void output_file(xml_context &x, const loadfile_file &f) {
+        // Format these into fixed-size buffers to avoid allocating.
+        char size[24];
+        int size_length(snprintf(size, sizeof(size), "%llu",
+                                 static_cast<unsigned long long>(f.size)));
 
-    template <>
-    wstring to_tag_value(const bool &value) {
-        return value ? L"true" : L"false";
+        x.lt("File").attr("FileType", f.file_type).gt();
+        x.lt("ExternalFile")
+            .attr("FileName", f.filename)
+            .attr("FileSize", size, size_length);
+        if (f.digests.algorithms & digest_md5) {
+            std::array<char, 33> hash(hex_digest(f.digests.md5));
+            x.attr("Hash", hash.data(), hash.size() - 1);
+        }
+        if (f.digests.algorithms & digest_sha1) {
+            std::array<char, 41> hash(hex_digest(f.digests.sha1));
+            x.attr("SHA1Hash", hash.data(), hash.size() - 1);
+        }
+        if (f.digests.algorithms & digest_sha256) {
+            std::array<char, 65> hash(hex_digest(f.digests.sha256));
+            x.attr("SHA256Hash", hash.data(), hash.size() - 1);
+        }
+        x.slash_gt();
+        x.end_tag("File");
     }
 }
 
-// Convert a C++ value to an EDRM TagValue string for serialization to XML.
-wstring edrm_tag_value(const any &value) {
-    if (value.type() == typeid(wstring))
-        return any_cast<wstring>(value);
-    else if (value.type() == typeid(vector<wstring>))
-        return to_tag_value(any_cast<vector<wstring> >(value));
-    else if (value.type() == typeid(int32_t))
-        return to_tag_value(any_cast<int32_t>(value));
-    else if (value.type() == typeid(ptime))
-        return to_tag_value(any_cast<ptime>(value));
-    else if (value.type() == typeid(bool))
-        return to_tag_value(any_cast<bool>(value));
-    else if (value.type() == typeid(int64_t))
-        return to_tag_value(any_cast<int64_t>(value));
-
-    throw runtime_error("Unable to output EDRM TagValue for value");
-}
+void edrm_sink::output_document(const document &d,
+                                const vector<loadfile_file> &files) {
+    trace_span span("serialize XML");
+    xml_context &x(loadfile());
 
-/// Generate a unique document identifier.  We try to keep these to 8
-/// characters for the few remaining legal shops that use 8.3 filenames.
-wstring edrm_context::next_doc_id() {
-    size_t id = m_next_doc_id++;
-    wostringstream out;
-    out << L"d" << setw(7) << setfill(L'0') << id;
-    return out.str();
+    x.lt("Document")
+        .attr("DocID", d.id())
+        .attr("DocType", d.type_string());
+    if (d.content_type() != "")
+        x.attr("MimeType", d.content_type());
+    x.gt();
+
+    x.lt("Files").gt();
+    BOOST_FOREACH(const loadfile_file &f, files)
+        output_file(x, f);
+    x.end_tag("Files");
+
+    x.lt("Tags").gt();
+    document::tag_iterator ti(d.tag_begin());
+    for (; ti != d.tag_end(); ++ti)
+        output_tag(x, ti);
+    x.end_tag("Tags");
+
+    x.end_tag("Document");
 }
 
-void edrm_context::relationship(const wstring &type,
-                                const wstring &parent_doc_id,
-                                const wstring &child_doc_id) {
+void edrm_sink::relationship(const string &type,
+                             const string &parent_doc_id,
+                             const string &child_doc_id) {
     relationship_info r(type, parent_doc_id, child_doc_id);
     m_relationships.push_back(r);
 }
 
-void edrm_context::output_relationships() {
+void edrm_sink::output_relationships() {
     xml_context &x(loadfile());
     x.lt("Relationships").gt();
     
@@ -142,138 +152,493 @@ void edrm_context::output_relationships() {
     x.end_tag("Relationships");
 }
 
+void edrm_sink::end() {
+    xml_context &x(loadfile());
+    x.end_tag("Documents");
+    output_relationships();
+    x.end_tag("Batch");
+    x.end_tag("Root");
+}
+
+edrm_context::edrm_context(ostream &out, const path &out_dir)
+    : m_edrm(new edrm_sink(out)), m_out_dir(out_dir), m_next_doc_id(1),
+      m_digests(digest_md5), m_headers(out_dir), m_message_text(false),
+      m_dedup(NULL) {
+    add_sink(*m_edrm);
+}
+
+xml_context &edrm_context::loadfile() {
+    if (!m_edrm)
+        throw runtime_error("No EDRM loadfile for this context");
+    return m_edrm->loadfile();
+}
+
+/// Generate a unique document identifier.  We try to keep these to 8
+/// characters for the few remaining legal shops that use 8.3 filenames.
+string edrm_context::next_doc_id() {
+    size_t id = m_next_doc_id++;
+    ostringstream out;
+    out << "d" << setw(7) << setfill('0') << id;
+    return out.str();
+}
+
+string edrm_context::volume() const {
+    return path(m_out_dir.leaf()).string();
+}
+
+const loadfile_file *edrm_context::find_payload(const payload_key &key) const {
+    map<payload_key, loadfile_file>::const_iterator found(m_payloads.find(key));
+    return found == m_payloads.end() ? NULL : &found->second;
+}
+
+void edrm_context::add_payload(const payload_key &key,
+                               const loadfile_file &file) {
+    m_payloads.insert(make_pair(key, file));
+}
+
+void edrm_context::begin() {
+    BOOST_FOREACH(loadfile_sink *sink, m_sinks)
+        sink->begin();
+}
+
+void edrm_context::output_document(const document &d,
+                                   const vector<loadfile_file> &files) {
+    BOOST_FOREACH(loadfile_sink *sink, m_sinks)
+        sink->output_document(d, files);
+}
+
+void edrm_context::relationship(const string &type,
+                                const string &parent_doc_id,
+                                const string &child_doc_id) {
+    BOOST_FOREACH(loadfile_sink *sink, m_sinks)
+        sink->relationship(type, parent_doc_id, child_doc_id);
+}
+
+void edrm_context::output_relationships() {
+    if (!m_edrm)
+        throw runtime_error("No EDRM loadfile for this context");
+    m_edrm->output_relationships();
+}
+
+void edrm_context::end() {
+    BOOST_FOREACH(loadfile_sink *sink, m_sinks)
+        sink->end();
+}
+
 namespace {
-    wstring native_filename(const document &d) {
-        wstring filename(d.id());
-        any extension(d[L"#FileExtension"]);
-        if (!extension.empty())
-            filename += L"." + any_cast<wstring>(extension);
+    string native_filename(const document &d) {
+        string filename(d.id());
+        const any *extension(d.find_tag("#FileExtension"));
+        if (extension != NULL && !extension->empty()) {
+            const tag_string &ext(any_cast<const tag_string &>(*extension));
+            filename += '.';
+            filename.append(ext.data(), ext.size());
+        }
         return filename;
     }
 
-    void output_tag(edrm_context &edrm, document::tag_iterator kv) {
-        edrm.loadfile().lt("Tag")
-            .attr("TagName", kv->first)
-            .attr("TagValue", edrm_tag_value(kv->second))
-            .attr("TagDataType", edrm_tag_data_type(kv->second))
-            .slash_gt();
-    }
+    // How much we write and hash at a time.  Each chunk is hashed right
+    // after it is written, while it's still in the CPU's cache.
+    const size_t output_chunk_size = 64 * 1024;
+
+    // Writes one of our output files a chunk at a time, calculating our
+    // configured digests as the data goes past.
+    class file_writer : boost::noncopyable {
+        edrm_context &m_edrm;
+        string m_filename;
+        path m_path;
+        ofstream m_file;
+        multi_digest m_digest;
+        uint64_t m_size;
+
+    public:
+        file_writer(edrm_context &edrm, const string &filename)
+            : m_edrm(edrm), m_filename(filename),
+              m_path(edrm.out_dir() / filename),
+              m_file(m_path.file_string().c_str(),
+                     ios_base::out | ios_base::trunc | ios_base::binary),
+              m_digest(edrm.digests()), m_size(0) {}
+
+        void write(const char *data, size_t size) {
+            {
+                trace_span write_span("write file");
+                m_file.write(data, size);
+            }
+            {
+                trace_span hash_span("hash");
+                m_digest.update(data, size);
+            }
+            m_size += size;
+            m_edrm.watchdog().check();
+        }
 
-    void output_file(edrm_context &edrm, const wstring &edrm_file_type,
-                     const wstring &filename, const vector<uint8_t> &data) {
-        wstring size(lexical_cast<wstring>(data.size()));
-        wstring hash(string_to_wstring(md5(data)));
+        // Don't leave a partial file lying around.
+        void abandon() {
+            m_file.close();
+            remove(m_path);
+        }
 
-        xml_context &x(edrm.loadfile());
-        x.lt("File").attr("FileType", edrm_file_type).gt();
-        x.lt("ExternalFile")
-            .attr("FileName", filename)
-            .attr("FileSize", size)
-            .attr("Hash", hash)
-            .slash_gt();
-        x.end_tag("File");
-        
-        path native_path(edrm.out_dir() / wstring_to_string(filename));
-        ofstream f(native_path.file_string().c_str(),
-                   ios_base::out | ios_base::trunc | ios_base::binary);
-        f.write(reinterpret_cast<const char *>(&data[0]), data.size());
-        f.close();
+        loadfile_file finish(const string &edrm_file_type) {
+            m_file.close();
+            return loadfile_file(edrm_file_type, m_filename, m_size,
+                                 m_digest.finish());
+        }
+    };
+
+    // Write 'size' bytes at 'data' to 'filename', without making any
+    // copies along the way, and calculate our configured digests.
+    loadfile_file output_file(edrm_context &edrm, const string &edrm_file_type,
+                              const string &filename,
+                              const void *data, size_t size) {
+        trace_span span("output file", "Size", size);
+        file_writer writer(edrm, filename);
+        const char *p(static_cast<const char *>(data));
+        try {
+            for (size_t remaining = size; remaining > 0; ) {
+                size_t n(min(remaining, output_chunk_size));
+                writer.write(p, n);
+                p += n;
+                remaining -= n;
+            }
+        } catch (...) {
+            writer.abandon();
+            throw;
+        }
+        return writer.finish(edrm_file_type);
     }
 
-    void output_eml_file(edrm_context &edrm, const document &d) {
-        ostringstream eml;
-        document_to_rfc822(eml, d);
-        string eml_str(eml.str());
-        output_file(edrm, L"Native", d.id() + L".eml",
-                    vector<uint8_t>(eml_str.begin(), eml_str.end()));
-    }
+    // A stream buffer which passes everything written to it to a
+    // file_writer in chunks, charging our watchdog for each chunk.  This
+    // lets us write EML files without ever holding one in memory.
+    class file_writer_buf : public streambuf {
+        file_writer &m_writer;
+        message_watchdog &m_watchdog;
+        vector<char> m_buffer;
+
+        void write_buffer() {
+            size_t n(pptr() - pbase());
+            if (n > 0) {
+                m_watchdog.charge(n);
+                m_writer.write(pbase(), n);
+            }
+            setp(&m_buffer[0], &m_buffer[0] + m_buffer.size());
+        }
 
-    void output_native_file(edrm_context &edrm, const document &d) {
-        output_file(edrm, L"Native", native_filename(d), d.native());
-    }
+    protected:
+        virtual int_type overflow(int_type c) {
+            write_buffer();
+            if (!traits_type::eq_int_type(c, traits_type::eof())) {
+                *pptr() = traits_type::to_char_type(c);
+                pbump(1);
+            }
+            return traits_type::not_eof(c);
+        }
+
+        virtual int sync() {
+            write_buffer();
+            return 0;
+        }
 
-    void output_text_file(edrm_context &edrm, const document &d) {
-        string utf8_str(wstring_to_utf8(d.text()));
-        vector<uint8_t> utf8(utf8_str.begin(), utf8_str.end());
-        output_file(edrm, L"Text", d.id() + L".txt", utf8);
+    public:
+        file_writer_buf(file_writer &writer, message_watchdog &watchdog)
+            : m_writer(writer), m_watchdog(watchdog),
+              m_buffer(output_chunk_size) {
+            setp(&m_buffer[0], &m_buffer[0] + m_buffer.size());
+        }
+    };
+
+    loadfile_file output_eml_file(edrm_context &edrm, const document &d) {
+        trace_span span("render EML");
+        file_writer writer(edrm, d.id() + ".eml");
+        file_writer_buf buffer(writer, edrm.watchdog());
+        ostream eml(&buffer);
+        // Let budget_exceeded and friends escape from our stream buffer,
+        // instead of just setting badbit.
+        eml.exceptions(ios_base::badbit);
+        try {
+            document_to_rfc822(eml, d);
+            eml.flush();
+        } catch (...) {
+            writer.abandon();
+            throw;
+        }
+        return writer.finish("Native");
     }
 
-    void output_document(edrm_context &edrm, const document &d) {
-        xml_context &x(edrm.loadfile());
+    loadfile_file output_native_file(edrm_context &edrm, const document &d) {
+        const vector<uint8_t> &native(d.native());
+        return output_file(edrm, "Native", native_filename(d),
+                           native.data(), native.size());
+    }
 
-        x.lt("Document")
-            .attr("DocID", d.id())
-            .attr("DocType", d.type_string());
-        if (d.content_type() != L"")
-            x.attr("MimeType", d.content_type());
-        x.gt();
+    loadfile_file output_text_file(edrm_context &edrm, const document &d) {
+        const string &utf8(d.text());
+        return output_file(edrm, "Text", d.id() + ".txt",
+                           utf8.data(), utf8.size());
+    }
 
-        x.lt("Files").gt();
+    // Write out any files associated with 'd', adding each one to 'files'
+    // as soon as it's written, so that our caller can clean up if we're
+    // interrupted.  If 'd' has a native file, it comes first.
+    void output_files(edrm_context &edrm, const document &d,
+                      vector<loadfile_file> &files) {
+        const field_selection &fields(edrm.fields());
         if (d.type() == document::message) {
-            output_eml_file(edrm, d);
+            if (fields.native_files())
+                files.push_back(output_eml_file(edrm, d));
+            // We already have the text in memory, so writing it now saves
+            // our indexer from decoding it back out of the EML.
+            if (edrm.message_text() && fields.text_files() && d.has_text())
+                files.push_back(output_text_file(edrm, d));
         } else {
             if (d.has_native())
-                output_native_file(edrm, d);
-            if (d.has_text())
-                output_text_file(edrm, d);
+                files.push_back(output_native_file(edrm, d));
+            if (fields.text_files() && d.has_text())
+                files.push_back(output_text_file(edrm, d));
         }
-        x.end_tag("Files");
-
-        x.lt("Tags").gt();        
-        document::tag_iterator ti(d.tag_begin());
-        for (; ti != d.tag_end(); ++ti)
-            output_tag(edrm, ti);
-        x.end_tag("Tags");
+    }
 
-        x.end_tag("Document");
+    // Find the data block which holds the bytes of 'a'.  Large attachment
+    // data lives in a subnode of the attachment's node, whose ID is stored
+    // in place of PidTagAttachDataBinary's heap ID.  Small attachments are
+    // stored inline in the property heap, and aren't worth caching, so we
+    // return false for those.
+    bool find_payload_key(const attachment &a, payload_key &key) {
+        const property_bag &props(a.get_property_bag());
+        if (!props.prop_exists(0x3701)) // PidTagAttachDataBinary
+            return false;
+
+        // Reading a variable-size property as a 4-byte integer gives us
+        // its HNID, without reading the value itself.
+        node_id id(props.read_prop<slong>(0x3701));
+        if (!is_subnode_id(id))
+            return false;
+        const node &n(props.get_node());
+        node::const_subnodeinfo_iterator i(n.subnode_info_begin());
+        for (; i != n.subnode_info_end(); ++i) {
+            if (i->id == id) {
+                key = payload_key(i->data_bid, a.content_size());
+                return true;
+            }
+        }
+        return false;
     }
 
-    void output_message(edrm_context &edrm, const message &m,
-                        const document *attached_to = NULL);
+    // Converts each item we visit into a document, and passes it along to
+    // our loadfile sinks.  We write each document's files as soon as it's
+    // built, but we hold back its loadfile entries until its top-level
+    // message is finished.  So a skipped message never leaves anything
+    // in a loadfile, and we only need to remove its files.
+    class loadfile_visitor : public pst_visitor {
+        // A document whose files have been written, waiting for the rest
+        // of its top-level message.  We've already freed its native file
+        // and HTML.
+        struct pending_document {
+            std::shared_ptr<document> doc;
+            string parent_id;
+            vector<loadfile_file> files;
+            bool near_duplicates;
+            bool fingerprinted;
+            message_fingerprint fingerprint;
+            bool shares_payload;
+            payload_key key;
+
+            pending_document(document *d, const string &parent)
+                : doc(d), parent_id(parent), near_duplicates(true),
+                  fingerprinted(false), shares_payload(false), key(0, 0) {}
+        };
+
+        edrm_context &m_edrm;
+        message_watchdog &m_watchdog;
+
+        // The tags of every document in our current top-level message.
+        // These must be declared before m_pending, which refers to them.
+        arena_block_pool m_arena_pool;
+        arena m_arena;
+
+        // The DocIDs of the messages we're currently inside.
+        vector<string> m_parents;
+
+        // How deeply we're nested inside a duplicate message, whose
+        // attachments we skip, or 0 if we aren't.
+        int m_duplicate_depth;
+
+        // Everything in our current top-level message, in order.
+        vector<pending_document> m_pending;
+
+        // Every file we've written for our current top-level message,
+        // which we remove if it's skipped.  Files we share with earlier
+        // messages aren't included.
+        vector<loadfile_file> m_new_files;
+
+        // Approximately how much memory 'd' uses for its content.
+        static uint64_t document_bytes(const document &d) {
+            uint64_t bytes(d.text().size());
+            if (d.has_native())
+                bytes += d.native().size();
+            if (d.has_html())
+                bytes += d.html().size();
+            return bytes;
+        }
 
-    void output_attachment(edrm_context &edrm, const attachment &a,
-                           const document *attached_to) {
-        if (a.is_message()) {
-            output_message(edrm, a.open_as_message(), attached_to);
-        } else {
-            document d(a);
-            d.set_id(edrm.next_doc_id());
-            output_document(edrm, d);
-            edrm.relationship(L"Attachment", attached_to->id(), d.id());
+        string parent_id() const {
+            return m_parents.empty() ? string() : m_parents.back();
         }
-    }
 
-    void output_message(edrm_context &edrm, const message &m,
-                        const document *attached_to) {
-        document d(m);
-        d.set_id(edrm.next_doc_id());
-        output_document(edrm, d);
-        if (attached_to)
-            edrm.relationship(L"Attachment", attached_to->id(), d.id());
-
-        if (m.get_attachment_count() > 0) {
-            message::attachment_iterator ai(m.attachment_begin());
-            for (; ai != m.attachment_end(); ++ai)
-                output_attachment(edrm, *ai, &d);
+        // Write the files for 'p', and remember them.
+        void write_files(pending_document &p) {
+            size_t first(m_new_files.size());
+            output_files(m_edrm, *p.doc, m_new_files);
+            p.files.assign(m_new_files.begin() + first, m_new_files.end());
         }
-    }
+
+        // Pass everything in our finished top-level message to our sinks.
+        void flush() {
+            dedup_db *db(m_edrm.dedup());
+            BOOST_FOREACH(pending_document &p, m_pending) {
+                document &d(*p.doc);
+                trace_document traced(d.id());
+                if (p.near_duplicates)
+                    m_edrm.near_duplicates().tag(d);
+
+                // Anything we read only for our own use goes now.  Our
+                // EML file needed the headers, but it's been written.
+                m_edrm.fields().drop_unwritten_tags(d);
+                m_edrm.headers().store(d);
+                if (!p.parent_id.empty())
+                    m_edrm.relationship("Attachment", p.parent_id, d.id());
+                m_edrm.output_document(d, p.files);
+
+                if (p.shares_payload)
+                    m_edrm.add_payload(p.key, p.files.front());
+                if (p.fingerprinted)
+                    db->add(p.fingerprint, m_edrm.volume() + "/" + d.id());
+            }
+            m_pending.clear();
+            m_new_files.clear();
+            m_arena.reset();
+        }
+
+    public:
+        explicit loadfile_visitor(edrm_context &edrm)
+            : m_edrm(edrm), m_watchdog(edrm.watchdog()),
+              m_arena(m_arena_pool), m_duplicate_depth(0) {}
+
+        virtual void begin_message(const message &m, bool embedded) {
+            if (m_duplicate_depth > 0) {
+                ++m_duplicate_depth;
+                return;
+            }
+
+            string id(m_edrm.next_doc_id());
+            trace_document traced(id);
+            if (!embedded)
+                m_watchdog.begin_message(m.get_id(), id);
+            m_watchdog.check();
+
+            trace_span build("build document", "NodeID", m.get_id());
+            m_pending.push_back(pending_document(
+                new document(m, &m_edrm.fields(), &m_arena), parent_id()));
+            pending_document &p(m_pending.back());
+            document &d(*p.doc);
+            build.finish();
+            d.set_id(id);
+            m_watchdog.charge(document_bytes(d));
+            m_watchdog.check();
+            if (!embedded)
+                m_edrm.threads().tag(m.get_id(), d);
+
+            // Duplicates are written as metadata-only references to the
+            // first copy, without any files or attachments.  We only
+            // remember the first copy once it's safely in our loadfiles.
+            dedup_db *db(m_edrm.dedup());
+            message_fingerprint fp;
+            bool fingerprinted(db != NULL && fingerprint_message(d, fp));
+            string first_copy;
+            if (fingerprinted && db->find(fp, first_copy)) {
+                d.set_string("#DuplicateOf", first_copy);
+                p.near_duplicates = false;
+                m_duplicate_depth = 1;
+            } else {
+                write_files(p);
+                p.fingerprinted = fingerprinted;
+                p.fingerprint = fp;
+            }
+            d.discard_native_and_html();
+            m_parents.push_back(id);
+        }
+
+        virtual void file_attachment(const attachment &a) {
+            if (m_duplicate_depth > 0)
+                return;
+            m_watchdog.check();
+
+            // If we've already written this attachment's bytes, don't
+            // bother to read, hash or write them again.
+            payload_key key(0, 0);
+            bool have_key(find_payload_key(a, key));
+            const loadfile_file *written(have_key ? m_edrm.find_payload(key)
+                                         : NULL);
+            bool extract(!written && m_edrm.fields().native_files());
+            if (extract)
+                m_watchdog.charge(a.content_size());
+
+            string id(m_edrm.next_doc_id());
+            trace_document traced(id);
+
+            trace_span build("build document");
+            m_pending.push_back(pending_document(
+                new document(a, extract, &m_edrm.fields(), &m_arena),
+                parent_id()));
+            pending_document &p(m_pending.back());
+            document &d(*p.doc);
+            build.finish();
+            d.set_id(id);
+
+            if (written) {
+                p.files.push_back(*written);
+            } else {
+                write_files(p);
+                p.shares_payload = have_key && d.has_native();
+                p.key = key;
+            }
+            d.discard_native_and_html();
+        }
+
+        virtual void end_message(const message &m) {
+            if (m_duplicate_depth > 0 && --m_duplicate_depth > 0)
+                return;
+            m_parents.pop_back();
+            if (!m_parents.empty())
+                return;
+            flush();
+            m_watchdog.end_message();
+        }
+
+        virtual void skipped_message(const skip_message &reason) {
+            BOOST_FOREACH(const loadfile_file &f, m_new_files)
+                remove(m_edrm.out_dir() / f.filename);
+            m_new_files.clear();
+            m_pending.clear();
+            m_arena.reset();
+            m_parents.clear();
+            m_duplicate_depth = 0;
+            m_watchdog.skip_message(reason.what());
+        }
+    };
+}
+
+/// Process every message in 'pst_file' exactly once, passing the results
+/// to all the sinks registered with 'edrm'.
+void convert_to_loadfiles(shared_ptr<pst> pst_file, edrm_context &edrm) {
+    edrm.begin();
+    loadfile_visitor visitor(edrm);
+    walk_pst(*pst_file, visitor);
+    edrm.end();
 }
 
 void convert_to_edrm(shared_ptr<pst> pst_file, ostream &loadfile,
                      const path &output_directory) {
     edrm_context edrm(loadfile, output_directory);
-    xml_context &x(edrm.loadfile());
-
-    x.lt("Root").attr("DataInterchangeType", L"Update").gt();
-    x.lt("Batch").gt();
-    x.lt("Documents").gt();
-
-    pst::message_iterator mi(pst_file->message_begin());
-    for (; mi != pst_file->message_end(); ++mi)
-        output_message(edrm, *mi);
-
-    x.end_tag("Documents");
-    edrm.output_relationships();
-    x.end_tag("Batch");
-    x.end_tag("Root");
+    convert_to_loadfiles(pst_file, edrm);
 }
@@ -22,50 +22,165 @@
 #define EDRM_H
 
 #include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
 #include <boost/utility.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/filesystem.hpp>
 
 #include "xml_context.h"
+#include "loadfile.h"
+#include "watchdog.h"
+#include "header_store.h"
+#include "near_duplicates.h"
+#include "dedup.h"
+#include "thread_index.h"
+#include "field_selection.h"
 
 namespace boost { class any; }
 namespace pstsdk { class pst; }
 
-extern std::wstring edrm_tag_data_type(const boost::any &value);
-extern std::wstring edrm_tag_value(const boost::any &value);
+extern std::string edrm_tag_data_type(const boost::any &value);
 
-/// This class holds various information needed to generate EDRM output.
-class edrm_context : boost::noncopyable {
+/// A loadfile_sink which writes an EDRM XML loadfile.
+class edrm_sink : public loadfile_sink {
     xml_context m_loadfile;
-    boost::filesystem::path m_out_dir;
-    size_t m_next_doc_id;
 
     struct relationship_info {
-        std::wstring type;
-        std::wstring parent_doc_id;
-        std::wstring child_doc_id;
+        std::string type;
+        std::string parent_doc_id;
+        std::string child_doc_id;
 
-        relationship_info(const std::wstring &t,
-                          const std::wstring &p,
-                          const std::wstring &c)
+        relationship_info(const std::string &t,
+                          const std::string &p,
+                          const std::string &c)
             : type(t), parent_doc_id(p), child_doc_id(c) {}
     };
 
     std::vector<relationship_info> m_relationships;
 
 public:
-    edrm_context(std::ostream &out, const boost::filesystem::path &out_dir)
-        : m_loadfile(out), m_out_dir(out_dir), m_next_doc_id(1) { }
+    explicit edrm_sink(std::ostream &out) : m_loadfile(out) {}
 
     xml_context &loadfile() { return m_loadfile; }
+
+    virtual void begin();
+    virtual void output_document(const document &d,
+                                 const std::vector<loadfile_file> &files);
+    virtual void relationship(const std::string &type,
+                              const std::string &parent_doc_id,
+                              const std::string &child_doc_id);
+    virtual void end();
+
+    void output_relationships();
+};
+
+/// Identifies the stored bytes of an attachment within a PST.  Two
+/// attachments backed by the same data block and with the same size have
+/// identical contents.
+struct payload_key {
+    uint64_t data_block_id;
+    uint64_t size;
+
+    payload_key(uint64_t b, uint64_t s) : data_block_id(b), size(s) {}
+
+    bool operator<(const payload_key &other) const {
+        return (data_block_id < other.data_block_id ||
+                (data_block_id == other.data_block_id && size < other.size));
+    }
+};
+
+/// This class holds various information needed to generate EDRM output,
+/// and passes each document along to every registered loadfile_sink.
+class edrm_context : boost::noncopyable {
+    boost::scoped_ptr<edrm_sink> m_edrm;
+    boost::filesystem::path m_out_dir;
+    size_t m_next_doc_id;
+    std::vector<loadfile_sink *> m_sinks;
+    digest_set m_digests;
+    std::map<payload_key, loadfile_file> m_payloads;
+    message_watchdog m_watchdog;
+    header_store m_headers;
+    bool m_message_text;
+    near_duplicate_index m_near_duplicates;
+    thread_index m_threads;
+    field_selection m_fields;
+    dedup_db *m_dedup;
+
+public:
+    /// Write an EDRM XML loadfile to 'out', and nothing else.
+    edrm_context(std::ostream &out, const boost::filesystem::path &out_dir);
+
+    /// Don't write any loadfiles until sinks are added with add_sink.
+    explicit edrm_context(const boost::filesystem::path &out_dir)
+        : m_out_dir(out_dir), m_next_doc_id(1), m_digests(digest_md5),
+          m_headers(out_dir), m_message_text(false), m_dedup(NULL) { }
+
+    /// Send all further output to 'sink' as well.  We do not take
+    /// ownership.
+    void add_sink(loadfile_sink &sink) { m_sinks.push_back(&sink); }
+
+    /// The XML context for our EDRM loadfile.
+    /// \pre We were constructed with an output stream.
+    xml_context &loadfile();
     boost::filesystem::path out_dir() const { return m_out_dir; }
-    std::wstring next_doc_id();
+    std::string next_doc_id();
+
+    /// The digests we calculate for each file we write.  Defaults to MD5.
+    digest_set digests() const { return m_digests; }
+    void set_digests(digest_set digests) { m_digests = digests; }
+
+    /// Our per-message time and memory budgets.
+    message_watchdog &watchdog() { return m_watchdog; }
+
+    /// Where we write transport headers.  Defaults to inline.
+    header_store &headers() { return m_headers; }
+
+    /// The tags and files we produce.  Defaults to everything.
+    field_selection &fields() { return m_fields; }
+
+    /// Do we write a Text file for each message, as well as its EML?
+    /// Defaults to false.
+    bool message_text() const { return m_message_text; }
+    void set_message_text(bool message_text)
+        { m_message_text = message_text; }
+
+    /// Groups near-duplicate documents.  Disabled by default.
+    near_duplicate_index &near_duplicates() { return m_near_duplicates; }
+
+    /// Conversation threads for top-level messages.  Empty unless someone
+    /// builds it before we convert the PST.
+    thread_index &threads() { return m_threads; }
+
+    /// The database of messages we've already written, or NULL if we
+    /// aren't deduplicating.  We do not take ownership.
+    dedup_db *dedup() { return m_dedup; }
+    void set_dedup(dedup_db *db) { m_dedup = db; }
+
+    /// The name of our output directory, which identifies this run in
+    /// our dedup database.
+    std::string volume() const;
+
+    /// The native file we already wrote for the payload 'key', or NULL if
+    /// we haven't seen it yet during this run.
+    const loadfile_file *find_payload(const payload_key &key) const;
+
+    /// Remember that we wrote 'file' for the payload 'key'.
+    void add_payload(const payload_key &key, const loadfile_file &file);
 
-    void relationship(const std::wstring &type,
-                      const std::wstring &parent_doc_id,
-                      const std::wstring &child_doc_id);
+    void begin();
+    void output_document(const document &d,
+                         const std::vector<loadfile_file> &files);
+    void relationship(const std::string &type,
+                      const std::string &parent_doc_id,
+                      const std::string &child_doc_id);
     void output_relationships();
+    void end();
 };
 
+extern void convert_to_loadfiles(std::shared_ptr<pstsdk::pst> pst_file,
+                                 edrm_context &edrm);
 extern void convert_to_edrm(std::shared_ptr<pstsdk::pst> pst_file,
                             std::ostream &loadfile,
                             const boost::filesystem::path &output_directory);
@@ -25,6 +25,7 @@
 #include <boost/any.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
+#include "document.h"
 #include "edrm.h"
 #include "xml_context.h"
 
@@ -39,13 +40,13 @@ namespace {
 
 // A type which we don't support outputting to EDRM files.
 void edrm_tag_data_type_should_infer_type_from_value() {
-    assert(L"Text" == edrm_tag_data_type(wstring()));
-    assert(L"Text" == edrm_tag_data_type(vector<wstring>()));
-    assert(L"Integer" == edrm_tag_data_type(int32_t(0)));
-    assert(L"DateTime" == edrm_tag_data_type(ptime()));
-    //assert(L"Decimal" == edrm_tag_data_type(0.0));  (Float, unused)
-    assert(L"Boolean" == edrm_tag_data_type(true));
-    assert(L"LongInteger" == edrm_tag_data_type(int64_t(0)));
+    assert("Text" == edrm_tag_data_type(tag_string()));
+    assert("Text" == edrm_tag_data_type(tag_string_list()));
+    assert("Integer" == edrm_tag_data_type(int32_t(0)));
+    assert("DateTime" == edrm_tag_data_type(ptime()));
+    //assert("Decimal" == edrm_tag_data_type(0.0));  (Float, unused)
+    assert("Boolean" == edrm_tag_data_type(true));
+    assert("LongInteger" == edrm_tag_data_type(int64_t(0)));
 }
 
 void edrm_tag_data_type_should_raise_error_if_type_unknown() {
@@ -58,32 +59,6 @@ void edrm_tag_data_type_should_raise_error_if_type_unknown() {
     assert(caught_exception);
 }
 
-void edrm_tag_value_should_format_value_appropriately() {
-    assert(L"Text" == edrm_tag_value(wstring(L"Text")));
-
-    vector<wstring> v;
-    v.push_back(L"Foo");
-    v.push_back(L"Bar");
-    assert(L"Foo;Bar" == edrm_tag_value(v));
-
-    assert(L"-1" == edrm_tag_value(int32_t(-1)));
-    assert(L"2002-01-31T23:59:59Z" ==
-           edrm_tag_value(from_iso_string("20020131T235959Z")));
-    assert(L"true" == edrm_tag_value(true));
-    assert(L"false" == edrm_tag_value(false));
-    assert(L"-1" == edrm_tag_value(int64_t(-1)));
-}
-
-void edrm_tag_value_should_raise_error_if_type_unknown() {
-    bool caught_exception(false);
-    try {
-        edrm_tag_value(value_of_unsupported_type);
-    } catch (std::exception &) {
-        caught_exception = true;
-    }
-    assert(caught_exception);
-}
-
 void edrm_context_should_have_xml_context_for_loadfile() {
     ostringstream out;
     edrm_context edrm(out, path());
@@ -100,15 +75,15 @@ void edrm_context_should_have_output_directory() {
 void edrm_context_should_generate_doc_ids() {
     ostringstream out;
     edrm_context edrm(out, path());
-    assert(L"d0000001" == edrm.next_doc_id());
-    assert(L"d0000002" == edrm.next_doc_id());
+    assert("d0000001" == edrm.next_doc_id());
+    assert("d0000002" == edrm.next_doc_id());
 }
 
 void edrm_context_should_store_relations_and_output_later() {
     ostringstream out;
     edrm_context edrm(out, path());
-    edrm.relationship(L"Attachment", L"d1", L"d2");
-    edrm.relationship(L"Discussion", L"d1", L"d3");
+    edrm.relationship("Attachment", "d1", "d2");
+    edrm.relationship("Discussion", "d1", "d3");
     edrm.output_relationships();
 
     const char *expected =
@@ -120,17 +95,57 @@ void edrm_context_should_store_relations_and_output_later() {
     assert(expected == out.str());
 }
 
+void edrm_context_should_pass_documents_to_all_sinks() {
+    ostringstream csv1_out, csv2_out;
+    csv_sink csv1(csv1_out), csv2(csv2_out);
+    edrm_context edrm((path()));
+    edrm.add_sink(csv1);
+    edrm.add_sink(csv2);
+
+    document d;
+    d.set_id("d0000001").set_type(document::message);
+    edrm.begin();
+    edrm.output_document(d, vector<loadfile_file>());
+    edrm.end();
+
+    assert(string::npos != csv1_out.str().find("\"d0000001\""));
+    assert(csv1_out.str() == csv2_out.str());
+}
+
+void edrm_context_should_remember_written_payloads() {
+    edrm_context edrm((path()));
+    payload_key key(42, 1000);
+    assert(NULL == edrm.find_payload(key));
+
+    edrm.add_payload(key, loadfile_file("Native", "d0000002.pdf", 1000,
+                                        file_digests()));
+    const loadfile_file *found(edrm.find_payload(key));
+    assert(found != NULL);
+    assert("d0000002.pdf" == found->filename);
+
+    // The same block with a different size is a different payload.
+    assert(NULL == edrm.find_payload(payload_key(42, 999)));
+}
+
+void edrm_context_should_only_write_message_text_when_asked() {
+    edrm_context edrm((path()));
+    assert(!edrm.message_text());
+    edrm.set_message_text(true);
+    assert(edrm.message_text());
+}
+
 int edrm_spec(int argc, char **argv) {
     edrm_tag_data_type_should_infer_type_from_value();
     edrm_tag_data_type_should_raise_error_if_type_unknown();
 
-    edrm_tag_value_should_format_value_appropriately();
-    edrm_tag_value_should_raise_error_if_type_unknown();
 
     edrm_context_should_have_xml_context_for_loadfile();
     edrm_context_should_have_output_directory();
     edrm_context_should_generate_doc_ids();
     edrm_context_should_store_relations_and_output_later();
+    edrm_context_should_pass_documents_to_all_sinks();
+    edrm_context_should_remember_written_payloads();
+    edrm_context_should_only_write_message_text_when_asked();
 
     return 0;
 }
@@ -0,0 +1,102 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include <stdexcept>
+
+#include "document.h"
+#include "field_selection.h"
+
+using namespace std;
+
+namespace {
+    // The tags we need to write native files: those which
+    // document_to_rfc822 writes into each EML file, and the extension we
+    // give each attachment.  EML files only mention #Header to point at
+    // our loadfiles, so it's only worth reading if we write it there.
+    const char *native_file_tags[] = {
+        "#From", "#To", "#CC", "#BCC", "#Subject", "#DateSent",
+        "#FileExtension", NULL
+    };
+
+    // header_store replaces #Header with these.
+    const char *stored_header_tags[] = {
+        "#HeaderFile", "#HeaderOffset", "#HeaderLength", NULL
+    };
+
+    bool is_one_of(const string &tag, const char **tags) {
+        for (const char **t = tags; *t != NULL; ++t)
+            if (tag == *t)
+                return true;
+        return false;
+    }
+
+    string tag_name(const string &name) {
+        return (!name.empty() && name[0] == '#') ? name : "#" + name;
+    }
+}
+
+void field_selection::select_tags(const vector<string> &tags) {
+    m_all_tags = false;
+    for (size_t i = 0; i < tags.size(); ++i)
+        if (!tags[i].empty())
+            m_tags.insert(tag_name(tags[i]));
+}
+
+void field_selection::select_files(const vector<string> &types) {
+    m_native_files = m_text_files = false;
+    for (size_t i = 0; i < types.size(); ++i) {
+        if (types[i] == "native")
+            m_native_files = true;
+        else if (types[i] == "text")
+            m_text_files = true;
+        else if (types[i] != "none")
+            throw runtime_error("Unknown file type: " + types[i]);
+    }
+}
+
+void field_selection::require_tag(const string &tag) {
+    m_required_tags.insert(tag_name(tag));
+}
+
+bool field_selection::reads_tag(const string &tag) const {
+    return (writes_tag(tag) ||
+            m_required_tags.find(tag) != m_required_tags.end() ||
+            (m_native_files && is_one_of(tag, native_file_tags)));
+}
+
+bool field_selection::writes_tag(const string &tag) const {
+    if (m_all_tags || m_tags.find(tag) != m_tags.end())
+        return true;
+    return (is_one_of(tag, stored_header_tags) &&
+            m_tags.find("#Header") != m_tags.end());
+}
+
+void field_selection::drop_unwritten_tags(document &d) const {
+    if (m_all_tags)
+        return;
+    vector<string> unwritten;
+    for (document::tag_iterator i = d.tag_begin(); i != d.tag_end(); ++i)
+        if (!writes_tag(i->first))
+            unwritten.push_back(i->first);
+    for (size_t i = 0; i < unwritten.size(); ++i)
+        d.erase(unwritten[i]);
+}
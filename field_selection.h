@@ -0,0 +1,89 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#ifndef FIELD_SELECTION_H
+#define FIELD_SELECTION_H
+
+#include <set>
+#include <string>
+#include <vector>
+
+class document;
+
+/// Which tags and files we produce for each document.  By default we
+/// produce everything, but when an export only needs a few fields, we
+/// can avoid reading message bodies, attachment tables and properties
+/// which nobody will see.
+class field_selection {
+    bool m_all_tags;
+    std::set<std::string> m_tags;
+    std::set<std::string> m_required_tags;
+    bool m_native_files;
+    bool m_text_files;
+    bool m_needs_text;
+
+public:
+    field_selection()
+        : m_all_tags(true), m_native_files(true), m_text_files(true),
+          m_needs_text(false) {}
+
+    /// Only produce the tags in 'tags', which may be given either as tag
+    /// names such as "#Subject" or column names such as "Subject".
+    void select_tags(const std::vector<std::string> &tags);
+
+    /// Only produce the file types in 'types', which may include "native"
+    /// and "text", or be just "none".  Throws std::runtime_error if it
+    /// contains anything else.
+    void select_files(const std::vector<std::string> &types);
+
+    /// Read 'tag' even if it wasn't selected, because something other
+    /// than our loadfiles needs it.  We still don't write it.
+    void require_tag(const std::string &tag);
+
+    /// Read message bodies even if we don't write any files, because
+    /// something such as our full-text index needs the text.
+    void require_text() { m_needs_text = true; }
+
+    /// Should we read the tag 'tag' from the PST?  Native files for
+    /// messages are EML files, which need the sender, recipients, subject
+    /// and date, and attachments need their extensions, so we always read
+    /// those when writing native files.
+    bool reads_tag(const std::string &tag) const;
+
+    /// Should we write the tag 'tag' to our loadfiles?
+    bool writes_tag(const std::string &tag) const;
+
+    /// Remove every tag from 'd' which we shouldn't write, including tags
+    /// which were added after 'd' was read.
+    void drop_unwritten_tags(document &d) const;
+
+    /// Should we write native files and extracted text files?
+    bool native_files() const { return m_native_files; }
+    bool text_files() const { return m_text_files; }
+
+    /// Do we need to read message bodies?  Our EML files need them, but
+    /// text files are only written for messages on request, so whoever
+    /// asks for those must also call require_text.
+    bool wants_bodies() const { return m_native_files || m_needs_text; }
+};
+
+#endif // FIELD_SELECTION_H
@@ -0,0 +1,141 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include <cassert>
+#include <iterator>
+#include <stdexcept>
+
+#include "document.h"
+#include "field_selection.h"
+
+using namespace std;
+
+namespace {
+    vector<string> names(const char *a, const char *b = NULL) {
+        vector<string> result;
+        result.push_back(a);
+        if (b)
+            result.push_back(b);
+        return result;
+    }
+}
+
+void field_selection_should_select_everything_by_default() {
+    field_selection fields;
+    assert(fields.reads_tag("#Subject"));
+    assert(fields.writes_tag("#AttachmentNames"));
+    assert(fields.native_files());
+    assert(fields.text_files());
+    assert(fields.wants_bodies());
+}
+
+void field_selection_should_accept_tag_and_column_names() {
+    field_selection fields;
+    fields.select_tags(names("Subject", "#MessageID"));
+    assert(fields.writes_tag("#Subject"));
+    assert(fields.writes_tag("#MessageID"));
+    assert(!fields.reads_tag("#AttachmentNames"));
+    assert(!fields.writes_tag("#AttachmentNames"));
+
+    // Our EML files need these, but we don't write them.
+    assert(fields.reads_tag("#From"));
+    assert(!fields.writes_tag("#From"));
+
+    // Our EML files only mention the headers when we write them.
+    assert(!fields.reads_tag("#Header"));
+    fields.select_files(names("text"));
+    assert(!fields.reads_tag("#From"));
+}
+
+void field_selection_should_write_stored_headers_with_header() {
+    field_selection fields;
+    fields.select_tags(names("Subject"));
+    assert(!fields.writes_tag("#HeaderFile"));
+    fields.select_tags(names("Header"));
+    assert(fields.writes_tag("#HeaderFile"));
+    assert(fields.writes_tag("#HeaderLength"));
+}
+
+void field_selection_should_select_file_types() {
+    field_selection fields;
+    fields.select_files(names("none"));
+    assert(!fields.native_files());
+    assert(!fields.text_files());
+    assert(!fields.wants_bodies());
+    fields.require_text();
+    assert(fields.wants_bodies());
+
+    // We only write text files for messages when asked to, and that
+    // requires the text explicitly.
+    field_selection text_only;
+    text_only.select_files(names("text"));
+    assert(text_only.text_files());
+    assert(!text_only.wants_bodies());
+
+    fields.select_files(names("native", "text"));
+    assert(fields.native_files());
+    assert(fields.text_files());
+
+    bool threw(false);
+    try {
+        fields.select_files(names("pdf"));
+    } catch (runtime_error &) {
+        threw = true;
+    }
+    assert(threw);
+}
+
+void field_selection_should_read_but_not_write_required_tags() {
+    field_selection fields;
+    fields.select_tags(names("Subject"));
+    fields.select_files(names("none"));
+    assert(!fields.reads_tag("#MessageID"));
+    fields.require_tag("MessageID");
+    assert(fields.reads_tag("#MessageID"));
+    assert(!fields.writes_tag("#MessageID"));
+}
+
+void field_selection_should_drop_unwritten_tags() {
+    field_selection fields;
+    fields.select_tags(names("Subject", "ThreadID"));
+    document d;
+    d.set_string("#Subject", "Hi");
+    d.set_string("#ThreadID", "0123456789abcdef");
+    d.set_string("#MessageID", "<a@example.com>");
+    d.set_string("#NearDupGroup", "d0000001");
+    fields.drop_unwritten_tags(d);
+
+    const document &const_d(d);
+    assert(2 == distance(const_d.tag_begin(), const_d.tag_end()));
+    assert(const_d.find_tag("#Subject") != NULL);
+    assert(const_d.find_tag("#ThreadID") != NULL);
+}
+
+int field_selection_spec(int argc, char **argv) {
+    field_selection_should_select_everything_by_default();
+    field_selection_should_accept_tag_and_column_names();
+    field_selection_should_select_file_types();
+    field_selection_should_write_stored_headers_with_header();
+    field_selection_should_read_but_not_write_required_tags();
+    field_selection_should_drop_unwritten_tags();
+    return 0;
+}
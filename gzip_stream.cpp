@@ -0,0 +1,210 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <zlib.h>
+
+#include <boost/bind/bind.hpp>
+
+#include "gzip_stream.h"
+#include "trace.h"
+
+using namespace std;
+
+namespace {
+    // How many buffers we allow to be in flight at once.  This limits how
+    // far the writer can get ahead of the compressor, and therefore how
+    // much memory we use.
+    const size_t max_buffers = 4;
+
+    // Ask zlib to generate a gzip header and trailer instead of a zlib one.
+    const int gzip_window_bits = 15 + 16;
+}
+
+async_gzip_streambuf::async_gzip_streambuf(ostream &out, int level,
+                                           size_t buffer_size)
+    : m_out(out), m_level(level), m_buffer_size(buffer_size),
+      m_current(buffer_size), m_buffers_in_use(1), m_closing(false)
+{
+    setp(&m_current[0], &m_current[0] + m_current.size());
+    m_thread.reset(new boost::thread(
+        boost::bind(&async_gzip_streambuf::compress_loop, this)));
+}
+
+async_gzip_streambuf::~async_gzip_streambuf() {
+    try {
+        close();
+    } catch (exception &) {
+        // We can't report errors from a destructor, so callers who care
+        // should call close() themselves.
+    }
+}
+
+/// Queue our current buffer for compression, and get a fresh one,
+/// waiting for the compressor to catch up if necessary.
+void async_gzip_streambuf::hand_off_current_buffer() {
+    size_t used(pptr() - pbase());
+    if (used == 0)
+        return;
+    m_current.resize(used);
+
+    boost::unique_lock<boost::mutex> lock(m_mutex);
+    m_full.push_back(buffer());
+    m_full.back().swap(m_current);
+    m_changed.notify_all();
+
+    if (m_free.empty() && m_buffers_in_use >= max_buffers) {
+        // Our compressor has fallen behind.
+        trace_span span("wait for compressor");
+        while (m_free.empty() && m_buffers_in_use >= max_buffers)
+            m_changed.wait(lock);
+    }
+    if (m_free.empty()) {
+        ++m_buffers_in_use;
+    } else {
+        m_current.swap(m_free.back());
+        m_free.pop_back();
+    }
+    lock.unlock();
+
+    m_current.resize(m_buffer_size);
+    setp(&m_current[0], &m_current[0] + m_current.size());
+}
+
+void async_gzip_streambuf::compress_loop() {
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    bool ok(deflateInit2(&z, m_level, Z_DEFLATED, gzip_window_bits, 8,
+                         Z_DEFAULT_STRATEGY) == Z_OK);
+    if (!ok) {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_error = "Unable to initialize zlib";
+    }
+
+    vector<char> out(64 * 1024);
+    buffer in;
+    for (;;) {
+        // Wait for the next buffer, or for the writer to finish.
+        {
+            boost::unique_lock<boost::mutex> lock(m_mutex);
+            while (m_full.empty() && !m_closing)
+                m_changed.wait(lock);
+            if (m_full.empty())
+                break;
+            in.swap(m_full.front());
+            m_full.pop_front();
+        }
+
+        // If something has already gone wrong, we just recycle buffers so
+        // that the writer never blocks.  close() will report the error.
+        if (ok) {
+            trace_span span("compress", "Size", in.size());
+            z.next_in = reinterpret_cast<Bytef *>(&in[0]);
+            z.avail_in = static_cast<uInt>(in.size());
+            do {
+                z.next_out = reinterpret_cast<Bytef *>(&out[0]);
+                z.avail_out = static_cast<uInt>(out.size());
+                deflate(&z, Z_NO_FLUSH);
+                m_out.write(&out[0], out.size() - z.avail_out);
+            } while (z.avail_out == 0);
+            if (!m_out) {
+                ok = false;
+                boost::lock_guard<boost::mutex> lock(m_mutex);
+                m_error = "Error writing compressed data";
+            }
+        }
+
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        in.clear();
+        m_free.push_back(buffer());
+        m_free.back().swap(in);
+        m_changed.notify_all();
+    }
+
+    // Flush everything out of zlib, and write the gzip trailer.
+    if (ok) {
+        int result;
+        do {
+            z.next_out = reinterpret_cast<Bytef *>(&out[0]);
+            z.avail_out = static_cast<uInt>(out.size());
+            result = deflate(&z, Z_FINISH);
+            m_out.write(&out[0], out.size() - z.avail_out);
+        } while (result == Z_OK);
+        m_out.flush();
+        if (result != Z_STREAM_END || !m_out) {
+            boost::lock_guard<boost::mutex> lock(m_mutex);
+            m_error = "Error finishing compressed data";
+        }
+    }
+    deflateEnd(&z);
+}
+
+async_gzip_streambuf::int_type async_gzip_streambuf::overflow(int_type c) {
+    if (!m_thread)
+        return traits_type::eof();
+    hand_off_current_buffer();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+streamsize async_gzip_streambuf::xsputn(const char *s, streamsize n) {
+    if (!m_thread)
+        return 0;
+    streamsize remaining(n);
+    while (remaining > 0) {
+        if (pptr() == epptr())
+            hand_off_current_buffer();
+        streamsize chunk(min<streamsize>(remaining, epptr() - pptr()));
+        memcpy(pptr(), s, chunk);
+        pbump(static_cast<int>(chunk));
+        s += chunk;
+        remaining -= chunk;
+    }
+    return n;
+}
+
+/// We deliberately ignore flushes.  Our callers tend to flush after every
+/// line, and compressing tiny blocks would defeat the point.
+int async_gzip_streambuf::sync() {
+    return 0;
+}
+
+void async_gzip_streambuf::close() {
+    if (!m_thread)
+        return;
+    hand_off_current_buffer();
+    setp(NULL, NULL);
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_closing = true;
+        m_changed.notify_all();
+    }
+    m_thread->join();
+    m_thread.reset();
+
+    if (!m_error.empty())
+        throw runtime_error(m_error);
+}
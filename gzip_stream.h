@@ -0,0 +1,96 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef GZIP_STREAM_H
+#define GZIP_STREAM_H
+
+#include <iostream>
+#include <streambuf>
+#include <vector>
+#include <deque>
+#include <string>
+
+#include <boost/utility.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+/// A streambuf which gzips everything written to it and passes the
+/// compressed data along to another stream.  Compression happens on a
+/// background thread, so the writer only pays for copying bytes into our
+/// buffers.
+class async_gzip_streambuf : public std::streambuf, boost::noncopyable {
+    typedef std::vector<char> buffer;
+
+    std::ostream &m_out;
+    int m_level;
+    size_t m_buffer_size;
+
+    // The buffer we're currently filling.  This belongs to the writer.
+    buffer m_current;
+
+    // Everything below is shared with our compression thread, and
+    // protected by m_mutex.
+    boost::mutex m_mutex;
+    boost::condition_variable m_changed;
+    std::deque<buffer> m_full;
+    std::vector<buffer> m_free;
+    size_t m_buffers_in_use;
+    bool m_closing;
+    std::string m_error;
+
+    boost::scoped_ptr<boost::thread> m_thread;
+
+    void hand_off_current_buffer();
+    void compress_loop();
+
+protected:
+    virtual int_type overflow(int_type c);
+    virtual std::streamsize xsputn(const char *s, std::streamsize n);
+    virtual int sync();
+
+public:
+    async_gzip_streambuf(std::ostream &out, int level, size_t buffer_size);
+    ~async_gzip_streambuf();
+
+    /// Compress any remaining data, write the gzip trailer, and wait for
+    /// our compression thread to finish.  Throws an exception if anything
+    /// went wrong while compressing.
+    void close();
+};
+
+/// An output stream which writes gzipped data to another stream.  Be sure
+/// to call close() when you're done; flushing this stream does not force
+/// any data out.
+class async_gzip_ostream : public std::ostream {
+    async_gzip_streambuf m_buf;
+
+public:
+    explicit async_gzip_ostream(std::ostream &out, int level = 6,
+                                size_t buffer_size = 256 * 1024)
+        : std::ostream(NULL), m_buf(out, level, buffer_size)
+        { rdbuf(&m_buf); }
+
+    void close() { m_buf.close(); }
+};
+
+#endif // GZIP_STREAM_H
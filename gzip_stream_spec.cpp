@@ -0,0 +1,88 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cassert>
+#include <cstring>
+#include <sstream>
+#include <zlib.h>
+
+#include "gzip_stream.h"
+
+using namespace std;
+
+namespace {
+    string gunzip(const string &compressed) {
+        z_stream z;
+        memset(&z, 0, sizeof(z));
+        int result = inflateInit2(&z, 15 + 16);
+        assert(Z_OK == result);
+
+        string output;
+        vector<char> buffer(4096);
+        z.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(
+            compressed.data()));
+        z.avail_in = static_cast<uInt>(compressed.size());
+        do {
+            z.next_out = reinterpret_cast<Bytef *>(&buffer[0]);
+            z.avail_out = static_cast<uInt>(buffer.size());
+            result = inflate(&z, Z_NO_FLUSH);
+            assert(Z_OK == result || Z_STREAM_END == result);
+            output.append(&buffer[0], buffer.size() - z.avail_out);
+        } while (result != Z_STREAM_END);
+        inflateEnd(&z);
+        return output;
+    }
+}
+
+void async_gzip_ostream_should_write_empty_gzip_file() {
+    ostringstream out;
+    async_gzip_ostream gz(out);
+    gz.close();
+    assert("" == gunzip(out.str()));
+}
+
+void async_gzip_ostream_should_compress_data_across_many_buffers() {
+    ostringstream expected;
+    ostringstream out;
+    {
+        // Use a tiny buffer so we exercise the hand-off between threads.
+        async_gzip_ostream gz(out, 6, 100);
+        for (int i = 0; i < 10000; ++i) {
+            gz << "  <Tag TagName='#Subject' TagValue='" << i << "'/>" << endl;
+            expected << "  <Tag TagName='#Subject' TagValue='" << i << "'/>"
+                     << endl;
+        }
+        gz.put('!');
+        expected.put('!');
+        gz.close();
+        gz.close(); // Should be harmless.
+    }
+
+    assert(expected.str() == gunzip(out.str()));
+    assert(out.str().size() < expected.str().size() / 4);
+}
+
+int gzip_stream_spec(int argc, char **argv) {
+    async_gzip_ostream_should_write_empty_gzip_file();
+    async_gzip_ostream_should_compress_data_across_many_buffers();
+
+    return 0;
+}
@@ -0,0 +1,336 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include <vector>
+#include <cstdint>
+
+#include "document.h"
+#include "header_fields.h"
+#include "utilities.h"
+
+using namespace std;
+
+namespace {
+    bool is_wsp(char c) { return c == ' ' || c == '\t'; }
+
+    bool is_fws(char c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    }
+
+    char ascii_lower(char c) {
+        return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+    }
+
+    // The end of the line starting at 'p', not including its line break.
+    // Sets 'next' to the start of the following line.
+    const char *line_end(const char *p, const char *end, const char *&next) {
+        const char *nl(static_cast<const char *>(memchr(p, '\n', end - p)));
+        if (nl == NULL) {
+            next = end;
+            return end;
+        }
+        next = nl + 1;
+        return (nl > p && nl[-1] == '\r') ? nl - 1 : nl;
+    }
+
+    int hex_value(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    }
+
+    int base64_value(char c) {
+        if (c >= 'A' && c <= 'Z') return c - 'A';
+        if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+        if (c >= '0' && c <= '9') return c - '0' + 52;
+        if (c == '+') return 62;
+        if (c == '/') return 63;
+        return -1;
+    }
+
+    // Decode the text of a B encoded-word, ignoring padding and anything
+    // else which isn't Base64.
+    void decode_b(const char *p, const char *end, string &out) {
+        uint32_t bits(0);
+        int bit_count(0);
+        for (; p != end; ++p) {
+            int v(base64_value(*p));
+            if (v < 0)
+                continue;
+            bits = (bits << 6) | v;
+            bit_count += 6;
+            if (bit_count >= 8) {
+                bit_count -= 8;
+                out.push_back(char((bits >> bit_count) & 0xff));
+            }
+        }
+    }
+
+    // Decode the text of a Q encoded-word.
+    void decode_q(const char *p, const char *end, string &out) {
+        for (; p != end; ++p) {
+            if (*p == '_') {
+                out.push_back(' ');
+            } else if (*p == '=' && end - p >= 3 &&
+                       hex_value(p[1]) >= 0 && hex_value(p[2]) >= 0) {
+                out.push_back(char(hex_value(p[1]) * 16 + hex_value(p[2])));
+                p += 2;
+            } else {
+                out.push_back(*p);
+            }
+        }
+    }
+
+    enum word_charset {
+        charset_unknown,
+        charset_utf8,
+        charset_cp1252
+    };
+
+    // Identify an encoded-word's charset, ignoring any RFC 2231 language.
+    word_charset parse_charset(const char *p, const char *end) {
+        string name;
+        for (; p != end && *p != '*'; ++p)
+            name.push_back(ascii_lower(*p));
+        if (name == "utf-8" || name == "us-ascii")
+            return charset_utf8;
+        // Mail labelled ISO-8859-1 is very often really Windows-1252,
+        // which is a superset of its printable characters.
+        if (name == "iso-8859-1" || name == "windows-1252")
+            return charset_cp1252;
+        return charset_unknown;
+    }
+
+    // If an encoded-word starts at 'p', decode it onto 'out' and return a
+    // pointer just past it.  Otherwise return NULL.
+    const char *decode_word(const char *p, const char *end, string &out) {
+        // =?charset?encoding?text?=
+        const char *charset(p + 2);
+        const char *q(static_cast<const char *>(
+            memchr(charset, '?', end - charset)));
+        if (q == NULL || end - q < 4 || q[2] != '?')
+            return NULL;
+        char encoding(ascii_lower(q[1]));
+        const char *text(q + 3);
+        const char *text_end(text);
+        while (text_end + 1 < end &&
+               !(text_end[0] == '?' && text_end[1] == '='))
+            ++text_end;
+        if (text_end + 1 >= end)
+            return NULL;
+
+        word_charset cs(parse_charset(charset, q));
+        if (cs == charset_unknown || (encoding != 'b' && encoding != 'q'))
+            return NULL;
+
+        string bytes;
+        if (encoding == 'b')
+            decode_b(text, text_end, bytes);
+        else
+            decode_q(text, text_end, bytes);
+
+        if (cs == charset_utf8) {
+            out += bytes;
+        } else {
+            for (size_t i = 0; i < bytes.size(); ++i)
+                code_point_to_utf8_append(out,
+                                          cp1252_to_code_point(bytes[i]));
+        }
+        return text_end + 2;
+    }
+
+    // Split a list of message IDs, such as a References field, keeping
+    // the angle brackets.  Anything outside angle brackets is a comment.
+    void split_message_ids(const string &value, vector<string> &ids) {
+        string::size_type begin(0);
+        while ((begin = value.find('<', begin)) != string::npos) {
+            string::size_type end(value.find('>', begin));
+            if (end == string::npos)
+                break;
+            ids.push_back(value.substr(begin, end - begin + 1));
+            begin = end + 1;
+        }
+    }
+}
+
+bool header_field::is(const char *field_name) const {
+    size_t length(strlen(field_name));
+    if (length != name.size())
+        return false;
+    for (size_t i = 0; i < length; ++i)
+        if (ascii_lower(name.begin[i]) != ascii_lower(field_name[i]))
+            return false;
+    return true;
+}
+
+string header_field::unfolded() const {
+    string result;
+    result.reserve(value.size());
+    bool pending_space(false);
+    for (const char *p = value.begin; p != value.end; ++p) {
+        if (is_fws(*p)) {
+            pending_space = !result.empty();
+        } else {
+            if (pending_space)
+                result.push_back(' ');
+            pending_space = false;
+            result.push_back(*p);
+        }
+    }
+    return result;
+}
+
+string header_field::decoded() const {
+    return decode_encoded_words(unfolded());
+}
+
+bool header_tokenizer::next(header_field &field) {
+    while (m_next != m_end) {
+        const char *line(m_next);
+        const char *end(line_end(line, m_end, m_next));
+
+        // An empty line ends the header block.
+        if (end == line) {
+            m_next = m_end;
+            return false;
+        }
+
+        // Continuation lines whose field we skipped, or which have no
+        // field at all, are ignored.
+        if (is_wsp(*line))
+            continue;
+
+        // Field names are printable ASCII, but obsolete syntax allows
+        // whitespace before the colon.
+        const char *colon(line);
+        while (colon != end && *colon != ':' &&
+               *colon > ' ' && *colon <= '~')
+            ++colon;
+        const char *name_end(colon);
+        while (colon != end && is_wsp(*colon))
+            ++colon;
+        if (colon == end || *colon != ':' || name_end == line)
+            continue;
+
+        // Extend the value over any continuation lines.
+        const char *value_end(end);
+        while (m_next != m_end && is_wsp(*m_next))
+            value_end = line_end(m_next, m_end, m_next);
+
+        const char *value(colon + 1);
+        while (value != value_end && is_wsp(*value))
+            ++value;
+        field.name = text_range(line, name_end);
+        field.value = text_range(value, value_end);
+        return true;
+    }
+    return false;
+}
+
+string decode_encoded_words(const string &value) {
+    string::size_type start(value.find("=?"));
+    if (start == string::npos)
+        return value;
+
+    string result(value, 0, start);
+    const char *p(value.data() + start);
+    const char *end(value.data() + value.size());
+    bool after_word(false);
+    while (p != end) {
+        // Whitespace between two encoded-words is dropped.
+        if (after_word && is_fws(*p)) {
+            const char *q(p);
+            while (q != end && is_fws(*q))
+                ++q;
+            if (end - q >= 2 && q[0] == '=' && q[1] == '?') {
+                const char *next(decode_word(q, end, result));
+                if (next != NULL) {
+                    p = next;
+                    continue;
+                }
+            }
+            result.append(p, q);
+            p = q;
+            after_word = false;
+            continue;
+        }
+
+        if (end - p >= 2 && p[0] == '=' && p[1] == '?') {
+            const char *next(decode_word(p, end, result));
+            if (next != NULL) {
+                p = next;
+                after_word = true;
+                continue;
+            }
+        }
+        result.push_back(*p++);
+        after_word = false;
+    }
+    return result;
+}
+
+void promote_header_fields(const string &headers, document &d) {
+    bool want_message_id(!d.has_tag("#MessageID"));
+    int32_t received_hops(0);
+    vector<string> references;
+
+    header_tokenizer tokenizer(headers);
+    header_field field;
+    while (tokenizer.next(field)) {
+        // Most fields are neither of these, so check the first letter
+        // before comparing whole names.
+        switch (ascii_lower(*field.name.begin)) {
+            case 'i':
+                if (field.is("In-Reply-To") && !d.has_tag("#InReplyTo"))
+                    d.set_string("#InReplyTo", field.unfolded());
+                break;
+            case 'm':
+                if (want_message_id && field.is("Message-ID")) {
+                    d.set_string("#MessageID", field.unfolded());
+                    want_message_id = false;
+                }
+                break;
+            case 'r':
+                if (field.is("Received"))
+                    ++received_hops;
+                else if (field.is("References"))
+                    split_message_ids(field.unfolded(), references);
+                break;
+            case 'x':
+                if (field.is("X-Originating-IP") &&
+                    !d.has_tag("#OriginatingIP")) {
+                    string ip(field.unfolded());
+                    if (ip.size() >= 2 && ip[0] == '[' &&
+                        ip[ip.size() - 1] == ']')
+                        ip = ip.substr(1, ip.size() - 2);
+                    d.set_string("#OriginatingIP", ip);
+                }
+                break;
+        }
+    }
+
+    if (received_hops > 0)
+        d["#ReceivedHops"] = received_hops;
+    if (!references.empty())
+        d.set_strings("#References", references);
+}
@@ -0,0 +1,92 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#ifndef HEADER_FIELDS_H
+#define HEADER_FIELDS_H
+
+#include <string>
+#include <cstring>
+
+class document;
+
+/// A range of characters in a buffer owned by someone else.  It's only
+/// valid for as long as that buffer is.
+struct text_range {
+    const char *begin;
+    const char *end;
+
+    text_range() : begin(NULL), end(NULL) {}
+    text_range(const char *b, const char *e) : begin(b), end(e) {}
+
+    size_t size() const { return end - begin; }
+    bool empty() const { return begin == end; }
+    std::string str() const { return std::string(begin, end); }
+};
+
+/// A single header field, pointing into the header block it came from.
+/// The value is exactly as it appears in that block, so it may still be
+/// folded over several lines and contain RFC 2047 encoded-words.  We only
+/// unfold and decode the values somebody asks for.
+struct header_field {
+    text_range name;
+    text_range value;
+
+    /// Does this field have 'field_name', ignoring case?
+    bool is(const char *field_name) const;
+
+    /// The value with folding whitespace replaced by single spaces, and
+    /// leading and trailing whitespace removed.
+    std::string unfolded() const;
+
+    /// The unfolded value with any encoded-words decoded to UTF-8.
+    std::string decoded() const;
+};
+
+/// Splits an RFC 5322 header block into fields without copying it.  We
+/// stop at the first empty line, and skip any line which isn't a valid
+/// field, since real-world transport headers are often damaged.
+class header_tokenizer {
+    const char *m_next;
+    const char *m_end;
+
+public:
+    header_tokenizer(const char *begin, const char *end)
+        : m_next(begin), m_end(end) {}
+    explicit header_tokenizer(const std::string &headers)
+        : m_next(headers.data()), m_end(headers.data() + headers.size()) {}
+
+    /// Find the next field, returning false if there are none left.
+    bool next(header_field &field);
+};
+
+/// Decode any RFC 2047 encoded-words in 'value', converting them to UTF-8.
+/// We understand UTF-8, US-ASCII, ISO-8859-1 and Windows-1252, and leave
+/// encoded-words in other character sets alone.
+extern std::string decode_encoded_words(const std::string &value);
+
+/// Promote the routing and threading fields of the transport header block
+/// 'headers' to typed tags on 'd': #InReplyTo, #References,
+/// #ReceivedHops and #OriginatingIP.  We also set #MessageID if 'd'
+/// doesn't already have one.
+extern void promote_header_fields(const std::string &headers, document &d);
+
+#endif // HEADER_FIELDS_H
@@ -0,0 +1,141 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include <boost/any.hpp>
+
+#include "document.h"
+#include "header_fields.h"
+
+using namespace std;
+using boost::any_cast;
+
+namespace {
+    const char *sample_headers =
+        "Received: from mail.example.com (mail.example.com [192.0.2.1])\r\n"
+        "\tby mx.example.org; Mon, 1 Mar 2010 10:00:00 -0500\r\n"
+        "Received: from [10.0.0.1] by mail.example.com;\r\n"
+        " Mon, 1 Mar 2010 09:59:58 -0500\r\n"
+        "X-Originating-IP: [10.0.0.1]\r\n"
+        "Message-ID: <reply@example.com>\r\n"
+        "In-Reply-To: <original@example.com>\r\n"
+        "References: <root@example.com>\r\n"
+        "  <original@example.com> (the original)\r\n"
+        "Subject: =?utf-8?B?Q2Fmw6k=?= =?iso-8859-1?Q?_cr=E8me?=\r\n"
+        "\r\n"
+        "Not-A-Header: this is the body\r\n";
+
+    // Our fields point into 'headers', so it must outlive them.
+    vector<header_field> tokenize(const char *headers) {
+        vector<header_field> fields;
+        header_tokenizer tokenizer(headers, headers + strlen(headers));
+        header_field field;
+        while (tokenizer.next(field))
+            fields.push_back(field);
+        return fields;
+    }
+}
+
+void header_tokenizer_should_split_fields_in_place() {
+    string headers(sample_headers);
+    vector<header_field> fields(tokenize(headers.c_str()));
+    assert(7 == fields.size());
+    assert(fields[0].is("received"));
+    assert(fields[0].name.begin == headers.data());
+    assert("Received" == fields[0].name.str());
+    assert("from [10.0.0.1] by mail.example.com;\r\n"
+           " Mon, 1 Mar 2010 09:59:58 -0500" == fields[1].value.str());
+    assert(fields[6].is("Subject"));
+}
+
+void header_tokenizer_should_skip_damaged_lines() {
+    vector<header_field> fields(tokenize(" orphan continuation\n"
+                                         "no colon here\n"
+                                         ": no name\n"
+                                         "Subject : obsolete\n"
+                                         "Empty:\n"
+                                         "To: last"));
+    assert(3 == fields.size());
+    assert("Subject" == fields[0].name.str());
+    assert("obsolete" == fields[0].value.str());
+    assert(fields[1].value.empty());
+    assert("last" == fields[2].value.str());
+}
+
+void header_field_should_unfold_values() {
+    vector<header_field> fields(tokenize(sample_headers));
+    assert("from [10.0.0.1] by mail.example.com; "
+           "Mon, 1 Mar 2010 09:59:58 -0500" == fields[1].unfolded());
+}
+
+void decode_encoded_words_should_convert_to_utf8() {
+    assert("plain" == decode_encoded_words("plain"));
+    assert("Caf\xc3\xa9" == decode_encoded_words("=?UTF-8?B?Q2Fmw6k=?="));
+    assert("\xe2\x82\xac 5" ==
+           decode_encoded_words("=?windows-1252?q?=80_5?="));
+    assert("ab" ==
+           decode_encoded_words("=?us-ascii?Q?a?= \r\n =?us-ascii?Q?b?="));
+    assert("x a y" == decode_encoded_words("x =?us-ascii*en?Q?a?= y"));
+    assert("=?koi8-r?B?5g==?=" == decode_encoded_words("=?koi8-r?B?5g==?="));
+    assert("=?broken" == decode_encoded_words("=?broken"));
+
+    vector<header_field> fields(tokenize(sample_headers));
+    assert("Caf\xc3\xa9 cr\xc3\xa8me" == fields[6].decoded());
+}
+
+void promote_header_fields_should_tag_routing_fields() {
+    document d;
+    promote_header_fields(sample_headers, d);
+    assert(2 == any_cast<int32_t>(d["#ReceivedHops"]));
+    assert("10.0.0.1" == any_cast<tag_string>(d["#OriginatingIP"]));
+    assert("<reply@example.com>" == any_cast<tag_string>(d["#MessageID"]));
+    assert("<original@example.com>" == any_cast<tag_string>(d["#InReplyTo"]));
+    tag_string_list references(any_cast<tag_string_list>(d["#References"]));
+    assert(2 == references.size());
+    assert("<root@example.com>" == references[0]);
+    assert("<original@example.com>" == references[1]);
+}
+
+void promote_header_fields_should_keep_existing_message_id() {
+    document d;
+    d.set_string("#MessageID", "<from-mapi@example.com>");
+    promote_header_fields(sample_headers, d);
+    assert("<from-mapi@example.com>" == any_cast<tag_string>(d["#MessageID"]));
+
+    document empty;
+    promote_header_fields("", empty);
+    assert(empty["#ReceivedHops"].empty());
+    assert(empty["#References"].empty());
+}
+
+int header_fields_spec(int argc, char **argv) {
+    header_tokenizer_should_split_fields_in_place();
+    header_tokenizer_should_skip_damaged_lines();
+    header_field_should_unfold_values();
+    decode_encoded_words_should_convert_to_utf8();
+    promote_header_fields_should_tag_routing_fields();
+    promote_header_fields_should_keep_existing_message_id();
+    return 0;
+}
@@ -0,0 +1,87 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <stdexcept>
+#include <boost/any.hpp>
+
+#include "document.h"
+#include "header_store.h"
+#include "trace.h"
+
+using namespace std;
+using boost::any;
+using boost::any_cast;
+using namespace boost::filesystem;
+
+header_mode parse_header_mode(const string &name) {
+    if (name == "inline")
+        return headers_inline;
+    else if (name == "sidecar")
+        return headers_sidecar;
+    else if (name == "files")
+        return headers_files;
+    throw runtime_error("Unknown header mode: " + name);
+}
+
+const char *header_store::sidecar_filename = "headers.txt";
+
+void header_store::store(document &d) {
+    if (m_mode == headers_inline)
+        return;
+    const any *header_value(d.find_tag("#Header"));
+    if (header_value == NULL || header_value->empty())
+        return;
+    trace_span span("store headers");
+    const tag_string &header(any_cast<const tag_string &>(*header_value));
+    int64_t length(header.size());
+
+    string filename;
+    uint64_t offset(0);
+    if (m_mode == headers_sidecar) {
+        // Open our sidecar the first time we need it, so that batches
+        // without any headers don't get an empty file.
+        if (!m_sidecar.is_open()) {
+            path p(m_out_dir / sidecar_filename);
+            m_sidecar.open(p.file_string().c_str(),
+                           ios_base::out | ios_base::trunc | ios_base::binary);
+        }
+        filename = sidecar_filename;
+        offset = m_sidecar_size;
+        m_sidecar.write(header.data(), header.size());
+        if (!m_sidecar)
+            throw runtime_error("Could not write " + filename);
+        m_sidecar_size += header.size();
+    } else {
+        filename = d.id() + ".hdr";
+        path p(m_out_dir / filename);
+        ofstream f(p.file_string().c_str(),
+                   ios_base::out | ios_base::trunc | ios_base::binary);
+        f.write(header.data(), header.size());
+        if (!f)
+            throw runtime_error("Could not write " + filename);
+    }
+
+    // Careful: this invalidates 'header'.
+    d.erase("#Header");
+    d.set_string("#HeaderFile", filename);
+    d["#HeaderOffset"] = static_cast<int64_t>(offset);
+    d["#HeaderLength"] = length;
+}
@@ -0,0 +1,73 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef HEADER_STORE_H
+#define HEADER_STORE_H
+
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <boost/utility.hpp>
+#include <boost/filesystem.hpp>
+
+class document;
+
+/// Where we put each message's transport headers.
+enum header_mode {
+    /// Write headers inline, as the #Header tag.
+    headers_inline,
+    /// Append headers to a single headers.txt file for the whole batch.
+    headers_sidecar,
+    /// Write the headers for each document to their own .hdr file.
+    headers_files
+};
+
+/// Parse "inline", "sidecar" or "files" into a header_mode.
+extern header_mode parse_header_mode(const std::string &name);
+
+/// Moves transport headers out of our loadfiles, which would otherwise
+/// spend most of their space on escaped copies of them.  Each document's
+/// #Header tag is replaced by #HeaderFile, #HeaderOffset and #HeaderLength
+/// tags, which point at the raw header bytes.
+class header_store : boost::noncopyable {
+    boost::filesystem::path m_out_dir;
+    header_mode m_mode;
+    std::ofstream m_sidecar;
+    uint64_t m_sidecar_size;
+
+public:
+    explicit header_store(const boost::filesystem::path &out_dir,
+                          header_mode mode = headers_inline)
+        : m_out_dir(out_dir), m_mode(mode), m_sidecar_size(0) {}
+
+    header_mode mode() const { return m_mode; }
+    void set_mode(header_mode mode) { m_mode = mode; }
+
+    /// The name of our per-batch sidecar file.
+    static const char *sidecar_filename;
+
+    /// Write the #Header of 'd' out according to our mode, and replace it
+    /// with a reference.  Does nothing if 'd' has no headers, or if we're
+    /// writing headers inline.
+    void store(document &d);
+};
+
+#endif // HEADER_STORE_H
@@ -0,0 +1,147 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cassert>
+#include <iterator>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <boost/any.hpp>
+
+#include "document.h"
+#include "header_store.h"
+
+using namespace std;
+using boost::any_cast;
+using namespace boost::filesystem;
+
+namespace {
+    string read_file(const path &p) {
+        ifstream f(p.file_string().c_str(), ios_base::in | ios_base::binary);
+        ostringstream out;
+        out << f.rdbuf();
+        return out.str();
+    }
+
+    document document_with_header(const string &id, const string &header) {
+        document d;
+        d.set_id(id).set_type(document::message);
+        d.set_string("#Header", header);
+        return d;
+    }
+}
+
+void parse_header_mode_should_recognize_modes() {
+    assert(headers_inline == parse_header_mode("inline"));
+    assert(headers_sidecar == parse_header_mode("sidecar"));
+    assert(headers_files == parse_header_mode("files"));
+
+    bool caught = false;
+    try {
+        parse_header_mode("xml");
+    } catch (runtime_error &) {
+        caught = true;
+    }
+    assert(caught);
+}
+
+void header_store_should_leave_inline_headers_alone() {
+    header_store store(path("header_store_spec_out"));
+    document d(document_with_header("d0000001", "Subject: Hi\r\n"));
+    store.store(d);
+    assert("Subject: Hi\r\n" == any_cast<tag_string>(d["#Header"]));
+    assert(d["#HeaderFile"].empty());
+}
+
+void header_store_should_append_headers_to_sidecar() {
+    path out_dir("header_store_spec_out");
+    remove_all(out_dir);
+    create_directory(out_dir);
+    {
+        header_store store(out_dir, headers_sidecar);
+        document d1(document_with_header("d0000001", "Subject: One\r\n"));
+        document d2(document_with_header("d0000002", "Subject: Two\r\n"));
+        document d3;
+        d3.set_id("d0000003");
+        store.store(d1);
+        store.store(d2);
+        store.store(d3);
+
+        assert(d1["#Header"].empty());
+        assert("headers.txt" == any_cast<tag_string>(d1["#HeaderFile"]));
+        assert(0 == any_cast<int64_t>(d1["#HeaderOffset"]));
+        assert(14 == any_cast<int64_t>(d1["#HeaderLength"]));
+        assert("headers.txt" == any_cast<tag_string>(d2["#HeaderFile"]));
+        assert(14 == any_cast<int64_t>(d2["#HeaderOffset"]));
+        assert(14 == any_cast<int64_t>(d2["#HeaderLength"]));
+        assert(d3["#HeaderFile"].empty());
+    }
+    assert("Subject: One\r\nSubject: Two\r\n" ==
+           read_file(out_dir / "headers.txt"));
+    remove_all(out_dir);
+}
+
+void header_store_should_write_one_file_per_document() {
+    path out_dir("header_store_spec_out");
+    remove_all(out_dir);
+    create_directory(out_dir);
+    header_store store(out_dir, headers_files);
+    document d(document_with_header("d0000001", "Subject: One\r\n"));
+    store.store(d);
+
+    assert(d["#Header"].empty());
+    assert("d0000001.hdr" == any_cast<tag_string>(d["#HeaderFile"]));
+    assert(0 == any_cast<int64_t>(d["#HeaderOffset"]));
+    assert(14 == any_cast<int64_t>(d["#HeaderLength"]));
+    assert("Subject: One\r\n" == read_file(out_dir / "d0000001.hdr"));
+    assert(!exists(out_dir / "headers.txt"));
+    remove_all(out_dir);
+}
+
+void header_store_should_not_add_tags_to_documents_without_headers() {
+    path out_dir("header_store_spec_out");
+    remove_all(out_dir);
+    create_directory(out_dir);
+    header_mode modes[] = { headers_inline, headers_sidecar, headers_files };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+        header_store store(out_dir, modes[i]);
+        document d;
+        d.set_id("d0000001").set_type(document::message);
+        d.set_string("#Subject", "Draft");
+        store.store(d);
+
+        const document &const_d(d);
+        assert(1 == distance(const_d.tag_begin(), const_d.tag_end()));
+        assert(const_d.find_tag("#Header") == NULL);
+    }
+    assert(!exists(out_dir / "headers.txt"));
+    remove_all(out_dir);
+}
+
+int header_store_spec(int argc, char **argv) {
+    parse_header_mode_should_recognize_modes();
+    header_store_should_leave_inline_headers_alone();
+    header_store_should_append_headers_to_sidecar();
+    header_store_should_not_add_tags_to_documents_without_headers();
+    header_store_should_write_one_file_per_document();
+    return 0;
+}
@@ -0,0 +1,501 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <cstring>
+
+#include "utilities.h"
+#include "html.h"
+
+using namespace std;
+
+namespace {
+    // Returned by decode_utf8 for malformed input.
+    const uint32_t invalid_code_point = 0xFFFFFFFF;
+
+    bool is_alpha(uint8_t c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    bool is_digit(uint8_t c) { return c >= '0' && c <= '9'; }
+
+    bool is_space(uint32_t c) {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f';
+    }
+
+    uint8_t to_lower(uint8_t c) {
+        return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+    }
+
+    // Find 'needle', which must be lowercase, in [p, end), ignoring case.
+    const uint8_t *find_lower(const uint8_t *p, const uint8_t *end,
+                              const char *needle) {
+        size_t length(strlen(needle));
+        for (; size_t(end - p) >= length; ++p) {
+            size_t i(0);
+            while (i < length && to_lower(p[i]) == uint8_t(needle[i]))
+                ++i;
+            if (i == length)
+                return p;
+        }
+        return end;
+    }
+
+    // Decode one UTF-8 character starting at 'p', and advance past it.
+    // We always consume at least one byte.
+    uint32_t decode_utf8(const uint8_t *&p, const uint8_t *end) {
+        uint8_t lead(*p++);
+        if (lead < 0x80)
+            return lead;
+
+        size_t continuation;
+        uint32_t c, minimum;
+        if (lead >= 0xC2 && lead <= 0xDF) {
+            continuation = 1; c = lead & 0x1F; minimum = 0x80;
+        } else if (lead >= 0xE0 && lead <= 0xEF) {
+            continuation = 2; c = lead & 0x0F; minimum = 0x800;
+        } else if (lead >= 0xF0 && lead <= 0xF4) {
+            continuation = 3; c = lead & 0x07; minimum = 0x10000;
+        } else {
+            return invalid_code_point;
+        }
+
+        for (size_t i = 0; i < continuation; ++i) {
+            if (p == end || (*p & 0xC0) != 0x80)
+                return invalid_code_point;
+            c = (c << 6) | (*p++ & 0x3F);
+        }
+        if (c < minimum || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF))
+            return invalid_code_point;
+        return c;
+    }
+
+    // The names under which browsers decode a page as Windows-1252.
+    const char *const cp1252_names[] = {
+        "windows-1252", "cp1252", "x-cp1252", "iso-8859-1", "iso8859-1",
+        "iso_8859-1", "latin1", "l1", "us-ascii", "ascii", NULL
+    };
+
+    bool is_cp1252_name(const string &name) {
+        for (const char *const *n = cp1252_names; *n != NULL; ++n)
+            if (name == *n)
+                return true;
+        return false;
+    }
+
+    struct named_reference {
+        const char *name;
+        uint32_t code_point;
+    };
+
+    // The character references which turn up in real email.  HTML defines
+    // many more, but these are nearly all we ever see.
+    const named_reference named_references[] = {
+        { "amp", '&' }, { "lt", '<' }, { "gt", '>' }, { "quot", '"' },
+        { "apos", '\'' }, { "nbsp", 0xA0 }, { "copy", 0xA9 },
+        { "reg", 0xAE }, { "trade", 0x2122 }, { "euro", 0x20AC },
+        { "pound", 0xA3 }, { "yen", 0xA5 }, { "cent", 0xA2 },
+        { "sect", 0xA7 }, { "para", 0xB6 }, { "deg", 0xB0 },
+        { "plusmn", 0xB1 }, { "middot", 0xB7 }, { "times", 0xD7 },
+        { "divide", 0xF7 }, { "laquo", 0xAB }, { "raquo", 0xBB },
+        { "iexcl", 0xA1 }, { "iquest", 0xBF }, { "shy", 0xAD },
+        { "ndash", 0x2013 }, { "mdash", 0x2014 }, { "lsquo", 0x2018 },
+        { "rsquo", 0x2019 }, { "sbquo", 0x201A }, { "ldquo", 0x201C },
+        { "rdquo", 0x201D }, { "bdquo", 0x201E }, { "hellip", 0x2026 },
+        { "bull", 0x2022 }, { "dagger", 0x2020 }, { "Dagger", 0x2021 },
+        { "agrave", 0xE0 }, { "aacute", 0xE1 }, { "acirc", 0xE2 },
+        { "auml", 0xE4 }, { "ccedil", 0xE7 }, { "egrave", 0xE8 },
+        { "eacute", 0xE9 }, { "ecirc", 0xEA }, { "iacute", 0xED },
+        { "ntilde", 0xF1 }, { "oacute", 0xF3 }, { "ouml", 0xF6 },
+        { "uacute", 0xFA }, { "uuml", 0xFC }, { "szlig", 0xDF },
+        { "Auml", 0xC4 }, { "Eacute", 0xC9 }, { "Ntilde", 0xD1 },
+        { "Ouml", 0xD6 }, { "Uuml", 0xDC },
+        { NULL, 0 }
+    };
+
+    // How we treat the elements we care about.  Anything else is ignored.
+    enum element_kind {
+        element_other,
+        element_break,  // Always ends the current line.
+        element_cell,   // Separates its contents from its neighbors.
+        element_block,  // Starts a new line of text.
+        element_pre,    // A block with significant whitespace.
+        element_hidden  // Never displayed.
+    };
+
+    struct element {
+        const char *name;
+        element_kind kind;
+    };
+
+    // Office also puts <xml> islands in its HTML.
+    const element elements[] = {
+        { "br", element_break }, { "td", element_cell },
+        { "th", element_cell }, { "p", element_block },
+        { "div", element_block }, { "tr", element_block },
+        { "li", element_block }, { "ul", element_block },
+        { "ol", element_block }, { "dl", element_block },
+        { "dt", element_block }, { "dd", element_block },
+        { "table", element_block }, { "blockquote", element_block },
+        { "h1", element_block }, { "h2", element_block },
+        { "h3", element_block }, { "h4", element_block },
+        { "h5", element_block }, { "h6", element_block },
+        { "hr", element_block }, { "address", element_block },
+        { "center", element_block }, { "form", element_block },
+        { "pre", element_pre }, { "head", element_hidden },
+        { "script", element_hidden }, { "style", element_hidden },
+        { "title", element_hidden }, { "xml", element_hidden },
+        { NULL, element_other }
+    };
+
+    // Look up 'name', checking the first character before calling strcmp,
+    // because we do this for every tag.
+    element_kind classify_element(const char *name) {
+        for (const element *e = elements; e->name != NULL; ++e)
+            if (e->name[0] == name[0] && strcmp(e->name, name) == 0)
+                return e->kind;
+        return element_other;
+    }
+
+    class html_text_extractor {
+        string &m_out;
+        html_charset m_charset;
+        bool m_pending_space;
+        bool m_at_line_start;
+        int m_pre_depth;
+
+        // If we have to guess our charset, we try UTF-8 first.  If that
+        // turns out to be wrong, we go back to our first non-ASCII
+        // character, which is where our guess was first used, and carry
+        // on from there as Windows-1252.
+        const uint8_t *m_guess_start;
+        size_t m_guess_out_size;
+        bool m_guess_pending_space;
+        bool m_guess_at_line_start;
+        int m_guess_pre_depth;
+
+        void line_break() {
+            m_out += "\r\n";
+            m_at_line_start = true;
+            m_pending_space = false;
+        }
+
+        void block_break() {
+            if (!m_at_line_start)
+                line_break();
+            m_pending_space = false;
+        }
+
+        void text(uint32_t c) {
+            if (m_pre_depth > 0) {
+                if (c == '\r')
+                    return;
+                if (c == '\n') {
+                    line_break();
+                    return;
+                }
+            } else if (is_space(c)) {
+                m_pending_space = true;
+                return;
+            }
+
+            if (m_pending_space && !m_at_line_start)
+                m_out += ' ';
+            m_pending_space = false;
+            m_at_line_start = false;
+            if (c == 0xA0)
+                m_out += ' ';
+            else if (c < 0x80)
+                m_out += char(c);
+            else
+                code_point_to_utf8_append(m_out, c);
+        }
+
+        // Output [p, end), which contains no markup, and no whitespace
+        // except for single spaces between words.
+        void text_run(const uint8_t *p, const uint8_t *end) {
+            if (m_pending_space && !m_at_line_start)
+                m_out += ' ';
+            m_pending_space = false;
+            m_at_line_start = false;
+            m_out.append(reinterpret_cast<const char *>(p), end - p);
+        }
+
+        // Handle a tag, starting just after the '<'.
+        const uint8_t *tag(const uint8_t *p, const uint8_t *end) {
+            const uint8_t *start(p);
+            if (p < end && *p == '!') {
+                if (end - p >= 3 && p[1] == '-' && p[2] == '-') {
+                    const uint8_t *close(find_lower(p + 3, end, "-->"));
+                    return close == end ? end : close + 3;
+                }
+                const uint8_t *close(find_lower(p, end, ">"));
+                return close == end ? end : close + 1;
+            } else if (p < end && *p == '?') {
+                const uint8_t *close(find_lower(p, end, ">"));
+                return close == end ? end : close + 1;
+            }
+
+            bool closing(false);
+            if (p < end && *p == '/') {
+                closing = true;
+                ++p;
+            }
+            if (p == end || !is_alpha(*p)) {
+                // Not a tag at all, just a stray '<'.
+                text('<');
+                return start;
+            }
+
+            char name[16];
+            size_t length(0);
+            for (; p < end && (is_alpha(*p) || is_digit(*p)); ++p)
+                if (length < sizeof(name) - 1)
+                    name[length++] = char(to_lower(*p));
+            name[length] = '\0';
+
+            // Skip over our attributes, which may contain quoted '>'s.
+            while (p < end && *p != '>') {
+                if (*p == '"' || *p == '\'') {
+                    uint8_t quote(*p++);
+                    while (p < end && *p != quote)
+                        ++p;
+                }
+                if (p < end)
+                    ++p;
+            }
+            bool self_closing(p < end && p > start && p[-1] == '/');
+            if (p < end)
+                ++p;
+
+            switch (classify_element(name)) {
+                case element_break:
+                    line_break();
+                    break;
+                case element_cell:
+                    m_pending_space = true;
+                    break;
+                case element_block:
+                    block_break();
+                    break;
+                case element_pre:
+                    block_break();
+                    if (!closing)
+                        ++m_pre_depth;
+                    else if (m_pre_depth > 0)
+                        --m_pre_depth;
+                    break;
+                case element_hidden:
+                    if (!closing && !self_closing) {
+                        // Jump straight to the closing tag, which we then
+                        // parse normally.
+                        char close[20] = "</";
+                        strcat(close, name);
+                        p = find_lower(p, end, close);
+                    }
+                    break;
+                case element_other:
+                    break;
+            }
+            return p;
+        }
+
+        // Handle a non-ASCII character, and return the position just after
+        // it.  Our output is always UTF-8, so each byte of a charset we
+        // can't decode becomes a replacement character.
+        const uint8_t *non_ascii(const uint8_t *p, const uint8_t *end) {
+            if (m_charset == html_charset_other) {
+                text(0xFFFD);
+                return p + 1;
+            } else if (m_charset == html_charset_cp1252) {
+                text(cp1252_to_code_point(*p));
+                return p + 1;
+            }
+
+            if (m_charset == html_charset_undeclared &&
+                m_guess_start == NULL) {
+                m_guess_start = p;
+                m_guess_out_size = m_out.size();
+                m_guess_pending_space = m_pending_space;
+                m_guess_at_line_start = m_at_line_start;
+                m_guess_pre_depth = m_pre_depth;
+            }
+            uint32_t decoded(decode_utf8(p, end));
+            if (decoded != invalid_code_point) {
+                text(decoded);
+            } else if (m_charset == html_charset_utf8) {
+                text(0xFFFD);
+            } else {
+                // This isn't UTF-8 after all.
+                m_charset = html_charset_cp1252;
+                m_out.resize(m_guess_out_size);
+                m_pending_space = m_guess_pending_space;
+                m_at_line_start = m_guess_at_line_start;
+                m_pre_depth = m_guess_pre_depth;
+                return m_guess_start;
+            }
+            return p;
+        }
+
+        // Handle a character reference, starting just after the '&'.
+        const uint8_t *reference(const uint8_t *p, const uint8_t *end) {
+            const uint8_t *start(p);
+            if (p < end && *p == '#') {
+                ++p;
+                bool hex(p < end && (*p == 'x' || *p == 'X'));
+                if (hex)
+                    ++p;
+                uint32_t c(0);
+                int digits(0);
+                for (; p < end; ++p, ++digits) {
+                    int value;
+                    if (is_digit(*p))
+                        value = *p - '0';
+                    else if (hex && to_lower(*p) >= 'a' && to_lower(*p) <= 'f')
+                        value = to_lower(*p) - 'a' + 10;
+                    else
+                        break;
+                    if (c <= 0x10FFFF)
+                        c = c * (hex ? 16 : 10) + value;
+                }
+                if (digits == 0) {
+                    text('&');
+                    return start;
+                }
+                if (p < end && *p == ';')
+                    ++p;
+                // Like browsers, we treat references to C1 control
+                // characters as Windows-1252.
+                if (c >= 0x80 && c < 0xA0)
+                    c = cp1252_to_code_point(uint8_t(c));
+                text(c == 0 ? 0xFFFD : c);
+                return p;
+            }
+
+            char name[12];
+            size_t length(0);
+            for (; p < end && length < sizeof(name) - 1 &&
+                     (is_alpha(*p) || is_digit(*p)); ++p)
+                name[length++] = char(*p);
+            name[length] = '\0';
+            if (p < end && *p == ';') {
+                const named_reference *r(named_references);
+                for (; r->name != NULL; ++r) {
+                    if (strcmp(r->name, name) == 0) {
+                        text(r->code_point);
+                        return p + 1;
+                    }
+                }
+            }
+            text('&');
+            return start;
+        }
+
+    public:
+        html_text_extractor(string &out, html_charset charset)
+            : m_out(out), m_charset(charset), m_pending_space(false),
+              m_at_line_start(true), m_pre_depth(0), m_guess_start(NULL),
+              m_guess_out_size(0), m_guess_pending_space(false),
+              m_guess_at_line_start(false), m_guess_pre_depth(0) {}
+
+
+        void extract(const uint8_t *p, const uint8_t *end) {
+            while (p < end) {
+                uint8_t c(*p);
+                if (c == '<') {
+                    p = tag(p + 1, end);
+                } else if (c == '&') {
+                    p = reference(p + 1, end);
+                } else if (c > ' ' && c < 0x80) {
+                    // Copy runs of ordinary characters all at once.  Single
+                    // spaces between words are already collapsed, so they
+                    // can be part of a run, too.
+                    const uint8_t *run(p);
+                    for (; p < end; ++p) {
+                        uint8_t b(*p);
+                        if (b == ' ' ? p[-1] == ' '
+                            : (b < ' ' || b >= 0x80 || b == '<' || b == '&'))
+                            break;
+                    }
+                    if (p[-1] == ' ')
+                        --p;
+                    text_run(run, p);
+                } else if (c < 0x80) {
+                    text(c);
+                    ++p;
+                } else {
+                    p = non_ascii(p, end);
+                }
+            }
+        }
+    };
+}
+
+html_charset detect_html_charset(const vector<uint8_t> &html,
+                                 string *name) {
+    const uint8_t *begin(html.data()), *end(begin + html.size());
+    if (html.size() >= 3 && begin[0] == 0xEF && begin[1] == 0xBB &&
+        begin[2] == 0xBF)
+        return html_charset_utf8;
+
+    // Charsets are declared in a <meta> tag, which belongs in the <head>.
+    const uint8_t *head_end(begin + min(html.size(), size_t(4096)));
+    const uint8_t *p(find_lower(begin, head_end, "charset="));
+    if (p != head_end) {
+        p += strlen("charset=");
+        while (p < end && (*p == '"' || *p == '\'' || is_space(*p)))
+            ++p;
+        string declared;
+        for (; p < end && (is_alpha(*p) || is_digit(*p) || *p == '-' ||
+                           *p == '_' || *p == '.' || *p == ':'); ++p)
+            declared += char(to_lower(*p));
+        if (name != NULL)
+            *name = declared;
+        if (declared == "utf-8" || declared == "utf8")
+            return html_charset_utf8;
+        else if (is_cp1252_name(declared))
+            return html_charset_cp1252;
+        else if (!declared.empty())
+            return html_charset_other;
+    }
+
+    return html_charset_undeclared;
+}
+
+string html_to_text(const vector<uint8_t> &html,
+                    string *undecoded_charset) {
+    const uint8_t *p(html.data()), *end(p + html.size());
+    string declared;
+    html_charset charset(detect_html_charset(html, &declared));
+    if (html.size() >= 3 && p[0] == 0xEF && p[1] == 0xBB && p[2] == 0xBF)
+        p += 3;
+
+    // Our text is almost never longer than our HTML, so this is normally
+    // the only allocation we make.
+    string text;
+    text.reserve(html.size());
+    html_text_extractor extractor(text, charset);
+    extractor.extract(p, end);
+    if (undecoded_charset != NULL)
+        *undecoded_charset = (charset == html_charset_other ? declared
+                              : string());
+    return text;
+}
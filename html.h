@@ -0,0 +1,58 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef HTML_H
+#define HTML_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/// The character encodings HTML may declare.
+enum html_charset {
+    html_charset_undeclared, ///< No declaration, so we have to guess.
+    html_charset_utf8,
+    html_charset_cp1252,
+    html_charset_other       ///< A charset we don't know how to decode.
+};
+
+/// Figure out which encoding 'html' declares, either with a byte order
+/// mark or with a charset declaration near the start of the document.
+/// ISO-8859-1 and US-ASCII are treated as Windows-1252, as browsers do.
+/// If 'name' is specified, it is set to the declared name, in lowercase.
+extern html_charset detect_html_charset(const std::vector<uint8_t> &html,
+                                        std::string *name = NULL);
+
+/// Convert 'html' to plain text in a single pass.  We drop tags,
+/// comments, scripts and styles, decode character references, collapse
+/// whitespace, and start new lines for block-level elements.
+///
+/// The text is always UTF-8.  If there's no charset declaration, we
+/// decode the HTML as UTF-8 if it is valid UTF-8, and as Windows-1252
+/// otherwise.  If the HTML declares a charset we can't decode, such as
+/// Shift_JIS, we replace each of its non-ASCII bytes with U+FFFD, and set
+/// '*undecoded_charset' to the declared name, so that the caller can
+/// record what was lost.  Otherwise, '*undecoded_charset' is set to the
+/// empty string.
+extern std::string html_to_text(const std::vector<uint8_t> &html,
+                                std::string *undecoded_charset = NULL);
+
+#endif // HTML_H
@@ -0,0 +1,147 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cassert>
+#include <cstring>
+
+#include "html.h"
+
+using namespace std;
+
+namespace {
+    vector<uint8_t> bytes(const char *str) {
+        return vector<uint8_t>(str, str + strlen(str));
+    }
+
+    // Is 'str' well-formed UTF-8?  We don't check for overlong forms.
+    bool is_utf8(const string &str) {
+        for (size_t i = 0; i < str.size(); ) {
+            uint8_t lead(str[i++]);
+            size_t continuation(lead < 0x80 ? 0 : lead >= 0xF0 ? 3
+                                : lead >= 0xE0 ? 2 : lead >= 0xC0 ? 1 : 4);
+            if (continuation > 3 || lead > 0xF4)
+                return false;
+            for (; continuation > 0; --continuation, ++i)
+                if (i == str.size() || (uint8_t(str[i]) & 0xC0) != 0x80)
+                    return false;
+        }
+        return true;
+    }
+
+    string text_of(const char *html) {
+        return html_to_text(bytes(html));
+    }
+}
+
+void detect_html_charset_should_use_declared_charset() {
+    assert(html_charset_utf8 == detect_html_charset(bytes(
+        "<html><head><meta charset=\"UTF-8\"></head><body>\xE9</body>")));
+    assert(html_charset_cp1252 == detect_html_charset(bytes(
+        "<meta http-equiv=Content-Type content=\"text/html; "
+        "charset=iso-8859-1\"><p>\xC3\xA9</p>")));
+    assert(html_charset_utf8 == detect_html_charset(bytes("\xEF\xBB\xBFhi")));
+    assert(html_charset_undeclared ==
+           detect_html_charset(bytes("<p>\xC3\xA9</p>")));
+}
+
+void detect_html_charset_should_not_treat_other_charsets_as_cp1252() {
+    string name;
+    assert(html_charset_other == detect_html_charset(bytes(
+        "<meta charset=\"KOI8-R\"><p>\xF0\xD2\xC9</p>"), &name));
+    assert("koi8-r" == name);
+    assert(html_charset_other ==
+           detect_html_charset(bytes("<meta charset=shift_jis>"), &name));
+    assert("shift_jis" == name);
+}
+
+void html_to_text_should_strip_tags_and_collapse_whitespace() {
+    assert("" == text_of(""));
+    assert("Hello, world!" ==
+           text_of("<html><body>  Hello,\r\n   <b>world</b>!  </body></html>"));
+    assert("a < b" == text_of("a < b"));
+    assert("link" == text_of("<a href='x>y' title=\"z\">link</a>"));
+}
+
+void html_to_text_should_break_lines_for_block_elements() {
+    assert("One\r\nTwo\r\nThree\r\nFour five\r\n" ==
+           text_of("<p>One</p><div>Two<br>Three</div>"
+                   "<table><tr><td>Four</td><td>five</td></tr></table>"));
+    assert("  a\r\n  b\r\n" == text_of("<pre>  a\r\n  b</pre>"));
+}
+
+void html_to_text_should_skip_hidden_content() {
+    assert("Body" == text_of(
+        "<html><head><title>T</title><style>p { x: 1 }</style></head>"
+        "<!-- <p>comment</p> --><body><script>if (a<b) x();</script>"
+        "Body</body></html>"));
+}
+
+void html_to_text_should_not_hide_content_after_self_closing_elements() {
+    assert("Body" == text_of("<script src='x.js'/>Body"));
+    assert("One Two" == text_of("<title/>One <xml />Two"));
+}
+
+void html_to_text_should_decode_character_references() {
+    assert("<&> \"x\" \xC3\xA9\xE2\x80\x94\xE2\x80\x94\xE2\x82\xAC" ==
+           text_of("&lt;&amp;&gt; &quot;x&quot; &eacute;&mdash;&#x2014;&#128;"));
+    assert("AT&T &bogus; &" == text_of("AT&T &bogus; &"));
+    assert("a b" == text_of("a&nbsp;b"));
+}
+
+void html_to_text_should_decode_charsets() {
+    assert("caf\xC3\xA9 \xE2\x80\x9Cq\xE2\x80\x9D" ==
+           text_of("caf\xE9 \x93q\x94"));
+    assert("caf\xC3\xA9" == text_of("<meta charset=utf-8>caf\xC3\xA9"));
+    assert("caf\xEF\xBF\xBD" == text_of("<meta charset=utf-8>caf\xE9"));
+}
+
+void html_to_text_should_guess_undeclared_charsets() {
+    assert("caf\xC3\xA9" == text_of("caf\xC3\xA9"));
+    assert("caf\xC3\xA9" == text_of("caf\xE9"));
+    // We only find out this isn't UTF-8 at the end.
+    assert("\xC3\x83\xC2\xA9\r\nx \xC3\xA9\r\n" ==
+           text_of("<p>\xC3\xA9</p><p>x \xE9</p>"));
+}
+
+void html_to_text_should_output_utf8_for_charsets_it_cannot_decode() {
+    string charset;
+    string text(html_to_text(bytes(
+        "<meta charset=koi8-r>\xF0\xD2\xC9 &eacute; &lt;"), &charset));
+    assert(is_utf8(text));
+    assert("\xEF\xBF\xBD\xEF\xBF\xBD\xEF\xBF\xBD \xC3\xA9 <" == text);
+    assert("koi8-r" == charset);
+    assert("caf\xC3\xA9" == html_to_text(bytes("caf\xE9"), &charset));
+    assert("" == charset);
+}
+
+int html_spec(int argc, char **argv) {
+    detect_html_charset_should_use_declared_charset();
+    detect_html_charset_should_not_treat_other_charsets_as_cp1252();
+    html_to_text_should_strip_tags_and_collapse_whitespace();
+    html_to_text_should_break_lines_for_block_elements();
+    html_to_text_should_skip_hidden_content();
+    html_to_text_should_not_hide_content_after_self_closing_elements();
+    html_to_text_should_decode_character_references();
+    html_to_text_should_decode_charsets();
+    html_to_text_should_guess_undeclared_charsets();
+    html_to_text_should_output_utf8_for_charsets_it_cannot_decode();
+    return 0;
+}
@@ -0,0 +1,301 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <sstream>
+#include <stdexcept>
+
+#include <boost/any.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/foreach.hpp>
+
+#include "utilities.h"
+#include "document.h"
+#include "loadfile.h"
+#include "trace.h"
+
+using namespace std;
+using boost::any;
+using boost::any_cast;
+using namespace boost::posix_time;
+
+namespace {
+    // Delimited loadfile columns which are copied directly from document
+    // tags.  These are output between our fixed leading columns (DocID,
+    // ParentDocID, DocType, MimeType) and our trailing file columns.
+    struct tag_column {
+        const char *name;
+        const char *tag;
+    };
+
+    const tag_column tag_columns[] = {
+        { "From", "#From" },
+        { "To", "#To" },
+        { "CC", "#CC" },
+        { "BCC", "#BCC" },
+        { "Subject", "#Subject" },
+        { "DateSent", "#DateSent" },
+        { "DateReceived", "#DateReceived" },
+        { "HasAttachments", "#HasAttachments" },
+        { "AttachmentCount", "#AttachmentCount" },
+        { "AttachmentNames", "#AttachmentNames" },
+        { "ReadFlag", "#ReadFlag" },
+        { "ImportanceFlag", "#ImportanceFlag" },
+        { "MessageClass", "#MessageClass" },
+        { "FlagStatus", "#FlagStatus" },
+        { "MessageID", "#MessageID" },
+        { "InReplyTo", "#InReplyTo" },
+        { "References", "#References" },
+        { "ReceivedHops", "#ReceivedHops" },
+        { "OriginatingIP", "#OriginatingIP" },
+        { "EntryID", "#EntryID" },
+        { "FileName", "#FileName" },
+        { "FileExtension", "#FileExtension" },
+        { "FileSize", "#FileSize" },
+        { "NearDupGroup", "#NearDupGroup" },
+        { "NearDupSimilarity", "#NearDupSimilarity" },
+        { "DuplicateOf", "#DuplicateOf" },
+        { "ThreadID", "#ThreadID" },
+        { "ThreadPosition", "#ThreadPosition" },
+        { "InclusiveEmail", "#InclusiveEmail" },
+        { NULL, NULL }
+    };
+
+    // Concordance delimiters, as UTF-8.
+    const char *concordance_field_separator = "\x14";
+    const char *concordance_quote_char = "\xC3\xBE";  // U+00FE þ
+    const char *concordance_newline = "\xC2\xAE";     // U+00AE ®
+
+    const loadfile_file *find_file(const vector<loadfile_file> &files,
+                                   const string &file_type) {
+        BOOST_FOREACH(const loadfile_file &f, files)
+            if (f.file_type == file_type)
+                return &f;
+        return NULL;
+    }
+
+    template <typename T>
+    string to_tag_value(const T& value) {
+        ostringstream out;
+        out << value;
+        return out.str();
+    }
+
+    template <>
+    string to_tag_value(const tag_string &value) {
+        return to_std_string(value);
+    }
+
+    template <>
+    string to_tag_value(const tag_string_list &values) {
+        string result;
+        bool first = true;
+        BOOST_FOREACH(const tag_string &v, values) {
+            if (first)
+                first = false;
+            else
+                result += ";";
+            result.append(v.data(), v.size());
+        }
+        return result;
+    }
+
+    template <>
+    string to_tag_value(const ptime &value) {
+        return to_iso_extended_string(value) + "Z";
+    }
+
+    template <>
+    string to_tag_value(const bool &value) {
+        return value ? "true" : "false";
+    }
+}
+
+/// Convert a document tag value to a string.  Every kind of loadfile
+/// formats values the same way.
+string loadfile_tag_value(const any &value) {
+    if (value.type() == typeid(tag_string))
+        return to_tag_value(any_cast<const tag_string &>(value));
+    else if (value.type() == typeid(tag_string_list))
+        return to_tag_value(any_cast<const tag_string_list &>(value));
+    else if (value.type() == typeid(int32_t))
+        return to_tag_value(any_cast<int32_t>(value));
+    else if (value.type() == typeid(ptime))
+        return to_tag_value(any_cast<ptime>(value));
+    else if (value.type() == typeid(bool))
+        return to_tag_value(any_cast<bool>(value));
+    else if (value.type() == typeid(int64_t))
+        return to_tag_value(any_cast<int64_t>(value));
+
+    throw runtime_error("Unable to output loadfile value for tag");
+}
+
+/// Quote a field for use in a Concordance DAT file.  Concordance can't
+/// cope with embedded line breaks, so we replace them with its usual
+/// newline placeholder.  It has no way to escape its delimiters, so we
+/// replace a þ with its capital, Þ, and a field separator with a space.
+string concordance_quote(const string &utf8) {
+    string out(concordance_quote_char);
+    for (size_t i = 0; i < utf8.size(); ++i) {
+        char c(utf8[i]);
+        if (c == '\r' && i + 1 < utf8.size() && utf8[i+1] == '\n') {
+            out += concordance_newline;
+            ++i;
+        } else if (c == '\r' || c == '\n') {
+            out += concordance_newline;
+        } else if (c == concordance_quote_char[0] && i + 1 < utf8.size() &&
+                   utf8[i+1] == concordance_quote_char[1]) {
+            out += "\xC3\x9E";  // U+00DE Þ
+            ++i;
+        } else if (c == concordance_field_separator[0]) {
+            out += ' ';
+        } else {
+            out += c;
+        }
+    }
+    out += concordance_quote_char;
+    return out;
+}
+
+/// Quote a field for use in a CSV file.
+string csv_quote(const string &utf8) {
+    string out("\"");
+    BOOST_FOREACH(char c, utf8) {
+        if (c == '"')
+            out += "\"\"";
+        else
+            out += c;
+    }
+    out += "\"";
+    return out;
+}
+
+const vector<string> &delimited_sink::column_names() {
+    static vector<string> names;
+    if (names.empty()) {
+        names.push_back("DocID");
+        names.push_back("ParentDocID");
+        names.push_back("DocType");
+        names.push_back("MimeType");
+        for (const tag_column *c = tag_columns; c->name != NULL; ++c)
+            names.push_back(c->name);
+        names.push_back("NativeFile");
+        names.push_back("TextFile");
+        names.push_back("MD5Hash");
+        names.push_back("SHA1Hash");
+        names.push_back("SHA256Hash");
+    }
+    return names;
+}
+
+void delimited_sink::begin() {
+    output_row(column_names());
+}
+
+void delimited_sink::output_document(const document &d,
+                                     const vector<loadfile_file> &files) {
+    trace_span span("serialize row");
+    vector<string> fields;
+    fields.push_back(d.id());
+
+    // We only need to remember a parent until we see the child.
+    map<string, string>::iterator parent(m_parents.find(d.id()));
+    if (parent == m_parents.end()) {
+        fields.push_back(string());
+    } else {
+        fields.push_back(parent->second);
+        m_parents.erase(parent);
+    }
+
+    fields.push_back(d.type_string());
+    fields.push_back(d.content_type());
+
+    for (const tag_column *c = tag_columns; c->name != NULL; ++c) {
+        any value(d[c->tag]);
+        if (value.empty())
+            fields.push_back(string());
+        else
+            fields.push_back(loadfile_tag_value(value));
+    }
+
+    const loadfile_file *native(find_file(files, "Native"));
+    const loadfile_file *text(find_file(files, "Text"));
+    fields.push_back(native ? native->filename : string());
+    fields.push_back(text ? text->filename : string());
+    file_digests digests;
+    if (native)
+        digests = native->digests;
+    fields.push_back(digests.algorithms & digest_md5 ?
+                     string(hex_digest(digests.md5).data()) : string());
+    fields.push_back(digests.algorithms & digest_sha1 ?
+                     string(hex_digest(digests.sha1).data()) : string());
+    fields.push_back(digests.algorithms & digest_sha256 ?
+                     string(hex_digest(digests.sha256).data()) : string());
+
+    output_row(fields);
+}
+
+void delimited_sink::relationship(const string &type,
+                                  const string &parent_doc_id,
+                                  const string &child_doc_id) {
+    m_parents[child_doc_id] = parent_doc_id;
+}
+
+void concordance_sink::begin() {
+    // Concordance uses the byte order mark to recognize UTF-8 DAT files.
+    m_dat << "\xEF\xBB\xBF";
+    delimited_sink::begin();
+}
+
+void concordance_sink::output_document(const document &d,
+                                       const vector<loadfile_file> &files) {
+    delimited_sink::output_document(d, files);
+
+    // Opticon cross-reference: ImageKey, Volume, Path, DocBreak,
+    // FolderBreak, BoxBreak, PageCount.
+    const loadfile_file *native(find_file(files, "Native"));
+    if (native)
+        m_opt << d.id() << "," << m_volume << ","
+              << native->filename << ",Y,,,1\r\n";
+}
+
+void concordance_sink::output_row(const vector<string> &fields) {
+    bool first = true;
+    BOOST_FOREACH(const string &f, fields) {
+        if (first)
+            first = false;
+        else
+            m_dat << concordance_field_separator;
+        m_dat << concordance_quote(f);
+    }
+    m_dat << "\r\n";
+}
+
+void csv_sink::output_row(const vector<string> &fields) {
+    bool first = true;
+    BOOST_FOREACH(const string &f, fields) {
+        if (first)
+            first = false;
+        else
+            m_out << ",";
+        m_out << csv_quote(f);
+    }
+    m_out << "\r\n";
+}
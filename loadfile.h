@@ -0,0 +1,130 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef LOADFILE_H
+#define LOADFILE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+#include <cstdint>
+
+#include <boost/utility.hpp>
+
+#include "digest.h"
+
+namespace boost { class any; }
+class document;
+
+/// A file which we wrote to the output directory on behalf of a document.
+struct loadfile_file {
+    std::string file_type;
+    std::string filename;
+    uint64_t size;
+    file_digests digests;
+
+    loadfile_file(const std::string &t, const std::string &f,
+                  uint64_t s, const file_digests &h)
+        : file_type(t), filename(f), size(s), digests(h) {}
+};
+
+/// Something which wants to hear about every document we process, and
+/// which writes it to a loadfile of some sort.  All sinks are fed from a
+/// single traversal of the PST, so they share the same decoded documents
+/// and native files.
+class loadfile_sink : boost::noncopyable {
+public:
+    virtual ~loadfile_sink() {}
+
+    /// Called once before any documents are output.
+    virtual void begin() {}
+
+    /// Called once for each document, after its files have been written.
+    virtual void output_document(const document &d,
+                                 const std::vector<loadfile_file> &files) = 0;
+
+    /// Called before the child document is output.
+    virtual void relationship(const std::string &type,
+                              const std::string &parent_doc_id,
+                              const std::string &child_doc_id) {}
+
+    /// Called once after all documents have been output.
+    virtual void end() {}
+};
+
+/// A sink which writes one row per document, using a fixed set of columns.
+/// Since rows are written as we go, we need to know each document's
+/// parent before we see the document itself.
+class delimited_sink : public loadfile_sink {
+    std::map<std::string, std::string> m_parents;
+
+protected:
+    /// Write a single row of UTF-8 field values.
+    virtual void output_row(const std::vector<std::string> &fields) = 0;
+
+public:
+    static const std::vector<std::string> &column_names();
+
+    virtual void begin();
+    virtual void output_document(const document &d,
+                                 const std::vector<loadfile_file> &files);
+    virtual void relationship(const std::string &type,
+                              const std::string &parent_doc_id,
+                              const std::string &child_doc_id);
+};
+
+/// A Concordance-style DAT file, plus an Opticon OPT file listing the
+/// native file for each document.
+class concordance_sink : public delimited_sink {
+    std::ostream &m_dat;
+    std::ostream &m_opt;
+    std::string m_volume;
+
+protected:
+    virtual void output_row(const std::vector<std::string> &fields);
+
+public:
+    concordance_sink(std::ostream &dat, std::ostream &opt,
+                     const std::string &volume)
+        : m_dat(dat), m_opt(opt), m_volume(volume) {}
+
+    virtual void begin();
+    virtual void output_document(const document &d,
+                                 const std::vector<loadfile_file> &files);
+};
+
+/// A CSV file, as described by RFC 4180.
+class csv_sink : public delimited_sink {
+    std::ostream &m_out;
+
+protected:
+    virtual void output_row(const std::vector<std::string> &fields);
+
+public:
+    explicit csv_sink(std::ostream &out) : m_out(out) {}
+};
+
+extern std::string loadfile_tag_value(const boost::any &value);
+extern std::string concordance_quote(const std::string &utf8);
+extern std::string csv_quote(const std::string &utf8);
+
+#endif // LOADFILE_H
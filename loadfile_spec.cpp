@@ -0,0 +1,171 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cassert>
+#include <stdexcept>
+#include <sstream>
+
+#include <boost/any.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "document.h"
+#include "loadfile.h"
+
+using namespace std;
+using namespace boost::posix_time;
+
+namespace {
+    // Build the expected header row, using 'sep' between quoted names.
+    string header_row(const string &open, const string &close,
+                      const string &sep) {
+        string result;
+        const vector<string> &names(delimited_sink::column_names());
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (i > 0)
+                result += sep;
+            result += open + names[i] + close;
+        }
+        return result + "\r\n";
+    }
+
+    document sample_attachment() {
+        document d;
+        d.set_id("d0000002").set_type(document::file);
+        d.set_string("#FileName", "a \"b\".txt");
+        d.set_string("#FileExtension", "txt");
+        return d;
+    }
+
+    vector<loadfile_file> sample_files() {
+        vector<loadfile_file> files;
+        file_digests hash;
+        hash.algorithms = digest_md5;
+        hash.md5.fill(0xab);
+        files.push_back(loadfile_file("Native", "d0000002.txt", 3, hash));
+        return files;
+    }
+}
+
+void loadfile_tag_value_should_format_value_appropriately() {
+    assert("Text" == loadfile_tag_value(tag_string("Text")));
+
+    tag_string_list v;
+    v.push_back(tag_string("Foo"));
+    v.push_back(tag_string("Bar"));
+    assert("Foo;Bar" == loadfile_tag_value(v));
+
+    assert("-1" == loadfile_tag_value(int32_t(-1)));
+    assert("2002-01-31T23:59:59Z" ==
+           loadfile_tag_value(from_iso_string("20020131T235959Z")));
+    assert("true" == loadfile_tag_value(true));
+    assert("false" == loadfile_tag_value(false));
+    assert("-1" == loadfile_tag_value(int64_t(-1)));
+}
+
+void loadfile_tag_value_should_raise_error_if_type_unknown() {
+    bool caught_exception(false);
+    try {
+        loadfile_tag_value(static_cast<const char *>(""));
+    } catch (std::exception &) {
+        caught_exception = true;
+    }
+    assert(caught_exception);
+}
+
+void concordance_quote_should_use_thorns_and_replace_newlines() {
+    assert("\xC3\xBE\xC3\xBE" == concordance_quote(""));
+    assert("\xC3\xBE" "a\xC2\xAE" "b\xC2\xAE" "c\xC3\xBE" ==
+           concordance_quote("a\r\nb\nc"));
+}
+
+void concordance_quote_should_replace_delimiters_in_values() {
+    assert("\xC3\xBE" "\xC3\x9E" "orn a b\xC3\xBE" ==
+           concordance_quote("\xC3\xBE" "orn a\x14" "b"));
+    // Other characters which share þ's lead byte are left alone.
+    assert("\xC3\xBE" "\xC3\xA9\xC3\xBE" == concordance_quote("\xC3\xA9"));
+}
+
+void csv_quote_should_double_embedded_quotes() {
+    assert("\"\"" == csv_quote(""));
+    assert("\"a \"\"b\"\"\r\nc\"" == csv_quote("a \"b\"\r\nc"));
+}
+
+void delimited_sink_should_have_standard_columns() {
+    const vector<string> &names(delimited_sink::column_names());
+    assert("DocID" == names[0]);
+    assert("ParentDocID" == names[1]);
+    assert("MD5Hash" == names[names.size() - 3]);
+    assert("SHA256Hash" == names.back());
+}
+
+void csv_sink_should_write_header_and_one_row_per_document() {
+    ostringstream out;
+    csv_sink csv(out);
+    csv.begin();
+    csv.relationship("Attachment", "d0000001", "d0000002");
+    csv.output_document(sample_attachment(), sample_files());
+    csv.end();
+
+    string s(out.str());
+    string header(header_row("\"", "\"", ","));
+    assert(header == s.substr(0, header.size()));
+
+    string row(s.substr(header.size()));
+    assert("\"d0000002\",\"d0000001\",\"File\",\"\"," ==
+           row.substr(0, 32));
+    assert(string::npos != row.find(",\"a \"\"b\"\".txt\",\"txt\","));
+    string hash;
+    for (int i = 0; i < 16; ++i)
+        hash += "ab";
+    assert(",\"d0000002.txt\",\"\",\"" + hash + "\",\"\",\"\"\r\n" ==
+           row.substr(row.size() - 61));
+}
+
+void concordance_sink_should_write_dat_and_opt_files() {
+    ostringstream dat, opt;
+    concordance_sink c(dat, opt, "VOL1");
+    c.begin();
+    c.output_document(sample_attachment(), sample_files());
+    c.end();
+
+    string s(dat.str());
+    string header("\xEF\xBB\xBF" +
+                  header_row("\xC3\xBE", "\xC3\xBE", "\x14"));
+    assert(header == s.substr(0, header.size()));
+    assert("\xC3\xBE" "d0000002\xC3\xBE\x14\xC3\xBE\xC3\xBE\x14" ==
+           s.substr(header.size(), 18));
+
+    assert("d0000002,VOL1,d0000002.txt,Y,,,1\r\n" == opt.str());
+}
+
+int loadfile_spec(int argc, char **argv) {
+    loadfile_tag_value_should_format_value_appropriately();
+    loadfile_tag_value_should_raise_error_if_type_unknown();
+    concordance_quote_should_use_thorns_and_replace_newlines();
+    concordance_quote_should_replace_delimiters_in_values();
+    csv_quote_should_double_embedded_quotes();
+
+    delimited_sink_should_have_standard_columns();
+    csv_sink_should_write_header_and_one_row_per_document();
+    concordance_sink_should_write_dat_and_opt_files();
+
+    return 0;
+}
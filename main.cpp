@@ -19,23 +19,159 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <iostream>
+#include <vector>
+#include <boost/scoped_ptr.hpp>
+#include <boost/lexical_cast.hpp>
 #include <pstsdk/pst.h>
 
 #include "utilities.h"
+#include "loadfile.h"
 #include "edrm.h"
+#include "gzip_stream.h"
+#include "scan.h"
+#include "trace.h"
+#include "text_index.h"
 
 using namespace std;
 using namespace pstsdk;
 using namespace boost::filesystem;
 
+namespace {
+    void usage() {
+        wcout << L"Usage: process-pst [--format=edrm,dat,csv] [--gzip] "
+              << L"[--hash=md5,sha1,sha256] [--trace=trace.json] "
+              << L"[--max-message-seconds=N] [--max-message-bytes=N] "
+              << L"[--headers=inline,sidecar,files] [--message-text] "
+              << L"[--index] [--near-dups] [--dedup-db=FILE] "
+              << L"[--threads] [--fields=Subject,From,...] "
+              << L"[--files=native,text,none] "
+              << L"input.pst output-dir" << endl
+              << L"       process-pst --scan input.pst" << endl;
+        exit(1);
+    }
+
+    // Split a comma-separated option value into its component parts.
+    vector<string> split_option(const string &value) {
+        vector<string> result;
+        string::size_type start = 0, comma;
+        while ((comma = value.find(',', start)) != string::npos) {
+            result.push_back(value.substr(start, comma - start));
+            start = comma + 1;
+        }
+        result.push_back(value.substr(start));
+        return result;
+    }
+}
+
 int main(int argc, char **argv) {
     // Parse our command-line arguments.
-    if (argc != 3) {
-        wcout << L"Usage: process-pst input.pst output-dir" << endl;
-        exit(1);
+    vector<string> args;
+    vector<string> formats;
+    bool gzip = false;
+    bool scan = false;
+    bool message_text = false;
+    bool index = false;
+    bool near_dups = false;
+    bool threads = false;
+    string dedup_path;
+    string trace_path;
+    double max_message_seconds = 0;
+    uint64_t max_message_bytes = 0;
+    digest_set digests = digest_md5;
+    header_mode headers = headers_inline;
+    field_selection fields;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg.compare(0, 9, "--format=") == 0) {
+            formats = split_option(arg.substr(9));
+        } else if (arg == "--gzip") {
+            gzip = true;
+        } else if (arg == "--scan") {
+            scan = true;
+        } else if (arg == "--message-text") {
+            message_text = true;
+        } else if (arg == "--index") {
+            index = true;
+        } else if (arg == "--near-dups") {
+            near_dups = true;
+        } else if (arg == "--threads") {
+            threads = true;
+        } else if (arg.compare(0, 11, "--dedup-db=") == 0) {
+            dedup_path = arg.substr(11);
+        } else if (arg.compare(0, 8, "--trace=") == 0) {
+            trace_path = arg.substr(8);
+        } else if (arg.compare(0, 22, "--max-message-seconds=") == 0) {
+            try {
+                max_message_seconds =
+                    boost::lexical_cast<double>(arg.substr(22));
+            } catch (boost::bad_lexical_cast &) {
+                usage();
+            }
+        } else if (arg.compare(0, 20, "--max-message-bytes=") == 0) {
+            try {
+                max_message_bytes =
+                    boost::lexical_cast<uint64_t>(arg.substr(20));
+            } catch (boost::bad_lexical_cast &) {
+                usage();
+            }
+        } else if (arg.compare(0, 7, "--hash=") == 0) {
+            try {
+                digests = parse_digest_set(arg.substr(7));
+            } catch (exception &) {
+                usage();
+            }
+        } else if (arg.compare(0, 10, "--headers=") == 0) {
+            try {
+                headers = parse_header_mode(arg.substr(10));
+            } catch (exception &) {
+                usage();
+            }
+        } else if (arg.compare(0, 9, "--fields=") == 0) {
+            fields.select_tags(split_option(arg.substr(9)));
+        } else if (arg.compare(0, 8, "--files=") == 0) {
+            try {
+                fields.select_files(split_option(arg.substr(8)));
+            } catch (exception &) {
+                usage();
+            }
+        } else if (arg.compare(0, 2, "--") == 0) {
+            usage();
+        } else {
+            args.push_back(arg);
+        }
+    }
+    if (args.size() != (scan ? 1 : 2))
+        usage();
+    if (formats.empty())
+        formats.push_back("edrm");
+
+    bool want_edrm = false, want_dat = false, want_csv = false;
+    for (size_t i = 0; i < formats.size(); ++i) {
+        if (formats[i] == "edrm")
+            want_edrm = true;
+        else if (formats[i] == "dat")
+            want_dat = true;
+        else if (formats[i] == "csv")
+            want_csv = true;
+        else
+            usage();
+    }
+
+    string pst_path(args[0]);
+
+    // Start tracing, if asked to.  This needs to outlive everything else
+    // we create, including our compression threads.
+    ofstream trace_file;
+    boost::scoped_ptr<tracer> trace;
+    if (!trace_path.empty()) {
+        trace_file.open(trace_path.c_str(), ios_base::binary);
+        if (!trace_file) {
+            wcerr << L"Could not open " << string_to_wstring(trace_path)
+                  << endl;
+            exit(1);
+        }
+        trace.reset(new tracer(trace_file));
     }
-    string pst_path(argv[1]);
-    path output_directory_path(argv[2]);
 
     // Open our PST.
     shared_ptr<pst> pst_file;
@@ -46,6 +182,26 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
+    // If we're only scanning, summarize the PST and stop.
+    if (scan) {
+        output_scan_json(cout, scan_pst(*pst_file));
+        return 0;
+    }
+
+    path output_directory_path(args[1]);
+
+    // Open our dedup database before we create anything.
+    boost::scoped_ptr<dedup_db> dedup;
+    if (!dedup_path.empty()) {
+        try {
+            dedup.reset(new dedup_db(path(dedup_path)));
+        } catch (exception &e) {
+            wcerr << L"Could not open dedup database: "
+                  << string_to_wstring(e.what()) << endl;
+            exit(1);
+        }
+    }
+
     // Refuse to run if our output directory exists.
     if (exists(output_directory_path)) {
         wcerr << L"Will not overwrite existing "
@@ -53,12 +209,97 @@ int main(int argc, char **argv) {
         exit(1);
     }
 
-    // Create an empty loadfile.  We'll fill this in shortly.
+    // Create our empty loadfiles.  We'll fill these in shortly, in a
+    // single pass over the PST.
     create_directory(output_directory_path);
-    path loadfile_path(output_directory_path / "edrm-loadfile.xml");
-    ofstream loadfile(loadfile_path.string());
-    convert_to_edrm(pst_file, loadfile, output_directory_path);
-    loadfile.close();
+    edrm_context edrm(output_directory_path);
+    edrm.set_digests(digests);
+    edrm.headers().set_mode(headers);
+    edrm.set_message_text(message_text);
+    edrm.near_duplicates().set_enabled(near_dups);
+    edrm.set_dedup(dedup.get());
+
+    // Some of our features need fields which the loadfiles may not.
+    if (index || near_dups || dedup || (message_text && fields.text_files()))
+        fields.require_text();
+    if (dedup) {
+        fields.require_tag("#MessageID");
+        fields.require_tag("#Subject");
+    }
+    edrm.fields() = fields;
+    edrm.watchdog().set_budget(max_message_seconds, max_message_bytes);
+
+    ofstream edrm_loadfile;
+    boost::scoped_ptr<async_gzip_ostream> edrm_gzip;
+    boost::scoped_ptr<edrm_sink> edrm_out;
+    if (want_edrm && gzip) {
+        path p(output_directory_path / "edrm-loadfile.xml.gz");
+        edrm_loadfile.open(p.string().c_str(), ios_base::binary);
+        edrm_gzip.reset(new async_gzip_ostream(edrm_loadfile));
+        edrm_out.reset(new edrm_sink(*edrm_gzip));
+        edrm.add_sink(*edrm_out);
+    } else if (want_edrm) {
+        path p(output_directory_path / "edrm-loadfile.xml");
+        edrm_loadfile.open(p.string().c_str());
+        edrm_out.reset(new edrm_sink(edrm_loadfile));
+        edrm.add_sink(*edrm_out);
+    }
+
+    ofstream dat_loadfile, opt_loadfile;
+    boost::scoped_ptr<concordance_sink> dat_out;
+    if (want_dat) {
+        path dat_path(output_directory_path / "loadfile.dat");
+        path opt_path(output_directory_path / "loadfile.opt");
+        dat_loadfile.open(dat_path.string().c_str(), ios_base::binary);
+        opt_loadfile.open(opt_path.string().c_str(), ios_base::binary);
+        string volume(path(output_directory_path.leaf()).string());
+        dat_out.reset(new concordance_sink(dat_loadfile, opt_loadfile,
+                                           volume));
+        edrm.add_sink(*dat_out);
+    }
+
+    ofstream csv_loadfile;
+    boost::scoped_ptr<csv_sink> csv_out;
+    if (want_csv) {
+        path p(output_directory_path / "loadfile.csv");
+        csv_loadfile.open(p.string().c_str(), ios_base::binary);
+        csv_out.reset(new csv_sink(csv_loadfile));
+        edrm.add_sink(*csv_out);
+    }
+
+    boost::scoped_ptr<text_index_sink> index_out;
+    if (index) {
+        index_out.reset(new text_index_sink(output_directory_path));
+        edrm.add_sink(*index_out);
+    }
+
+    // Threading needs to see every message before we output any of them,
+    // so it gets a quick pass of its own.
+    if (threads)
+        build_thread_index(*pst_file, edrm.threads());
+
+    convert_to_loadfiles(pst_file, edrm);
+
+    // Compression happens in the background, so this is where we find
+    // out about any errors writing our compressed loadfile.
+    if (edrm_gzip) {
+        try {
+            edrm_gzip->close();
+        } catch (exception &e) {
+            wcerr << L"Could not write EDRM loadfile: "
+                  << string_to_wstring(e.what()) << endl;
+            exit(1);
+        }
+    }
+
+    // Report any messages we skipped, and the slowest ones we didn't.
+    path report_path(output_directory_path / "report.json");
+    ofstream report(report_path.string().c_str(), ios_base::binary);
+    edrm.watchdog().output_report(report);
+    if (!edrm.watchdog().skipped().empty())
+        wcerr << L"Skipped " << edrm.watchdog().skipped().size()
+              << L" message(s) which exceeded their budgets; see "
+              << string_to_wstring(report_path.string()) << endl;
 
     return 0;
 }
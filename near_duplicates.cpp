@@ -0,0 +1,131 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include "document.h"
+#include "near_duplicates.h"
+#include "text_index.h"
+#include "trace.h"
+
+using namespace std;
+
+namespace {
+    // 64-bit FNV-1a.
+    uint64_t hash_term(const string &term) {
+        uint64_t h(0xcbf29ce484222325ULL);
+        for (size_t i = 0; i < term.size(); ++i) {
+            h ^= uint8_t(term[i]);
+            h *= 0x100000001b3ULL;
+        }
+        return h;
+    }
+
+    // The splitmix64 finalizer, which spreads combined hashes over all 64
+    // bits.
+    uint64_t mix(uint64_t h) {
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        return h ^ (h >> 31);
+    }
+}
+
+uint64_t simhash(const vector<string> &terms) {
+    int32_t weights[64] = { 0 };
+    uint64_t h0(0), h1(0);
+    for (size_t i = 0; i < terms.size(); ++i) {
+        uint64_t h2(hash_term(terms[i]));
+        if (i >= 2) {
+            uint64_t shingle(mix(h0 * 31 * 31 + h1 * 31 + h2));
+            for (int bit = 0; bit < 64; ++bit)
+                weights[bit] += ((shingle >> bit) & 1) ? 1 : -1;
+        }
+        h0 = h1;
+        h1 = h2;
+    }
+
+    uint64_t signature(0);
+    for (int bit = 0; bit < 64; ++bit)
+        if (weights[bit] > 0)
+            signature |= uint64_t(1) << bit;
+    return signature;
+}
+
+int hamming_distance(uint64_t a, uint64_t b) {
+    int count(0);
+    for (uint64_t x = a ^ b; x != 0; x &= x - 1)
+        ++count;
+    return count;
+}
+
+const int near_duplicate_index::band_count;
+const size_t near_duplicate_index::band_size;
+
+string near_duplicate_index::add(const string &doc_id, uint64_t signature,
+                                 int &distance) {
+    if (m_bands[0].empty())
+        for (int b = 0; b < band_count; ++b)
+            m_bands[b].resize(band_size);
+
+    // Find the closest group which shares at least one band with us.  An
+    // exact match can't be beaten, so we stop looking as soon as we find
+    // one.
+    uint32_t best(0);
+    distance = near_duplicate_distance + 1;
+    for (int b = 0; b < band_count && distance > 0; ++b) {
+        const vector<uint32_t> &bucket(
+            m_bands[b][(signature >> (16 * b)) & 0xffff]);
+        for (size_t i = 0; i < bucket.size(); ++i) {
+            int d(hamming_distance(signature,
+                                   m_group_signatures[bucket[i]]));
+            if (d < distance) {
+                distance = d;
+                best = bucket[i];
+                if (d == 0)
+                    break;
+            }
+        }
+    }
+    if (distance <= near_duplicate_distance)
+        return m_group_doc_ids[best];
+
+    // We start a new group.
+    uint32_t group(m_group_signatures.size());
+    m_group_signatures.push_back(signature);
+    m_group_doc_ids.push_back(doc_id);
+    for (int b = 0; b < band_count; ++b)
+        m_bands[b][(signature >> (16 * b)) & 0xffff].push_back(group);
+    distance = 0;
+    return doc_id;
+}
+
+void near_duplicate_index::tag(document &d) {
+    if (!m_enabled || !d.has_text())
+        return;
+    trace_span span("fingerprint text");
+
+    m_terms.clear();
+    split_terms(d.text(), m_terms);
+    if (m_terms.size() < near_duplicate_min_terms)
+        return;
+
+    int distance;
+    d.set_string("#NearDupGroup", add(d.id(), simhash(m_terms), distance));
+    d["#NearDupSimilarity"] = int32_t(100 - (100 * distance + 32) / 64);
+}
@@ -0,0 +1,83 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef NEAR_DUPLICATES_H
+#define NEAR_DUPLICATES_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <boost/utility.hpp>
+
+class document;
+
+/// Documents whose SimHash signatures differ in at most this many bits are
+/// near-duplicates.  Our LSH bands rely on this being less than the number
+/// of bands.
+const int near_duplicate_distance = 3;
+
+/// Documents with fewer terms than this aren't fingerprinted, because short
+/// texts have too few shingles to give meaningful signatures.
+const size_t near_duplicate_min_terms = 10;
+
+/// Calculate a 64-bit SimHash signature over the three-word shingles of
+/// 'terms'.
+extern uint64_t simhash(const std::vector<std::string> &terms);
+
+/// The number of bits which differ between two signatures.
+extern int hamming_distance(uint64_t a, uint64_t b);
+
+/// Groups near-duplicate documents as they go by, using SimHash signatures
+/// of their text.  Signatures are split into four 16-bit bands, and any
+/// two signatures within near_duplicate_distance bits of each other must
+/// match exactly in at least one band, so we only compare each document
+/// with the groups which share one of its bands.  Each group is indexed
+/// by its first document alone, so large clusters of identical documents
+/// don't fill up our buckets.
+class near_duplicate_index : boost::noncopyable {
+    static const int band_count = 4;
+    static const size_t band_size = 1 << 16;
+
+    bool m_enabled;
+    std::vector<uint64_t> m_group_signatures;
+    std::vector<std::string> m_group_doc_ids;
+    std::vector<std::vector<uint32_t> > m_bands[band_count];
+    std::vector<std::string> m_terms;
+
+public:
+    near_duplicate_index() : m_enabled(false) {}
+
+    bool enabled() const { return m_enabled; }
+    void set_enabled(bool enabled) { m_enabled = enabled; }
+
+    /// Add a document with 'signature' to the index.  Returns the DocID of
+    /// the first document in its group, which is 'doc_id' itself if it has
+    /// no near-duplicates, and sets 'distance' to the number of bits by
+    /// which it differs from that document.
+    std::string add(const std::string &doc_id, uint64_t signature,
+                    int &distance);
+
+    /// If we're enabled and 'd' has enough text, tag it with #NearDupGroup
+    /// and #NearDupSimilarity, a percentage.
+    void tag(document &d);
+};
+
+#endif // NEAR_DUPLICATES_H
@@ -0,0 +1,141 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cassert>
+#include <sstream>
+
+#include <boost/any.hpp>
+
+#include "document.h"
+#include "near_duplicates.h"
+#include "text_index.h"
+
+using namespace std;
+using boost::any_cast;
+
+namespace {
+    // A report with a few hundred words, which varies with 'seed'.
+    string report(int seed, int changed_words = 0) {
+        ostringstream out;
+        for (int i = 0; i < 300; ++i) {
+            if (i < changed_words)
+                out << "changed" << i << " ";
+            else
+                out << "word" << (i * 7919 + seed * 104729) % 1000 << " ";
+        }
+        return out.str();
+    }
+
+    uint64_t signature_of(const string &text) {
+        vector<string> terms;
+        split_terms(text, terms);
+        return simhash(terms);
+    }
+
+    document text_document(const string &id, const string &text) {
+        document d;
+        d.set_id(id).set_type(document::message);
+        d.set_text(text);
+        return d;
+    }
+}
+
+void hamming_distance_should_count_differing_bits() {
+    assert(0 == hamming_distance(0x1234, 0x1234));
+    assert(1 == hamming_distance(0, 0x8000000000000000ULL));
+    assert(64 == hamming_distance(0, ~uint64_t(0)));
+}
+
+void simhash_should_be_close_for_similar_text() {
+    uint64_t original(signature_of(report(1)));
+    assert(original == signature_of(report(1)));
+    assert(hamming_distance(original, signature_of(report(1, 1))) <=
+           near_duplicate_distance);
+    assert(hamming_distance(original, signature_of(report(2))) >
+           near_duplicate_distance);
+}
+
+void near_duplicate_index_should_group_similar_signatures() {
+    near_duplicate_index index;
+    int distance;
+    assert("d1" == index.add("d1", 0x0123456789abcdefULL, distance));
+    assert(0 == distance);
+    assert("d2" == index.add("d2", 0xfedcba9876543210ULL, distance));
+
+    // Three bits off, spread across three bands.
+    assert("d1" == index.add("d3", 0x0123456789abcdefULL ^ 0x0001000100010000ULL,
+                             distance));
+    assert(3 == distance);
+
+    // Four bits off, one in each band.
+    assert("d4" == index.add("d4", 0xfedcba9876543210ULL ^ 0x0001000100010001ULL,
+                             distance));
+}
+
+void near_duplicate_index_should_handle_large_clusters_quickly() {
+    // If we compared each of these with every earlier member of its
+    // cluster, this would take minutes.
+    near_duplicate_index index;
+    int distance;
+    uint64_t report(0x0123456789abcdefULL);
+    assert("d0" == index.add("d0", report, distance));
+    for (int i = 1; i < 200000; ++i) {
+        ostringstream id;
+        id << "d" << i;
+        uint64_t signature(report ^ (uint64_t(i % 2) << (i % 64)));
+        assert("d0" == index.add(id.str(), signature, distance));
+        assert(distance <= 1);
+    }
+}
+
+void near_duplicate_index_should_tag_documents() {
+    near_duplicate_index index;
+    document d1(text_document("d0000001", report(1)));
+    index.tag(d1);
+    assert(d1["#NearDupGroup"].empty());
+
+    index.set_enabled(true);
+    index.tag(d1);
+    assert("d0000001" == any_cast<tag_string>(d1["#NearDupGroup"]));
+    assert(100 == any_cast<int32_t>(d1["#NearDupSimilarity"]));
+
+    document d2(text_document("d0000002", report(1, 1)));
+    index.tag(d2);
+    assert("d0000001" == any_cast<tag_string>(d2["#NearDupGroup"]));
+    assert(any_cast<int32_t>(d2["#NearDupSimilarity"]) >= 95);
+
+    document d3(text_document("d0000003", report(2)));
+    index.tag(d3);
+    assert("d0000003" == any_cast<tag_string>(d3["#NearDupGroup"]));
+
+    document short_text(text_document("d0000004", "Thanks!"));
+    index.tag(short_text);
+    assert(short_text["#NearDupGroup"].empty());
+}
+
+int near_duplicates_spec(int argc, char **argv) {
+    hamming_distance_should_count_differing_bits();
+    simhash_should_be_close_for_similar_text();
+    near_duplicate_index_should_group_similar_signatures();
+    near_duplicate_index_should_handle_large_clusters_quickly();
+    near_duplicate_index_should_tag_documents();
+    return 0;
+}
@@ -23,6 +23,7 @@
 #include <sstream>
 
 #include <boost/foreach.hpp>
+#include <boost/utility.hpp>
 #include <boost/serialization/pfto.hpp>
 #include <boost/archive/iterators/transform_width.hpp>
 #include <boost/archive/iterators/base64_from_binary.hpp>
@@ -45,28 +46,25 @@ namespace {
 
 /// Quote everything except RFC 822 "atom" characters and spaces.  This
 /// is normally used for the human-readable parts of email addresses.
-wstring rfc822_quote(const wstring &str) {
+/// 'str' is UTF-8, and we quote anything containing non-ASCII characters.
+string rfc822_quote(const string &str) {
     // We quote everything except RFC 822 "atom" characters and spaces.
     bool needs_quoting = false;
     for (size_t i = 0; i < str.size(); ++i) {
         // Switch statements are reasonably fast ways to perform efficient
         // table lookups in most compilers.
         switch (str[i]) {
-            case L'(': case L')': case L'<': case L'>':
-            case L'@': case L',': case L';': case L':':
-            case L'"': case L'\\': case L'.': case L'[':
-            case L']':
+            case '(': case ')': case '<': case '>':
+            case '@': case ',': case ';': case ':':
+            case '"': case '\\': case '.': case '[':
+            case ']':
                 needs_quoting = true;
                 break;
         }
 
-        if (str[i] > 0x7f) {
+        unsigned char c = static_cast<unsigned char>(str[i]);
+        if (c > 0x7f || (c != ' ' && !isgraph(c)))
             needs_quoting = true;
-        } else {
-            char c = static_cast<char>(str[i]);
-            if (c != ' ' && !isgraph(c))
-                needs_quoting = true;
-        }
 
         if (needs_quoting)
             break;
@@ -76,15 +74,16 @@ wstring rfc822_quote(const wstring &str) {
     if (!needs_quoting)
         return str;
 
-    // Quote it.
-    wstring out(L"\"");
+    // Quote it.  Since every byte of a multibyte UTF-8 character is
+    // greater than 0x7f, we can safely work a byte at a time.
+    string out("\"");
     for (size_t i = 0; i < str.size(); ++i) {
-        wchar_t w = str[i];
-        if (w == L'\\' || w == L'"')
-            out += L"\\";
-        out += w;
+        char c = str[i];
+        if (c == '\\' || c == '"')
+            out += "\\";
+        out += c;
     }
-    out += L"\"";
+    out += "\"";
     return out;
 }
 
@@ -92,7 +91,7 @@ wstring rfc822_quote(const wstring &str) {
 /// RFC822-formatted email address.  Note that our return value still
 /// contains potential Unicode characters at this point, because we'll
 /// serialize it to XML, where Unicode is both easy and convenient.
-wstring rfc822_email(const wstring &display_name, const wstring &email) {
+string rfc822_email(const string &display_name, const string &email) {
     if (display_name.empty() && email.empty())
         throw runtime_error("Can't build address without name or email!");
     else if (display_name.empty() || display_name == email)
@@ -100,7 +99,7 @@ wstring rfc822_email(const wstring &display_name, const wstring &email) {
     else if (email.empty())
         return rfc822_quote(display_name);
     else
-        return rfc822_quote(display_name) + L" <" + email + L">";
+        return rfc822_quote(display_name) + " <" + email + ">";
 }
 
 namespace {
@@ -111,12 +110,13 @@ namespace {
 }
 
 /// Encode a string using Base64.
-string base64(const string &input) {
+string base64(const char *input, size_t size) {
     // Let Boost do the heavy conversion work.
     string output;
-    copy(base64_iterator(BOOST_MAKE_PFTO_WRAPPER(input.data())),
-         base64_iterator(BOOST_MAKE_PFTO_WRAPPER(input.data() + input.size())),
-         insert_iterator<string>(output, output.begin()));
+    output.reserve((size + 2) / 3 * 4);
+    copy(base64_iterator(BOOST_MAKE_PFTO_WRAPPER(input)),
+         base64_iterator(BOOST_MAKE_PFTO_WRAPPER(input + size)),
+         back_inserter(output));
 
     // Add padding so the decoder can tell how many bytes were actually
     // encoded.
@@ -129,25 +129,174 @@ string base64(const string &input) {
     return output;
 }
 
+string base64(const string &input) {
+    return base64(input.data(), input.size());
+}
+
 /// Encode a string using Base64, inserting CRLF linebreaks every 72
-/// characters.  Note we don't use insert_linebreaks from boost, because it
-/// just inserts regular newlines.
+/// characters, and write it to 'out' one line at a time.  Note we don't
+/// use insert_linebreaks from boost, because it just inserts regular
+/// newlines.
+void write_base64_wrapped(ostream &out, const char *input, size_t size) {
+    // Each full line holds exactly 54 input bytes, so only the last line
+    // can need padding.
+    const size_t line_input_size = 54;
+    char line[72 + 2];
+    size_t i = 0;
+    do {
+        size_t n(min(size - i, line_input_size));
+        char *end(copy(base64_iterator(BOOST_MAKE_PFTO_WRAPPER(input + i)),
+                       base64_iterator(BOOST_MAKE_PFTO_WRAPPER(input + i + n)),
+                       line));
+        size_t leftover_bits = ((end - line) * 6) % 8;
+        if (leftover_bits == 4) {
+            *end++ = '=';
+            *end++ = '=';
+        } else if (leftover_bits == 2) {
+            *end++ = '=';
+        }
+        *end++ = '\r';
+        *end++ = '\n';
+        out.write(line, end - line);
+        i += n;
+    } while (i < size);
+}
+
+string base64_wrapped(const char *input, size_t size) {
+    ostringstream out;
+    write_base64_wrapped(out, input, size);
+    return out.str();
+}
+
 string base64_wrapped(const string &input) {
-    string encoded(base64(input));
-    string output;
+    return base64_wrapped(input.data(), input.size());
+}
 
-    string::difference_type max_line_length = 72;
-    string::iterator i(encoded.begin());
-    while (encoded.end() - i > max_line_length) {
-        copy(i, i + max_line_length,
-             insert_iterator<string>(output, output.end()));
-        output += crlf;
-        i += max_line_length;
+namespace {
+    // Can this byte appear unescaped in quoted-printable output?  Note that
+    // spaces, tabs and line breaks need special handling.
+    inline bool qp_literal(unsigned char c) {
+        return c >= 33 && c <= 126 && c != '=';
     }
-    copy(i, encoded.end(), insert_iterator<string>(output, output.end()));
-    output += crlf;
 
-    return output;
+    inline bool qp_line_end(const char *input, size_t size, size_t i) {
+        return (i == size ||
+                (input[i] == '\r' && i + 1 < size && input[i+1] == '\n'));
+    }
+
+    const char *hex_digits("0123456789ABCDEF");
+}
+
+namespace {
+    // Collects small pieces of output and passes them to a stream in
+    // larger chunks, so we don't call into the stream for every byte.
+    class chunked_writer : boost::noncopyable {
+        ostream &m_out;
+        char m_buffer[4096];
+        size_t m_used;
+
+    public:
+        explicit chunked_writer(ostream &out) : m_out(out), m_used(0) {}
+
+        void put(char c) {
+            if (m_used == sizeof(m_buffer))
+                flush();
+            m_buffer[m_used++] = c;
+        }
+
+        void flush() {
+            m_out.write(m_buffer, m_used);
+            m_used = 0;
+        }
+    };
+}
+
+/// Encode 'input' as quoted-printable text (RFC 2045), treating CRLF as a
+/// line break and keeping lines to 76 characters.  The result is written
+/// to 'out'.
+void write_quoted_printable(ostream &out, const char *input, size_t size) {
+    chunked_writer output(out);
+
+    const size_t max_line_length = 76;
+    size_t line_length = 0;
+    for (size_t i = 0; i < size; ++i) {
+        unsigned char c(input[i]);
+
+        // Pass hard line breaks straight through.
+        if (c == '\r' && i + 1 < size && input[i+1] == '\n') {
+            output.put('\r');
+            output.put('\n');
+            line_length = 0;
+            ++i;
+            continue;
+        }
+
+        // Whitespace is only literal if it isn't at the end of a line.
+        bool literal(qp_literal(c) ||
+                     ((c == ' ' || c == '\t') &&
+                      !qp_line_end(input, size, i+1)));
+        size_t width(literal ? 1 : 3);
+
+        // Leave room for the '=' of a soft line break.
+        if (line_length + width > max_line_length - 1) {
+            output.put('=');
+            output.put('\r');
+            output.put('\n');
+            line_length = 0;
+        }
+
+        if (literal) {
+            output.put(static_cast<char>(c));
+        } else {
+            output.put('=');
+            output.put(hex_digits[c >> 4]);
+            output.put(hex_digits[c & 0xf]);
+        }
+        line_length += width;
+    }
+    output.put('\r');
+    output.put('\n');
+    output.flush();
+}
+
+string quoted_printable(const char *input, size_t size) {
+    ostringstream out;
+    write_quoted_printable(out, input, size);
+    return out.str();
+}
+
+string quoted_printable(const string &input) {
+    return quoted_printable(input.data(), input.size());
+}
+
+/// Would 'input' be smaller encoded as quoted-printable than as base64?
+/// This is true for mostly-ASCII text, and it only takes one quick scan to
+/// find out.
+bool prefer_quoted_printable(const char *input, size_t size) {
+    size_t escaped = 0;
+    const unsigned char *p(reinterpret_cast<const unsigned char *>(input));
+    const unsigned char *end(p + size);
+    for (; p != end; ++p) {
+        // Tabs and spaces are almost always passed through unchanged, so
+        // we don't bother to look at them closely.  CRLF pairs are passed
+        // through too, but a bare CR or LF is escaped like anything else.
+        unsigned char c(*p);
+        if (c == '\r' && p + 1 != end && p[1] == '\n')
+            ++p;
+        else if (!qp_literal(c) && c != ' ' && c != '\t')
+            ++escaped;
+    }
+
+    // Estimate our output sizes, including line breaks.
+    size_t qp_size(size + 2 * escaped);
+    qp_size += qp_size / 75 * 3;
+    size_t base64_size((size + 2) / 3 * 4);
+    base64_size += base64_size / 72 * 2;
+    return qp_size <= base64_size;
+}
+
+bool prefer_quoted_printable(const string &input) {
+    return prefer_quoted_printable(input.data(), input.size());
 }
 
 /// Does 'str' contain anything other than printable ASCII characters and
@@ -163,8 +312,7 @@ bool contains_special_characters(const string &str) {
 /// Encode a free-form RFC822 header value if necessary.  Currently, this
 /// uses B-encoding, but there's no reason why it couldn't prefer Q-encoding
 /// in some cases.
-string header_encode(const wstring &str) {
-    string utf8_str(wstring_to_utf8(str));
+string header_encode(const string &utf8_str) {
     if (contains_special_characters(utf8_str))
         return "=?UTF-8?B?" + base64(utf8_str) + "?=";
     else
@@ -172,49 +320,48 @@ string header_encode(const wstring &str) {
 }
 
 /// Encode an email address for use in a structured RFC822 header.
-string header_encode_email(const wstring &email) {
+string header_encode_email(const string &email) {
     // Pass the simple cases through unchanged.  Note that if the email
     // address contains Unicode characters, but isn't properly quoted, we
     // just pass it straight through and hope for the best.
-    string utf8_str(wstring_to_utf8(email));
-    if (email.size() == 0 || !contains_special_characters(utf8_str) ||
-        email[0] != L'"')
-        return utf8_str;
+    if (email.size() == 0 || !contains_special_characters(email) ||
+        email[0] != '"')
+        return email;
 
     // Parse the name back out of the email address.  This isn't terribly
     // robust, because it assumes that our input was produced by
     // rfc822_email.
-    wstring unquoted_name;
+    string unquoted_name;
     size_t i;
-    for (i = 1; i < email.size() && email[i] != L'"'; ++i) {
-        wchar_t c = email[i];
-        if (c == L'\\' && (i+1) < email.size())
+    for (i = 1; i < email.size() && email[i] != '"'; ++i) {
+        char c = email[i];
+        if (c == '\\' && (i+1) < email.size())
             unquoted_name += email[++i];
         else
             unquoted_name += c;
     }
-    wstring remainder;
+    string remainder;
     if (i < email.size())
         remainder = email.substr(i+1, string::npos);
 
     // Now that the name has been unquoted, encode it.  Note we should do
     // something more clever with Unicode characters in 'remainder'.
-    return header_encode(unquoted_name) + wstring_to_utf8(remainder);
+    return header_encode(unquoted_name) + remainder;
 }
 
 /// Encode a freeform header.
-string header(const string &name, const wstring &value) {
+string header(const string &name, const string &value) {
     return name + ": " + header_encode(value);
 }
 
 /// Encode a header containing a list of emails.
-string header(const string &name, const vector<wstring> &emails) {
+string header(const string &name, const vector<string> &emails) {
     if (emails.empty())
         throw runtime_error("Cannot format empty email list as header");
     ostringstream out;
     out << name << ": ";
     bool first = true;
-    BOOST_FOREACH(const wstring &email, emails) {
+    BOOST_FOREACH(const string &email, emails) {
         if (first)
             first = false;
         else
@@ -234,44 +381,74 @@ string header(const string &name, const ptime &time) {
     return out.str();
 }
 
+namespace {
+    // Output one part of our multipart/alternative body, using whichever
+    // transfer encoding produces the least output.
+    void output_body_part(ostream &out, const char *content_type,
+                          const char *body, size_t size) {
+        out << "--=_boundary" << crlf
+            << "Content-Type: " << content_type << crlf;
+        if (prefer_quoted_printable(body, size)) {
+            out << "Content-Transfer-Encoding: quoted-printable" << crlf
+                << crlf;
+            write_quoted_printable(out, body, size);
+        } else {
+            out << "Content-Transfer-Encoding: base64" << crlf
+                << crlf;
+            write_base64_wrapped(out, body, size);
+        }
+    }
+}
+
+namespace {
+    // Output a header containing a list of emails, if 'd' has 'tag'.
+    void output_emails_header(ostream &out, const document &d,
+                              const char *name, const char *tag) {
+        const any *value(d.find_tag(tag));
+        if (value == NULL || value->empty())
+            return;
+        const tag_string_list &list(any_cast<const tag_string_list &>(*value));
+        vector<string> emails;
+        emails.reserve(list.size());
+        BOOST_FOREACH(const tag_string &email, list)
+            emails.push_back(to_std_string(email));
+        out << header(name, emails) << crlf;
+    }
+}
+
 /// Convert a document into an RFC822-format email message.
 void document_to_rfc822(ostream &out, const document &d) {
-    if (!d[L"#From"].empty())
-        out << header("From", any_cast<vector<wstring> >(d[L"#From"])) << crlf;
-    if (!d[L"#Subject"].empty())
-        out << header("Subject", any_cast<wstring>(d[L"#Subject"])) << crlf;
-    if (!d[L"#DateSent"].empty())
-        out << header("Date", any_cast<ptime>(d[L"#DateSent"])) << crlf;
-    if (!d[L"#To"].empty())
-        out << header("To", any_cast<vector<wstring> >(d[L"#To"])) << crlf;
-    if (!d[L"#CC"].empty())
-        out << header("CC", any_cast<vector<wstring> >(d[L"#CC"])) << crlf;
-    if (!d[L"#BCC"].empty())
-        out << header("BCC", any_cast<vector<wstring> >(d[L"#BCC"])) << crlf;
+    output_emails_header(out, d, "From", "#From");
+    const any *subject(d.find_tag("#Subject"));
+    if (subject != NULL && !subject->empty())
+        out << header("Subject", to_std_string(
+                          any_cast<const tag_string &>(*subject))) << crlf;
+    if (!d["#DateSent"].empty())
+        out << header("Date", any_cast<ptime>(d["#DateSent"])) << crlf;
+    output_emails_header(out, d, "To", "#To");
+    output_emails_header(out, d, "CC", "#CC");
+    output_emails_header(out, d, "BCC", "#BCC");
     out << "MIME-Version: 1.0" << crlf
         << "Content-Type: multipart/alternative; boundary=\"=_boundary\""
         << crlf
         << "X-Note: Exported from PST by "
         << "http://github.com/aranetic/process-pst" << crlf;
-    if (!d[L"#Header"].empty())
+    if (d.has_tag("#Header"))
         out << "X-Note: See load file metadata for original headers" << crlf;
     out << crlf;
 
     if (d.has_text()) {
-        out << "--=_boundary" << crlf
-            << "Content-Type: text/plain; charset=UTF-8" << crlf
-            << "Content-Transfer-Encoding: base64" << crlf
-            << crlf
-            << base64_wrapped(wstring_to_utf8(d.text()));
+        const string &text(d.text());
+        output_body_part(out, "text/plain; charset=UTF-8",
+                         text.data(), text.size());
     }
 
+    // Encode the HTML straight out of the document, without copying it.
     if (d.has_html()) {
-        string html(d.html().begin(), d.html().end());
-        out << "--=_boundary" << crlf
-            << "Content-Type: text/html" << crlf
-            << "Content-Transfer-Encoding: base64" << crlf
-            << crlf
-            << base64_wrapped(html);
+        const vector<uint8_t> &html(d.html());
+        output_body_part(out, "text/html",
+                         reinterpret_cast<const char *>(html.data()),
+                         html.size());
     }
 
     // TODO: Warn about messages with no text or HTML body.
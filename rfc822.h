@@ -22,22 +22,33 @@
 #define RFC822_H
 
 #include <string>
+#include <iosfwd>
 
 namespace boost { namespace posix_time { class ptime; } }
 class document;
 
-extern std::wstring rfc822_quote(const std::wstring &str);
-extern std::wstring rfc822_email(const std::wstring &display_name,
-                                 const std::wstring &email);
+extern std::string rfc822_quote(const std::string &str);
+extern std::string rfc822_email(const std::string &display_name,
+                                const std::string &email);
 
+extern std::string base64(const char *input, size_t size);
 extern std::string base64(const std::string &input);
+extern void write_base64_wrapped(std::ostream &out,
+                                 const char *input, size_t size);
+extern std::string base64_wrapped(const char *input, size_t size);
 extern std::string base64_wrapped(const std::string &input);
+extern void write_quoted_printable(std::ostream &out,
+                                   const char *input, size_t size);
+extern std::string quoted_printable(const char *input, size_t size);
+extern std::string quoted_printable(const std::string &input);
+extern bool prefer_quoted_printable(const char *input, size_t size);
+extern bool prefer_quoted_printable(const std::string &input);
 extern bool contains_special_characters(const std::string &str);
-extern std::string header_encode(const std::wstring &str);
-extern std::string header_encode_email(const std::wstring &email);
-extern std::string header(const std::string &name, const std::wstring &value);
+extern std::string header_encode(const std::string &str);
+extern std::string header_encode_email(const std::string &email);
+extern std::string header(const std::string &name, const std::string &value);
 extern std::string header(const std::string &name,
-                          const std::vector<std::wstring> &emails);
+                          const std::vector<std::string> &emails);
 extern std::string header(const std::string &name,
                           const boost::posix_time::ptime &time);
 
@@ -19,6 +19,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <cassert>
+#include <sstream>
 
 #include <boost/date_time/posix_time/posix_time.hpp>
 
@@ -29,11 +30,6 @@
 using namespace std;
 using namespace boost::posix_time;
 
-const wchar_t *long_wchar_t_string =
-    L"The quick brown fox jumped over the lazy dog\u2014or did she?  "
-    L"The quick brown fox jumped over the lazy dog\u2014or did she?  "
-    L"The quick brown fox jumped over the lazy dog\u2014or did she?";
-
 const char *long_utf8_string =
     "The quick brown fox jumped over the lazy dog\xE2\x80\x94or did she?  "
     "The quick brown fox jumped over the lazy dog\xE2\x80\x94or did she?  "
@@ -45,33 +41,38 @@ const char *long_utf8_string_base64 =
 "ciBkaWQgc2hlPyAgVGhlIHF1aWNrIGJyb3duIGZveCBqdW1wZWQgb3ZlciB0aGUgbGF6eSBk\r\n"
 "b2figJRvciBkaWQgc2hlPw==\r\n";
 
+const char *long_utf8_string_qp =
+"The quick brown fox jumped over the lazy dog=E2=80=94or did she?  The quick=\r\n"
+" brown fox jumped over the lazy dog=E2=80=94or did she?  The quick brown fo=\r\n"
+"x jumped over the lazy dog=E2=80=94or did she?\r\n";
+
 void rfc822_quote_should_quote_strings_when_necessary() {
-    assert(L"" == rfc822_quote(L""));
-    assert(L"John Smith" == rfc822_quote(L"John Smith"));
-    assert(L"\"John Q. Smith\"" == rfc822_quote(L"John Q. Smith"));
-    assert(L"\"\\\"\\\\\"" == rfc822_quote(L"\"\\"));
+    assert("" == rfc822_quote(""));
+    assert("John Smith" == rfc822_quote("John Smith"));
+    assert("\"John Q. Smith\"" == rfc822_quote("John Q. Smith"));
+    assert("\"\\\"\\\\\"" == rfc822_quote("\"\\"));
     
-    wstring escape_chars(L"()<>@,;:.[]"); // Omits " and \, handled above.
+    string escape_chars("()<>@,;:.[]"); // Omits " and \, handled above.
     for (size_t i = 0; i < escape_chars.size(); ++i) {
-        wstring input(escape_chars.substr(i, 1));
-        wstring expected(L"\"" + input + L"\"");
+        string input(escape_chars.substr(i, 1));
+        string expected("\"" + input + "\"");
         assert(expected == rfc822_quote(input));
     }
 }
 
 void rfc822_email_should_build_email_addresses() {
-    assert(L"Foo <foo@bar.com>" == rfc822_email(L"Foo", L"foo@bar.com"));
-    assert(L"Foo" == rfc822_email(L"Foo", L""));
-    assert(L"\"Foo B.\"" == rfc822_email(L"Foo B.", L""));
-    assert(L"foo@bar.com" == rfc822_email(L"", L"foo@bar.com"));
-    assert(L"foo@bar.com" == rfc822_email(L"foo@bar.com", L"foo@bar.com"));
-    assert(L"\"Foo B.\" <foo@bar.com>" ==
-           rfc822_email(L"Foo B.", L"foo@bar.com"));
+    assert("Foo <foo@bar.com>" == rfc822_email("Foo", "foo@bar.com"));
+    assert("Foo" == rfc822_email("Foo", ""));
+    assert("\"Foo B.\"" == rfc822_email("Foo B.", ""));
+    assert("foo@bar.com" == rfc822_email("", "foo@bar.com"));
+    assert("foo@bar.com" == rfc822_email("foo@bar.com", "foo@bar.com"));
+    assert("\"Foo B.\" <foo@bar.com>" ==
+           rfc822_email("Foo B.", "foo@bar.com"));
 
     // Note that header_encode_email relies on all Unicode characters being
     // quoted as follows when re-encoding addresses to be 7-bit clean.
-    assert(L"\"Foo\u2014Bar\" <foo@bar.com>" ==
-           rfc822_email(L"Foo\u2014Bar", L"foo@bar.com"));
+    assert("\"Foo\u2014Bar\" <foo@bar.com>" ==
+           rfc822_email("Foo\u2014Bar", "foo@bar.com"));
 }
 
 void base64_should_encode_string() {
@@ -93,6 +94,68 @@ void base64_wrapped_should_encode_string_with_line_breaks() {
     assert(long_utf8_string_base64 == base64_wrapped(long_utf8_string));
 }
 
+void quoted_printable_should_encode_string_with_line_breaks() {
+    assert("\r\n" == quoted_printable(""));
+    assert("abc\r\n" == quoted_printable("abc"));
+    assert(long_utf8_string_qp == quoted_printable(long_utf8_string));
+
+    // Escape '=', bare CR and LF, control characters and 8-bit data, but
+    // leave CRLF alone.
+    assert("a=3Db\r\nc=0Ad=0De=01=FF\r\n" ==
+           quoted_printable("a=b\r\nc\nd\re\x01\xFF"));
+
+    // Escape whitespace at the end of a line, but nowhere else.
+    assert("a b=20\r\nc=09\r\n" == quoted_printable("a b \r\nc\t"));
+
+    // Never produce lines longer than 76 characters.
+    string long_line(string(75, 'x') + "=");
+    assert(string(75, 'x') + "=\r\n=3D\r\n" == quoted_printable(long_line));
+}
+
+void encoders_should_stream_output_longer_than_their_buffers() {
+    // Long enough to need several of our internal output chunks.
+    string input(20000, 'x');
+    ostringstream qp;
+    write_quoted_printable(qp, input.data(), input.size());
+    string expected_qp;
+    for (size_t i = 0; i + 75 < input.size(); i += 75)
+        expected_qp += string(75, 'x') + "=\r\n";
+    expected_qp += string(input.size() % 75, 'x') + "\r\n";
+    assert(expected_qp == qp.str());
+
+    ostringstream b64;
+    write_base64_wrapped(b64, input.data(), input.size());
+    string encoded(base64(input)), expected_b64;
+    for (size_t i = 0; i < encoded.size(); i += 72)
+        expected_b64 += encoded.substr(i, 72) + "\r\n";
+    assert(expected_b64 == b64.str());
+}
+
+void prefer_quoted_printable_should_detect_mostly_ascii_text() {
+    assert(prefer_quoted_printable(""));
+    assert(prefer_quoted_printable("Hello, world!\r\n"));
+    assert(prefer_quoted_printable(long_utf8_string));
+
+    // Mostly non-ASCII text is smaller as base64.
+    string cjk;
+    for (int i = 0; i < 20; ++i)
+        cjk += "\xE4\xB8\xAD\xE6\x96\x87";
+    assert(!prefer_quoted_printable(cjk));
+
+    // Only CRLF passes through quoted-printable unchanged.  Bare line
+    // feeds are escaped, so short LF-terminated lines are smaller as
+    // base64.
+    string crlf_lines, lf_lines;
+    for (int i = 0; i < 100; ++i) {
+        crlf_lines += "a\r\n";
+        lf_lines += "a\n";
+    }
+    assert(prefer_quoted_printable(crlf_lines));
+    assert(!prefer_quoted_printable(lf_lines));
+    assert(quoted_printable(lf_lines).size() >
+           base64_wrapped(lf_lines).size());
+}
+
 void contains_special_characters_should_detect_non_ascii_characters() {
     assert(!contains_special_characters(""));
     assert(!contains_special_characters("plain text!"));
@@ -101,52 +164,52 @@ void contains_special_characters_should_detect_non_ascii_characters() {
 }
 
 void header_encode_should_encode_special_characters() {
-    assert("" == header_encode(L""));
-    assert("Re: The fridge" == header_encode(L"Re: The fridge"));
+    assert("" == header_encode(""));
+    assert("Re: The fridge" == header_encode("Re: The fridge"));
 
     string utf8("Re: The fridge\xE2\x80\x94it's evil!");
-    wstring wstr(L"Re: The fridge\u2014it's evil!");
-    assert("=?UTF-8?B?" + base64(utf8) + "?=" == header_encode(wstr));
+    string str("Re: The fridge\u2014it's evil!");
+    assert("=?UTF-8?B?" + base64(utf8) + "?=" == header_encode(str));
 }
 
 void header_encode_email_should_encode_special_characters() {
-    assert("" == header_encode_email(L""));
+    assert("" == header_encode_email(""));
 
     // Pass all simple ASCII cases through unchanged.
-    const wchar_t *unchanged[] = {
-        L"Foo <foo@bar.com>", L"Foo", L"\"Foo B.\"",
-        L"foo@bar.com", L"\"Foo B.\" <foo@bar.com>",
+    const char *unchanged[] = {
+        "Foo <foo@bar.com>", "Foo", "\"Foo B.\"",
+        "foo@bar.com", "\"Foo B.\" <foo@bar.com>",
         NULL
     };
-    for (const wchar_t **iter = unchanged; *iter != NULL; ++iter)
-        assert(wstring_to_string(*iter) == header_encode_email(*iter));
+    for (const char **iter = unchanged; *iter != NULL; ++iter)
+        assert(*iter == header_encode_email(*iter));
 
     // Two current limitations here: 1) We don't attempt to encode Unicode
     // characters appearing in the email address itself, and 2) we assume
     // that all Unicode characters in the name part were produced by
     // rfc822_email, and are therefore automatically quoted.
-    assert(header_encode(L"Foo\u2014Bar") + " <foo@bar.com>" ==
-           header_encode_email(L"\"Foo\u2014Bar\" <foo@bar.com>"));
-    assert(header_encode(L"Foo\u2014Bar") ==
-           header_encode_email(L"\"Foo\u2014Bar\""));
-    assert(header_encode(L" \" \u2014 \\ ") ==
-           header_encode_email(L"\" \\\" \u2014 \\\\ \""));
-    assert(header_encode(L"\u2014") ==
-           header_encode_email(L"\"\u2014"));
+    assert(header_encode("Foo\u2014Bar") + " <foo@bar.com>" ==
+           header_encode_email("\"Foo\u2014Bar\" <foo@bar.com>"));
+    assert(header_encode("Foo\u2014Bar") ==
+           header_encode_email("\"Foo\u2014Bar\""));
+    assert(header_encode(" \" \u2014 \\ ") ==
+           header_encode_email("\" \\\" \u2014 \\\\ \""));
+    assert(header_encode("\u2014") ==
+           header_encode_email("\"\u2014"));
 }
 
 void header_should_turn_a_string_into_a_freeform_header() {
-    assert("Subject: Re: The fridge" == header("Subject", L"Re: The fridge"));
-    wstring wstr(L"Re: The fridge\u2014it's evil!");
-    assert("Subject: " + header_encode(wstr) == header("Subject", wstr));
+    assert("Subject: Re: The fridge" == header("Subject", "Re: The fridge"));
+    string str("Re: The fridge\u2014it's evil!");
+    assert("Subject: " + header_encode(str) == header("Subject", str));
 }
 
 void header_should_turn_a_list_of_emails_into_a_structured_header() {
-    vector<wstring> addresses;
-    addresses.push_back(L"Foo <foo@bar.com>");
-    addresses.push_back(L"\"Foo\u2014Bar\" <foo@bar.com>");
+    vector<string> addresses;
+    addresses.push_back("Foo <foo@bar.com>");
+    addresses.push_back("\"Foo\u2014Bar\" <foo@bar.com>");
     assert("To: Foo <foo@bar.com>,\r\n  " +
-           header_encode_email(L"\"Foo\u2014Bar\" <foo@bar.com>") ==
+           header_encode_email("\"Foo\u2014Bar\" <foo@bar.com>") ==
            header("To", addresses));
 }
 
@@ -158,34 +221,34 @@ void header_should_format_dates() {
 void document_to_rfc822_should_include_headers_text_and_html() {
     document d;
 
-    vector<wstring> from;
-    from.push_back(L"Foo <foo@example.com>");
-    d[L"#From"] = from;
+    vector<string> from;
+    from.push_back("Foo <foo@example.com>");
+    d.set_strings("#From", from);
 
-    vector<wstring> to;
-    to.push_back(L"Bar <bar@example.com>");
-    d[L"#To"] = to;
+    vector<string> to;
+    to.push_back("Bar <bar@example.com>");
+    d.set_strings("#To", to);
 
-    vector<wstring> cc;
-    cc.push_back(L"Baz <baz@example.com>");
-    cc.push_back(L"Moby <moby@example.com>");
-    d[L"#CC"] = cc;
+    vector<string> cc;
+    cc.push_back("Baz <baz@example.com>");
+    cc.push_back("Moby <moby@example.com>");
+    d.set_strings("#CC", cc);
 
-    vector<wstring> bcc;
-    bcc.push_back(L"Quux <quux@example.com>");
-    d[L"#BCC"] = bcc;
+    vector<string> bcc;
+    bcc.push_back("Quux <quux@example.com>");
+    d.set_strings("#BCC", bcc);
 
-    d[L"#Subject"] = wstring(L"Re: The fridge");
-    d[L"#DateSent"] = from_iso_string("20020131T235959Z");
-    d[L"#Header"] = wstring(L"Subject: Re: the fridge\r\n");
+    d.set_string("#Subject", "Re: The fridge");
+    d["#DateSent"] = from_iso_string("20020131T235959Z");
+    d.set_string("#Header", "Subject: Re: the fridge\r\n");
 
-    d.set_text(long_wchar_t_string);
+    d.set_text(long_utf8_string);
 
     // TODO: HTML body
     string html("<p>The quick brown fox jumped over the lazy dog.</p>");
     d.set_html(vector<uint8_t>(html.begin(), html.end()));
 
-    const char *expected =
+    string expected =
         "From: Foo <foo@example.com>\r\n"
         "Subject: Re: The fridge\r\n"
         "Date: 31 Jan 2002 23:59:59 GMT\r\n"
@@ -201,17 +264,14 @@ void document_to_rfc822_should_include_headers_text_and_html() {
         "\r\n"
         "--=_boundary\r\n"
         "Content-Type: text/plain; charset=UTF-8\r\n"
-        "Content-Transfer-Encoding: base64\r\n"
+        "Content-Transfer-Encoding: quoted-printable\r\n"
         "\r\n"
-"VGhlIHF1aWNrIGJyb3duIGZveCBqdW1wZWQgb3ZlciB0aGUgbGF6eSBkb2figJRvciBkaWQg\r\n"
-"c2hlPyAgVGhlIHF1aWNrIGJyb3duIGZveCBqdW1wZWQgb3ZlciB0aGUgbGF6eSBkb2figJRv\r\n"
-"ciBkaWQgc2hlPyAgVGhlIHF1aWNrIGJyb3duIGZveCBqdW1wZWQgb3ZlciB0aGUgbGF6eSBk\r\n"
-"b2figJRvciBkaWQgc2hlPw==\r\n"
+        + string(long_utf8_string_qp) +
         "--=_boundary\r\n"
         "Content-Type: text/html\r\n"
-        "Content-Transfer-Encoding: base64\r\n"
+        "Content-Transfer-Encoding: quoted-printable\r\n"
         "\r\n"
-"PHA+VGhlIHF1aWNrIGJyb3duIGZveCBqdW1wZWQgb3ZlciB0aGUgbGF6eSBkb2cuPC9wPg==\r\n"
+        "<p>The quick brown fox jumped over the lazy dog.</p>\r\n"
         "--=_boundary--\r\n";
     
     ostringstream out;
@@ -225,6 +285,9 @@ int rfc822_spec(int argc, char **argv) {
 
     base64_should_encode_string();
     base64_wrapped_should_encode_string_with_line_breaks();
+    quoted_printable_should_encode_string_with_line_breaks();
+    encoders_should_stream_output_longer_than_their_buffers();
+    prefer_quoted_printable_should_detect_mostly_ascii_text();
 
     contains_special_characters_should_detect_non_ascii_characters();
 
@@ -0,0 +1,443 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include "utilities.h"
+#include "rtf.h"
+
+using namespace std;
+
+//==========================================================================
+//  LZFu decompression
+
+namespace {
+    // Every compressed RTF stream starts with this dictionary.
+    const char lzfu_prebuffer[] =
+        "{\\rtf1\\ansi\\mac\\deff0\\deftab720{\\fonttbl;}"
+        "{\\f0\\fnil \\froman \\fswiss \\fmodern \\fscript \\fdecor "
+        "MS Sans SerifSymbolArialTimes New RomanCourier"
+        "{\\colortbl\\red0\\green0\\blue0\r\n\\par "
+        "\\pard\\plain\\f0\\fs20\\b\\i\\u\\tab\\tx";
+
+    const size_t lzfu_dictionary_size = 4096;
+    const uint32_t lzfu_compressed = 0x75465a4c;   // "LZFu"
+    const uint32_t lzfu_uncompressed = 0x414c454d; // "MELA"
+
+    uint32_t read_le32(const uint8_t *p) {
+        return (uint32_t(p[0]) | (uint32_t(p[1]) << 8) |
+                (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24));
+    }
+
+    // The usual CRC-32 table, but [MS-OXRTFCP] starts from 0 and doesn't
+    // invert the result, so we can't use zlib's crc32.
+    struct crc_table {
+        uint32_t entries[256];
+
+        crc_table() {
+            for (uint32_t n = 0; n < 256; ++n) {
+                uint32_t c(n);
+                for (int k = 0; k < 8; ++k)
+                    c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+                entries[n] = c;
+            }
+        }
+    };
+
+    const crc_table lzfu_crc_table;
+
+    uint32_t lzfu_crc(const uint8_t *p, const uint8_t *end) {
+        uint32_t crc(0);
+        for (; p < end; ++p)
+            crc = lzfu_crc_table.entries[(crc ^ *p) & 0xff] ^ (crc >> 8);
+        return crc;
+    }
+}
+
+void lzfu_decompress(const uint8_t *data, size_t size, vector<uint8_t> &out) {
+    out.clear();
+    if (size < 16)
+        throw runtime_error("Compressed RTF is too short");
+
+    // COMPSIZE counts everything after itself, including the rest of the
+    // header.
+    uint32_t comp_size(read_le32(data));
+    uint32_t raw_size(read_le32(data + 4));
+    uint32_t comp_type(read_le32(data + 8));
+    uint32_t crc(read_le32(data + 12));
+    if (comp_size < 12 || comp_size - 12 > size - 16)
+        throw runtime_error("Compressed RTF is truncated");
+    const uint8_t *p(data + 16), *end(data + 4 + comp_size);
+
+    if (comp_type == lzfu_uncompressed) {
+        if (raw_size > size_t(end - p))
+            throw runtime_error("Uncompressed RTF is truncated");
+        out.assign(p, p + raw_size);
+        return;
+    } else if (comp_type != lzfu_compressed) {
+        throw runtime_error("Unknown compressed RTF type");
+    }
+    if (lzfu_crc(p, end) != crc)
+        throw runtime_error("Compressed RTF has a bad CRC");
+
+    // Each reference expands 2 bytes into at most 17, so don't trust a
+    // RAWSIZE which claims more than that.
+    out.reserve(min(size_t(raw_size), size_t(end - p) * 9));
+
+    uint8_t dictionary[lzfu_dictionary_size];
+    size_t write_pos(sizeof(lzfu_prebuffer) - 1);
+    memcpy(dictionary, lzfu_prebuffer, write_pos);
+
+    while (p < end) {
+        uint8_t control(*p++);
+        for (int bit = 0; bit < 8 && p < end; ++bit, control >>= 1) {
+            if (!(control & 1)) {
+                uint8_t c(*p++);
+                out.push_back(c);
+                dictionary[write_pos] = c;
+                write_pos = (write_pos + 1) % lzfu_dictionary_size;
+                continue;
+            }
+
+            // A 12-bit dictionary offset and a 4-bit length, big-endian.
+            if (end - p < 2)
+                throw runtime_error("Compressed RTF is truncated");
+            unsigned reference((unsigned(p[0]) << 8) | p[1]);
+            p += 2;
+            size_t offset(reference >> 4), length((reference & 0xf) + 2);
+            if (offset == write_pos)
+                return; // The end of our data.
+            for (size_t i = 0; i < length; ++i) {
+                uint8_t c(dictionary[(offset + i) % lzfu_dictionary_size]);
+                out.push_back(c);
+                dictionary[write_pos] = c;
+                write_pos = (write_pos + 1) % lzfu_dictionary_size;
+            }
+        }
+    }
+}
+
+vector<uint8_t> lzfu_decompress(const vector<uint8_t> &data) {
+    vector<uint8_t> out;
+    lzfu_decompress(data.data(), data.size(), out);
+    return out;
+}
+
+
+//==========================================================================
+//  RTF parsing
+
+namespace {
+    // Destinations which never contain any of the document's text.
+    const char *ignored_destinations[] = {
+        "fonttbl", "colortbl", "stylesheet", "info", "pict", "object",
+        "header", "headerl", "headerr", "headerf",
+        "footer", "footerl", "footerr", "footerf",
+        "listtable", "listoverridetable", "rsidtbl", "generator",
+        "xmlnstbl", "themedata", "colorschememapping", "latentstyles",
+        "datastore", "fldinst", "filetbl", "revtbl",
+        "pntext", "pntxta", "pntxtb",
+        NULL
+    };
+
+    struct symbol_word {
+        const char *word;
+        uint32_t code_point;
+    };
+
+    const symbol_word symbol_words[] = {
+        { "lquote", 0x2018 }, { "rquote", 0x2019 },
+        { "ldblquote", 0x201C }, { "rdblquote", 0x201D },
+        { "bullet", 0x2022 }, { "endash", 0x2013 }, { "emdash", 0x2014 },
+        { "enspace", 0x2002 }, { "emspace", 0x2003 },
+        { NULL, 0 }
+    };
+
+    bool is_word(const uint8_t *word, size_t length, const char *expected) {
+        return (strlen(expected) == length &&
+                memcmp(word, expected, length) == 0);
+    }
+
+    bool is_ignored_destination(const uint8_t *word, size_t length) {
+        for (const char **d = ignored_destinations; *d != NULL; ++d)
+            if (is_word(word, length, *d))
+                return true;
+        return false;
+    }
+
+    bool is_alpha(uint8_t c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    bool is_digit(uint8_t c) { return c >= '0' && c <= '9'; }
+
+    int hex_value(uint8_t c) {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        else if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    // Collects plain text as UTF-8.
+    class text_output {
+        string &m_out;
+
+    public:
+        explicit text_output(string &out) : m_out(out) {}
+
+        void byte(uint8_t c) { code_point(cp1252_to_code_point(c)); }
+        void code_point(uint32_t c) { code_point_to_utf8_append(m_out, c); }
+        void newline() { m_out += "\r\n"; }
+    };
+
+    // Collects HTML in whatever encoding it was originally written in.
+    class html_output {
+        vector<uint8_t> &m_out;
+
+    public:
+        explicit html_output(vector<uint8_t> &out) : m_out(out) {}
+
+        void byte(uint8_t c) { m_out.push_back(c); }
+        void code_point(uint32_t c) {
+            if (c < 0x80) {
+                m_out.push_back(uint8_t(c));
+            } else {
+                char ref[16];
+                int length(snprintf(ref, sizeof(ref), "&#%u;", c));
+                m_out.insert(m_out.end(), ref, ref + length);
+            }
+        }
+        void newline() { m_out.push_back('\r'); m_out.push_back('\n'); }
+    };
+
+    // A single-pass RTF reader.  When 'html' is true, we output the
+    // contents of \*\htmltag destinations, and suppress \htmlrtf regions,
+    // as described in [MS-OXRTFEX].  Otherwise, we output the same text an
+    // RTF reader would display.
+    template <typename Output>
+    class rtf_reader {
+        struct group_state {
+            bool skip;       // Is this group's content hidden?
+            bool htmltag;    // Are we inside \*\htmltag?
+            bool htmlrtf;    // Are we inside an \htmlrtf region?
+            int32_t uc;      // Fallback characters after each \uN.
+        };
+
+        Output &m_out;
+        bool m_html;
+        group_state m_state;
+        vector<group_state> m_stack;
+        int32_t m_skip_chars;
+        uint32_t m_high_surrogate;
+
+        bool visible() const {
+            return (!m_state.skip &&
+                    (!m_html || m_state.htmltag || !m_state.htmlrtf));
+        }
+
+        void byte(uint8_t c) {
+            if (m_skip_chars > 0)
+                --m_skip_chars;
+            else if (visible())
+                m_out.byte(c);
+        }
+
+        void code_point(uint32_t c) {
+            if (!visible())
+                return;
+            if (c >= 0xD800 && c <= 0xDBFF) {
+                m_high_surrogate = c;
+                return;
+            }
+            if (c >= 0xDC00 && c <= 0xDFFF && m_high_surrogate != 0)
+                c = 0x10000 + ((m_high_surrogate - 0xD800) << 10) +
+                    (c - 0xDC00);
+            m_high_surrogate = 0;
+            m_out.code_point(c);
+        }
+
+        void control_word(const uint8_t *word, size_t length,
+                          bool has_param, int32_t param) {
+            if (is_word(word, length, "par") ||
+                is_word(word, length, "line")) {
+                if (visible())
+                    m_out.newline();
+            } else if (is_word(word, length, "tab")) {
+                byte('\t');
+            } else if (is_word(word, length, "u")) {
+                // Parameters are signed 16-bit values.
+                code_point(uint32_t(param < 0 ? param + 0x10000 : param));
+                m_skip_chars = m_state.uc;
+            } else if (is_word(word, length, "uc")) {
+                m_state.uc = has_param ? param : 1;
+            } else if (is_word(word, length, "htmlrtf")) {
+                m_state.htmlrtf = !has_param || param != 0;
+            } else {
+                for (const symbol_word *s = symbol_words; s->word; ++s) {
+                    if (is_word(word, length, s->word)) {
+                        code_point(s->code_point);
+                        break;
+                    }
+                }
+            }
+        }
+
+    public:
+        rtf_reader(Output &out, bool html)
+            : m_out(out), m_html(html), m_skip_chars(0), m_high_surrogate(0) {
+            group_state initial = { false, false, false, 1 };
+            m_state = initial;
+            m_stack.reserve(32);
+        }
+
+        void read(const uint8_t *p, const uint8_t *end) {
+            // Destinations may only appear at the start of a group, and
+            // may be marked as ignorable with \*.
+            bool group_start(false), ignorable(false);
+            while (p < end) {
+                uint8_t c(*p++);
+                if (c == '{') {
+                    m_stack.push_back(m_state);
+                    group_start = true;
+                    ignorable = false;
+                    m_skip_chars = 0;
+                    continue;
+                } else if (c == '}') {
+                    if (!m_stack.empty()) {
+                        m_state = m_stack.back();
+                        m_stack.pop_back();
+                    }
+                    group_start = false;
+                    m_skip_chars = 0;
+                    continue;
+                } else if (c == '\r' || c == '\n') {
+                    continue;
+                }
+
+                bool at_group_start(group_start);
+                group_start = false;
+                if (c != '\\') {
+                    byte(c);
+                    continue;
+                }
+                if (p == end)
+                    break;
+
+                // Control symbols.
+                c = *p++;
+                if (c == '\'') {
+                    int high(p < end ? hex_value(p[0]) : -1);
+                    int low(p + 1 < end ? hex_value(p[1]) : -1);
+                    if (high >= 0 && low >= 0) {
+                        byte(uint8_t(high * 16 + low));
+                        p += 2;
+                    }
+                    continue;
+                } else if (c == '*') {
+                    ignorable = true;
+                    group_start = at_group_start;
+                    continue;
+                } else if (!is_alpha(c)) {
+                    switch (c) {
+                        case '\\': case '{': case '}': byte(c); break;
+                        case '~': code_point(0xA0); break;
+                        case '_': byte('-'); break;
+                        case '\r': case '\n':
+                            if (visible())
+                                m_out.newline();
+                            break;
+                    }
+                    continue;
+                }
+
+                // Control words, with an optional numeric parameter and
+                // an optional space delimiter.
+                const uint8_t *word(p - 1);
+                while (p < end && is_alpha(*p))
+                    ++p;
+                size_t length(p - word);
+                bool has_param(false), negative(false);
+                int32_t param(0);
+                if (p + 1 < end && *p == '-' && is_digit(p[1])) {
+                    negative = true;
+                    ++p;
+                }
+                for (int digits = 0; p < end && is_digit(*p); ++p, ++digits) {
+                    if (digits < 9)
+                        param = param * 10 + (*p - '0');
+                    has_param = true;
+                }
+                if (negative)
+                    param = -param;
+                if (p < end && *p == ' ')
+                    ++p;
+
+                if (at_group_start &&
+                    (ignorable || is_ignored_destination(word, length))) {
+                    if (m_html && ignorable &&
+                        is_word(word, length, "htmltag"))
+                        m_state.htmltag = true;
+                    else
+                        m_state.skip = true;
+                } else if (is_word(word, length, "bin")) {
+                    // Skip binary data without interpreting it.
+                    p += min(size_t(max(param, int32_t(0))), size_t(end - p));
+                } else {
+                    control_word(word, length, has_param, param);
+                }
+                ignorable = false;
+            }
+        }
+    };
+}
+
+bool rtf_has_encapsulated_html(const vector<uint8_t> &rtf) {
+    // \fromhtml must appear in the RTF header, before any text.
+    static const char marker[] = "\\fromhtml1";
+    vector<uint8_t>::const_iterator end(rtf.begin() +
+                                        min(rtf.size(), size_t(1024)));
+    return search(rtf.begin(), end, marker,
+                  marker + sizeof(marker) - 1) != end;
+}
+
+vector<uint8_t> rtf_to_html(const vector<uint8_t> &rtf) {
+    vector<uint8_t> html;
+    html.reserve(rtf.size());
+    html_output out(html);
+    rtf_reader<html_output> reader(out, true);
+    reader.read(rtf.data(), rtf.data() + rtf.size());
+    return html;
+}
+
+string rtf_to_text(const vector<uint8_t> &rtf) {
+    string text;
+    text.reserve(rtf.size() / 2);
+    text_output out(text);
+    rtf_reader<text_output> reader(out, false);
+    reader.read(rtf.data(), rtf.data() + rtf.size());
+    return text;
+}
@@ -0,0 +1,52 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef RTF_H
+#define RTF_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/// Decompress a PidTagRtfCompressed value, as described in [MS-OXRTFCP],
+/// replacing the contents of 'out'.  We handle both compressed ("LZFu")
+/// and uncompressed ("MELA") data, and throw a runtime_error if the data
+/// is corrupt.
+extern void lzfu_decompress(const uint8_t *data, size_t size,
+                            std::vector<uint8_t> &out);
+extern std::vector<uint8_t> lzfu_decompress(const std::vector<uint8_t> &data);
+
+/// Does 'rtf' contain an HTML document encapsulated as described in
+/// [MS-OXRTFEX]?
+extern bool rtf_has_encapsulated_html(const std::vector<uint8_t> &rtf);
+
+/// Recover the original HTML from 'rtf'.  Bytes written as \'xx are
+/// passed through unchanged, because they're in the HTML's own encoding,
+/// and Unicode characters are written as numeric character references.
+/// \pre rtf_has_encapsulated_html(rtf)
+extern std::vector<uint8_t> rtf_to_html(const std::vector<uint8_t> &rtf);
+
+/// Extract the plain text from 'rtf', as UTF-8.  8-bit characters are
+/// assumed to use Windows code page 1252, which is what Outlook writes
+/// for Western European languages.
+extern std::string rtf_to_text(const std::vector<uint8_t> &rtf);
+
+#endif // RTF_H
@@ -0,0 +1,137 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+#include "rtf.h"
+
+using namespace std;
+
+namespace {
+    template <size_t N>
+    vector<uint8_t> bytes(const uint8_t (&data)[N]) {
+        return vector<uint8_t>(data, data + N);
+    }
+
+    vector<uint8_t> bytes(const char *str) {
+        return vector<uint8_t>(str, str + strlen(str));
+    }
+
+    string as_string(const vector<uint8_t> &v) {
+        return string(v.begin(), v.end());
+    }
+
+    // The examples from [MS-OXRTFCP] section 3.1.
+    const uint8_t simple_compressed[] = {
+        0x2d, 0x00, 0x00, 0x00, 0x2b, 0x00, 0x00, 0x00,
+        0x4c, 0x5a, 0x46, 0x75, 0xf1, 0xc5, 0xc7, 0xa7,
+        0x03, 0x00, 0x0a, 0x00, 0x72, 0x63, 0x70, 0x67,
+        0x31, 0x32, 0x35, 0x42, 0x32, 0x0a, 0xf3, 0x20,
+        0x68, 0x65, 0x6c, 0x09, 0x00, 0x20, 0x62, 0x77,
+        0x05, 0xb0, 0x6c, 0x64, 0x7d, 0x0a, 0x80, 0x0f,
+        0xa0
+    };
+
+    const uint8_t overlapping_compressed[] = {
+        0x1a, 0x00, 0x00, 0x00, 0x1c, 0x00, 0x00, 0x00,
+        0x4c, 0x5a, 0x46, 0x75, 0xe2, 0xd4, 0x4b, 0x51,
+        0x41, 0x00, 0x04, 0x20, 0x57, 0x58, 0x59, 0x5a,
+        0x0d, 0x6e, 0x7d, 0x01, 0x0e, 0xb0
+    };
+
+    const uint8_t uncompressed[] = {
+        0x0f, 0x00, 0x00, 0x00, 0x03, 0x00, 0x00, 0x00,
+        0x4d, 0x45, 0x4c, 0x41, 0x00, 0x00, 0x00, 0x00,
+        0x7b, 0x78, 0x7d
+    };
+
+    const char *encapsulated_html =
+        "{\\rtf1\\ansi\\ansicpg1252\\fromhtml1 {\\fonttbl{\\f0 Arial;}}"
+        "{\\*\\htmltag64 <p>}\\htmlrtf \\pard\\htmlrtf0 Hi \\'e9\\u8212?"
+        "{\\*\\htmltag72 </p>}\\htmlrtf \\par\\htmlrtf0 }";
+
+    bool decompress_throws(vector<uint8_t> data) {
+        try {
+            lzfu_decompress(data);
+            return false;
+        } catch (runtime_error &) {
+            return true;
+        }
+    }
+}
+
+void lzfu_decompress_should_decompress_rtf() {
+    assert("{\\rtf1\\ansi\\ansicpg1252\\pard hello world}\r\n" ==
+           as_string(lzfu_decompress(bytes(simple_compressed))));
+    assert("{\\rtf1 WXYZWXYZWXYZWXYZWXYZ}" ==
+           as_string(lzfu_decompress(bytes(overlapping_compressed))));
+}
+
+void lzfu_decompress_should_copy_uncompressed_rtf() {
+    assert("{x}" == as_string(lzfu_decompress(bytes(uncompressed))));
+}
+
+void lzfu_decompress_should_reject_corrupt_data() {
+    vector<uint8_t> bad_crc(bytes(simple_compressed));
+    bad_crc[20] ^= 0x01;
+    assert(decompress_throws(bad_crc));
+
+    vector<uint8_t> truncated(bytes(simple_compressed));
+    truncated.resize(30);
+    assert(decompress_throws(truncated));
+
+    vector<uint8_t> bad_type(bytes(uncompressed));
+    bad_type[8] = 'X';
+    assert(decompress_throws(bad_type));
+}
+
+void rtf_has_encapsulated_html_should_check_for_fromhtml() {
+    assert(rtf_has_encapsulated_html(bytes(encapsulated_html)));
+    assert(!rtf_has_encapsulated_html(bytes("{\\rtf1\\ansi hello}")));
+}
+
+void rtf_to_html_should_recover_encapsulated_html() {
+    assert("<p>Hi \xE9&#8212;</p>" ==
+           as_string(rtf_to_html(bytes(encapsulated_html))));
+}
+
+void rtf_to_text_should_extract_plain_text() {
+    const char *rtf =
+        "{\\rtf1\\ansi\\ansicpg1252{\\fonttbl{\\f0 Arial;}}"
+        "{\\*\\generator Riched20;}\\pard Caf\\'e9 \\u8212? done\\par\r\n"
+        "next\\tab\\{x\\}}";
+    assert("Caf\xC3\xA9 \xE2\x80\x94 done\r\nnext\t{x}" ==
+           rtf_to_text(bytes(rtf)));
+    assert("Hi \xC3\xA9\xE2\x80\x94\r\n" ==
+           rtf_to_text(bytes(encapsulated_html)));
+}
+
+int rtf_spec(int argc, char **argv) {
+    lzfu_decompress_should_decompress_rtf();
+    lzfu_decompress_should_copy_uncompressed_rtf();
+    lzfu_decompress_should_reject_corrupt_data();
+    rtf_has_encapsulated_html_should_check_for_fromhtml();
+    rtf_to_html_should_recover_encapsulated_html();
+    rtf_to_text_should_extract_plain_text();
+    return 0;
+}
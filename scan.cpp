@@ -0,0 +1,94 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cmath>
+#include <pstsdk/pst.h>
+
+#include "scan.h"
+#include "traversal.h"
+
+using namespace std;
+using namespace pstsdk;
+
+namespace {
+    // Our cost model for a full conversion: a fixed cost for each document
+    // we output, plus a cost for each byte we decode, hash and write.
+    // These are deliberately conservative figures for a local disk.
+    const double seconds_per_document = 0.002;
+    const double bytes_per_second = 20.0 * 1024 * 1024;
+
+    uint64_t size_prop(const property_bag &props, prop_id id) {
+        if (!props.prop_exists(id))
+            return 0;
+        slong size(props.read_prop<slong>(id));
+        return size > 0 ? uint64_t(size) : 0;
+    }
+
+    class scan_visitor : public pst_visitor {
+        pst_scan &m_scan;
+
+    public:
+        explicit scan_visitor(pst_scan &scan) : m_scan(scan) {}
+
+        virtual void begin_message(const message &m, bool embedded) {
+            if (embedded) {
+                ++m_scan.embedded_messages;
+            } else {
+                ++m_scan.messages;
+                m_scan.message_bytes +=
+                    size_prop(m.get_property_bag(), 0x0e08); // PidTagMessageSize
+            }
+        }
+
+        virtual void file_attachment(const attachment &a) {
+            ++m_scan.attachments;
+            m_scan.attachment_bytes +=
+                size_prop(a.get_property_bag(), 0x0e20); // PidTagAttachSize
+        }
+    };
+}
+
+pst_scan scan_pst(const pst &pst_file) {
+    pst_scan scan;
+    scan_visitor visitor(scan);
+    walk_pst(pst_file, visitor);
+    return scan;
+}
+
+double estimate_conversion_seconds(const pst_scan &scan) {
+    return (scan.documents() * seconds_per_document +
+            scan.message_bytes / bytes_per_second);
+}
+
+void output_scan_json(ostream &out, const pst_scan &scan) {
+    // Round our estimate up to the nearest second, since nobody wants
+    // to read about fractional seconds in an ETA.
+    uint64_t eta(uint64_t(ceil(estimate_conversion_seconds(scan))));
+    out << "{\n"
+        << "  \"messages\": " << scan.messages << ",\n"
+        << "  \"embedded_messages\": " << scan.embedded_messages << ",\n"
+        << "  \"attachments\": " << scan.attachments << ",\n"
+        << "  \"documents\": " << scan.documents() << ",\n"
+        << "  \"message_bytes\": " << scan.message_bytes << ",\n"
+        << "  \"attachment_bytes\": " << scan.attachment_bytes << ",\n"
+        << "  \"estimated_seconds\": " << eta << "\n"
+        << "}\n";
+}
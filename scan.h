@@ -0,0 +1,63 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <cstdint>
+#include <iostream>
+
+namespace pstsdk { class pst; }
+
+/// A summary of a PST's contents, gathered without reading any message
+/// bodies or attachment data.
+struct pst_scan {
+    uint64_t messages;
+    uint64_t embedded_messages;
+    uint64_t attachments;
+
+    /// The sum of PidTagMessageSize over top-level messages.  This includes
+    /// the size of their attachments.
+    uint64_t message_bytes;
+
+    /// The sum of PidTagAttachSize over non-message attachments.
+    uint64_t attachment_bytes;
+
+    pst_scan()
+        : messages(0), embedded_messages(0), attachments(0),
+          message_bytes(0), attachment_bytes(0) {}
+
+    /// The number of documents a full conversion would produce.
+    uint64_t documents() const
+        { return messages + embedded_messages + attachments; }
+};
+
+/// Count the messages and attachments in 'pst_file', using the same
+/// traversal as a full conversion.
+extern pst_scan scan_pst(const pstsdk::pst &pst_file);
+
+/// Estimate how long a full conversion of 'scan' would take, in seconds.
+extern double estimate_conversion_seconds(const pst_scan &scan);
+
+/// Write 'scan' and our time estimate to 'out' as a JSON object.
+extern void output_scan_json(std::ostream &out, const pst_scan &scan);
+
+#endif // SCAN_H
@@ -0,0 +1,80 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cassert>
+#include <sstream>
+
+#include "scan.h"
+
+using namespace std;
+
+namespace {
+    pst_scan sample_scan() {
+        pst_scan scan;
+        scan.messages = 10;
+        scan.embedded_messages = 2;
+        scan.attachments = 5;
+        scan.message_bytes = 1000000;
+        scan.attachment_bytes = 400000;
+        return scan;
+    }
+}
+
+void pst_scan_should_count_documents() {
+    assert(0 == pst_scan().documents());
+    assert(17 == sample_scan().documents());
+}
+
+void estimate_conversion_seconds_should_grow_with_documents_and_bytes() {
+    pst_scan scan(sample_scan());
+    double base(estimate_conversion_seconds(scan));
+    assert(base > 0);
+
+    scan.attachments += 1000;
+    assert(estimate_conversion_seconds(scan) > base);
+
+    scan = sample_scan();
+    scan.message_bytes *= 100;
+    assert(estimate_conversion_seconds(scan) > base);
+}
+
+void output_scan_json_should_write_summary() {
+    ostringstream out;
+    output_scan_json(out, sample_scan());
+    string json(out.str());
+    assert('{' == json[0]);
+    assert("}\n" == json.substr(json.size() - 2));
+    assert(string::npos != json.find("\"messages\": 10,"));
+    assert(string::npos != json.find("\"embedded_messages\": 2,"));
+    assert(string::npos != json.find("\"attachments\": 5,"));
+    assert(string::npos != json.find("\"documents\": 17,"));
+    assert(string::npos != json.find("\"message_bytes\": 1000000,"));
+    assert(string::npos != json.find("\"attachment_bytes\": 400000,"));
+    assert(string::npos != json.find("\"estimated_seconds\": 1\n"));
+}
+
+int scan_spec(int argc, char **argv) {
+    pst_scan_should_count_documents();
+    estimate_conversion_seconds_should_grow_with_documents_and_bytes();
+    output_scan_json_should_write_summary();
+
+    return 0;
+}
@@ -2,6 +2,8 @@ require File.join(File.dirname(__FILE__), 'spec_helper')
 
 require 'assert2/xpath'
 require 'mail'
+require 'zlib'
+require 'digest/sha2'
 
 describe "process-pst" do
   include Test::Unit::Assertions # for assert2/xpath
@@ -122,4 +124,251 @@ describe "process-pst" do
       xpath("//Document[@DocID='d0000004'][@MimeType='text/plain']") { true }
     end
   end
+
+  context "with --format=edrm,dat,csv" do
+    before do
+      @result = process_pst("test_data/four_nesting_levels.pst", "out",
+                            "--format=edrm,dat,csv")
+    end
+
+    it "should write all the requested loadfiles in one pass" do
+      @result.should == true
+      %w(edrm-loadfile.xml loadfile.dat loadfile.opt loadfile.csv).each do |f|
+        File.exist?(build_path("out/#{f}")).should == true
+      end
+    end
+
+    it "should write one CSV row per document, plus a header" do
+      csv = File.read(build_path("out/loadfile.csv"))
+      csv.split("\r\n").length.should == 5
+      csv.should match(/^"d0000002","d0000001","Message"/)
+    end
+
+    it "should list each native file in the OPT file" do
+      opt = File.read(build_path("out/loadfile.opt"))
+      opt.should match(/^d0000004,out,d0000004.txt,Y,,,1\r$/)
+    end
+  end
+
+  context "with --format=csv" do
+    before do
+      process_pst("test_data/four_nesting_levels.pst", "out", "--format=csv")
+    end
+
+    it "should not write an EDRM loadfile" do
+      File.exist?(loadfile).should == false
+      File.exist?(build_path("out/loadfile.csv")).should == true
+    end
+  end
+
+  context "with --gzip" do
+    before do
+      @result = process_pst("test_data/four_nesting_levels.pst", "out",
+                            "--gzip")
+    end
+
+    it "should write a gzipped EDRM loadfile" do
+      @result.should == true
+      File.exist?(loadfile).should == false
+      xml = Zlib::GzipReader.open(build_path("out/edrm-loadfile.xml.gz")) do |gz|
+        gz.read
+      end
+      _assert_xml(xml)
+      xpath("//Tag[@TagName='#Subject'][@TagValue='Outermost message']") do
+        true
+      end
+    end
+  end
+
+  context "with --hash=md5,sha256" do
+    before do
+      @result = process_pst("test_data/four_nesting_levels.pst", "out",
+                            "--hash=md5,sha256", "--format=edrm,csv")
+    end
+
+    it "should include each requested digest" do
+      @result.should == true
+      sha256 = Digest::SHA256.file(build_path("out/d0000004.txt")).hexdigest
+      xpath("//ExternalFile[@FileName='d0000004.txt']" +
+            "[@Hash='78016cea74c298162366b9f86bfc3b16']" +
+            "[@SHA256Hash='#{sha256}']") { true }
+      File.read(loadfile).should_not include("SHA1Hash")
+      File.read(build_path("out/loadfile.csv")).should include(sha256)
+    end
+  end
+
+  context "with --scan" do
+    it "should print a JSON summary without writing any files" do
+      pst = source_path("test_data/four_nesting_levels.pst")
+      output = `#{build_path("process-pst")} --scan #{pst}`
+      $?.should be_success
+      output.should match(/"messages": \d+,/)
+      output.should match(/"embedded_messages": \d+,/)
+      output.should match(/"estimated_seconds": \d+/)
+      File.exist?(build_path("out")).should == false
+    end
+  end
+
+  context "with --trace" do
+    before do
+      @trace = build_path("trace.json")
+      @result = process_pst("test_data/four_nesting_levels.pst", "out",
+                            "--trace=#{@trace}")
+    end
+
+    after do
+      rm_f(@trace)
+    end
+
+    it "should record a span for each stage of each document" do
+      @result.should == true
+      trace = File.read(@trace)
+      trace.should match(/\A\{"traceEvents":\[/)
+      trace.should include('"name":"render EML"')
+      trace.should include('"DocID":"d0000001"')
+    end
+  end
+
+  context "with --max-message-bytes" do
+    before do
+      @result = process_pst("test_data/four_nesting_levels.pst", "out",
+                            "--max-message-bytes=1")
+    end
+
+    it "should skip messages over budget and list them in the report" do
+      @result.should == true
+      report = File.read(build_path("out/report.json"))
+      report.should match(/"skipped_messages": \[\n    \{"NodeID": \d+/)
+      report.should include("Exceeded memory budget of 1 bytes")
+      Dir[build_path("out/d*")].should == []
+      File.read(loadfile).should_not include("<Document ")
+    end
+  end
+
+  context "with --headers=sidecar" do
+    before do
+      @result = process_pst("test_data/flags_jane_doe.pst", "out",
+                            "--headers=sidecar")
+    end
+
+    it "should refer to headers in headers.txt instead of inlining them" do
+      @result.should == true
+      headers = File.read(build_path("out/headers.txt"))
+      headers.should match(/\AReturn-Path:/)
+      xpath("//Tag[@TagName='#HeaderFile'][@TagValue='headers.txt']") { true }
+      xpath("//Tag[@TagName='#HeaderOffset'][@TagValue='0']") { true }
+      File.read(loadfile).should_not include("TagName='#Header'")
+    end
+  end
+
+  context "with --message-text" do
+    before do
+      @result = process_pst("pstsdk/test/sample1.pst", "out",
+                            "--message-text")
+    end
+
+    it "should write a text file for each message" do
+      @result.should == true
+      xpath("//Document[@DocID='d0000001']/Files") do
+        xpath("./File[@FileType='Native']/ExternalFile" +
+              "[@FileName='d0000001.eml']") { true }
+        xpath("./File[@FileType='Text']/ExternalFile" +
+              "[@FileName='d0000001.txt']") { true }
+      end
+      File.exist?(build_path("out/d0000001.txt")).should == true
+    end
+  end
+
+  context "with --index" do
+    before do
+      @result = process_pst("pstsdk/test/sample1.pst", "out", "--index")
+    end
+
+    it "should write a full-text index" do
+      @result.should == true
+      index = File.open(build_path("out/text-index.bin"), "rb") {|f| f.read }
+      index[0, 5].should == "PPTI\x01"
+      index.should include("d0000001")
+      Dir[build_path("out/text-index.*.tmp")].should == []
+    end
+  end
+
+  context "with --dedup-db" do
+    before do
+      @db = build_path("dedup.db")
+      @result = process_pst("pstsdk/test/sample1.pst", "out",
+                            "--dedup-db=#{@db}")
+    end
+
+    after do
+      rm_f(@db)
+    end
+
+    it "should create a dedup database" do
+      @result.should == true
+      db = File.open(@db, "rb") {|f| f.read }
+      db[0, 5].should == "PPDD\x01"
+    end
+  end
+
+  context "with --dedup-db and a message skipped on its attachment" do
+    before do
+      @db = build_path("dedup.db")
+      # Enough for the message itself, but not for its attachment.
+      process_pst("pstsdk/test/sample1.pst", "out", "--dedup-db=#{@db}",
+                  "--max-message-bytes=20000")
+      report = File.read(build_path("out/report.json"))
+      report.should include("Exceeded memory budget of 20000 bytes")
+      rm_rf(build_path("out"))
+      @result = process_pst("pstsdk/test/sample1.pst", "out",
+                            "--dedup-db=#{@db}")
+      _assert_xml(File.read(loadfile))
+    end
+
+    after do
+      rm_f(@db)
+    end
+
+    it "should not treat the skipped message as the first copy" do
+      @result.should == true
+      File.read(loadfile).should_not include("#DuplicateOf")
+      File.exist?(build_path("out/d0000001.eml")).should == true
+    end
+  end
+
+  context "with --threads" do
+    before do
+      @result = process_pst("pstsdk/test/sample1.pst", "out", "--threads")
+      _assert_xml(File.read(loadfile))
+    end
+
+    it "should tag each message with its thread" do
+      @result.should == true
+      xpath("//Document[@DocID='d0000001']/Tags") do
+        xpath("./Tag[@TagName='#ThreadID'][@TagDataType='Text']") { true }
+        xpath("./Tag[@TagName='#ThreadPosition']" +
+              "[@TagDataType='Integer']") { true }
+        xpath("./Tag[@TagName='#InclusiveEmail']" +
+              "[@TagValue='true'][@TagDataType='Boolean']") { true }
+      end
+    end
+  end
+
+  context "with --fields and --files" do
+    before do
+      @result = process_pst("pstsdk/test/sample1.pst", "out",
+                            "--fields=Subject", "--files=none")
+      _assert_xml(File.read(loadfile))
+    end
+
+    it "should only output the selected tags and files" do
+      @result.should == true
+      xpath("//Document[@DocID='d0000001']/Tags") do
+        xpath("./Tag[@TagName='#Subject']" +
+              "[@TagValue='Here is a sample message']") { true }
+      end
+      File.read(loadfile).should_not =~ /TagName=["']#From["']/
+      File.exist?(build_path("out/d0000001.eml")).should == false
+    end
+  end
 end
@@ -19,8 +19,9 @@ def source_path(path)
   "#{ENV['SOURCE_ROOT']}/#{path}"
 end
 
-def process_pst(pst, out_dir)
-  system(build_path("process-pst"), source_path(pst), build_path(out_dir))
+def process_pst(pst, out_dir, *options)
+  system(build_path("process-pst"), *(options + [source_path(pst),
+                                                 build_path(out_dir)]))
 end
 
 Spec::Runner.configure do |config|  
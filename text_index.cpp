@@ -0,0 +1,410 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+
+#include <boost/any.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "utilities.h"
+#include "document.h"
+#include "text_index.h"
+#include "trace.h"
+
+using namespace std;
+using boost::any;
+using boost::any_cast;
+using boost::lexical_cast;
+using namespace boost::filesystem;
+
+namespace {
+    const char index_magic[] = "PPTI";
+    const char index_version = 1;
+
+    void append_varint(string &out, uint64_t value) {
+        while (value >= 0x80) {
+            out += char(0x80 | (value & 0x7f));
+            value >>= 7;
+        }
+        out += char(value);
+    }
+
+    void write_varint(ostream &out, uint64_t value) {
+        char buffer[10];
+        size_t length(0);
+        while (value >= 0x80) {
+            buffer[length++] = char(0x80 | (value & 0x7f));
+            value >>= 7;
+        }
+        buffer[length++] = char(value);
+        out.write(buffer, length);
+    }
+
+    void write_string(ostream &out, const string &str) {
+        write_varint(out, str.size());
+        out.write(str.data(), str.size());
+    }
+
+    uint64_t read_varint(istream &in) {
+        uint64_t value(0);
+        for (int shift = 0; shift < 64; shift += 7) {
+            int c(in.get());
+            if (c == EOF)
+                throw runtime_error("Text index is truncated");
+            value |= uint64_t(c & 0x7f) << shift;
+            if (!(c & 0x80))
+                return value;
+        }
+        throw runtime_error("Text index is corrupt");
+    }
+
+    // Decode the varint at 'pos' in 'bytes', and return the position just
+    // after it.
+    size_t decode_varint(const string &bytes, size_t pos, uint64_t &value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && pos < bytes.size(); shift += 7) {
+            uint8_t c(bytes[pos++]);
+            value |= uint64_t(c & 0x7f) << shift;
+            if (!(c & 0x80))
+                return pos;
+        }
+        throw runtime_error("Text index postings are corrupt");
+    }
+
+    string read_bytes(istream &in, uint64_t length) {
+        if (length > (1 << 30))
+            throw runtime_error("Text index is corrupt");
+        string result(size_t(length), '\0');
+        in.read(&result[0], length);
+        if (!in)
+            throw runtime_error("Text index is truncated");
+        return result;
+    }
+
+    bool is_separator(uint32_t c) {
+        if (c < 0x80)
+            return !((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                     (c >= '0' && c <= '9'));
+        return ((c <= 0xBF) ||                   // Latin-1 punctuation
+                c == 0xD7 || c == 0xF7 ||        // Multiplication, division
+                (c >= 0x2000 && c <= 0x206F) ||  // General punctuation
+                (c >= 0x3000 && c <= 0x303F) ||  // CJK punctuation
+                c == 0xFEFF || c == 0xFFFD);
+    }
+
+    // Read the UTF-8 character at 'i', returning its length.  We wrote
+    // this text ourselves, so we don't bother validating it.
+    size_t read_utf8(const string &s, size_t i, uint32_t &c) {
+        uint8_t lead(s[i]);
+        size_t length;
+        if (lead < 0x80) {
+            c = lead;
+            return 1;
+        } else if ((lead & 0xE0) == 0xC0) {
+            c = lead & 0x1F; length = 2;
+        } else if ((lead & 0xF0) == 0xE0) {
+            c = lead & 0x0F; length = 3;
+        } else if ((lead & 0xF8) == 0xF0) {
+            c = lead & 0x07; length = 4;
+        } else {
+            c = 0xFFFD;
+            return 1;
+        }
+        if (i + length > s.size()) {
+            c = 0xFFFD;
+            return 1;
+        }
+        for (size_t j = 1; j < length; ++j)
+            c = (c << 6) | (uint8_t(s[i + j]) & 0x3F);
+        return length;
+    }
+
+    void add_split_term(string &term, vector<string> &terms) {
+        if (!term.empty() && term.size() <= max_term_length)
+            terms.push_back(term);
+        term.clear();
+    }
+}
+
+void split_terms(const string &utf8, vector<string> &terms) {
+    string term;
+    for (size_t i = 0; i < utf8.size(); ) {
+        uint32_t c;
+        size_t length(read_utf8(utf8, i, c));
+        if (is_separator(c))
+            add_split_term(term, terms);
+        else if (c >= 'A' && c <= 'Z')
+            term += char(c - 'A' + 'a');
+        else if (c < 0x80)
+            term += char(c);
+        else if (c >= 0xC0 && c <= 0xDE) // Latin-1 capitals
+            code_point_to_utf8_append(term, c + 0x20);
+        else
+            term.append(utf8, i, length);
+        i += length;
+    }
+    add_split_term(term, terms);
+}
+
+const char *text_index_sink::filename = "text-index.bin";
+
+void text_index_sink::add_term(const string &term, uint32_t doc) {
+    posting_list &postings(m_postings[term]);
+    if (postings.count > 0 && postings.last_doc == doc)
+        return;
+
+    // Each segment starts with an absolute document number.
+    size_t before(postings.gaps.size());
+    if (postings.count == 0) {
+        m_bytes += term.size() + sizeof(posting_list) + 32;
+        append_varint(postings.gaps, doc);
+    } else {
+        append_varint(postings.gaps, doc - postings.last_doc);
+    }
+    postings.last_doc = doc;
+    ++postings.count;
+    m_bytes += postings.gaps.size() - before;
+}
+
+void text_index_sink::output_document(const document &d,
+                                      const vector<loadfile_file> &files) {
+    trace_span span("index text");
+    m_terms.clear();
+    const any *subject(d.find_tag("#Subject"));
+    if (subject != NULL && !subject->empty())
+        split_terms(to_std_string(any_cast<const tag_string &>(*subject)),
+                    m_terms);
+    if (d.has_text())
+        split_terms(d.text(), m_terms);
+    if (m_terms.empty())
+        return;
+
+    uint32_t doc(m_doc_ids.size());
+    m_doc_ids.push_back(d.id());
+    for (vector<string>::const_iterator i = m_terms.begin();
+         i != m_terms.end(); ++i)
+        add_term(*i, doc);
+
+    if (m_bytes >= m_segment_bytes)
+        write_segment();
+}
+
+namespace {
+    struct term_less {
+        template <typename T>
+        bool operator()(const T *a, const T *b) const
+            { return a->first < b->first; }
+    };
+
+    // Reads the entries of a segment file back in order.
+    class segment_reader {
+        ifstream m_in;
+
+    public:
+        string term;
+        uint64_t count;
+        uint64_t last_doc;
+        string gaps;
+        bool done;
+
+        explicit segment_reader(const path &p)
+            : m_in(p.file_string().c_str(), ios_base::in | ios_base::binary),
+              done(false) {
+            if (!m_in)
+                throw runtime_error("Could not read text index segment");
+            next();
+        }
+
+        void next() {
+            if (m_in.peek() == EOF) {
+                done = true;
+                return;
+            }
+            term = read_bytes(m_in, read_varint(m_in));
+            count = read_varint(m_in);
+            last_doc = read_varint(m_in);
+            gaps = read_bytes(m_in, read_varint(m_in));
+        }
+    };
+}
+
+/// Write our postings to a new segment file, sorted by term, and forget
+/// them.  Each entry is the term, the document count, the last document
+/// and the postings, all varint-prefixed.
+void text_index_sink::write_segment() {
+    if (m_postings.empty())
+        return;
+    trace_span span("write index segment");
+
+    vector<const posting_map::value_type *> sorted;
+    sorted.reserve(m_postings.size());
+    for (posting_map::const_iterator i = m_postings.begin();
+         i != m_postings.end(); ++i)
+        sorted.push_back(&*i);
+    sort(sorted.begin(), sorted.end(), term_less());
+
+    path p(m_out_dir / ("text-index." + lexical_cast<string>(m_segments.size())
+                        + ".tmp"));
+    ofstream out(p.file_string().c_str(),
+                 ios_base::out | ios_base::trunc | ios_base::binary);
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        const posting_list &postings(sorted[i]->second);
+        write_string(out, sorted[i]->first);
+        write_varint(out, postings.count);
+        write_varint(out, postings.last_doc);
+        write_string(out, postings.gaps);
+    }
+    if (!out)
+        throw runtime_error("Could not write text index segment");
+
+    m_segments.push_back(p);
+    m_postings.clear();
+    m_bytes = 0;
+}
+
+/// Merge our segments into our final index, and remove them.  Segments
+/// hold consecutive ranges of documents, so we can join their postings
+/// for each term by rebasing the first document number of each segment.
+void text_index_sink::merge_segments() {
+    trace_span span("merge index segments");
+    vector<shared_ptr<segment_reader> > readers;
+    for (size_t i = 0; i < m_segments.size(); ++i)
+        readers.push_back(shared_ptr<segment_reader>(
+            new segment_reader(m_segments[i])));
+
+    path p(m_out_dir / filename);
+    ofstream out(p.file_string().c_str(),
+                 ios_base::out | ios_base::trunc | ios_base::binary);
+    out.write(index_magic, 4);
+    out.put(index_version);
+    write_varint(out, m_doc_ids.size());
+    for (size_t i = 0; i < m_doc_ids.size(); ++i)
+        write_string(out, m_doc_ids[i]);
+
+    string previous;
+    for (;;) {
+        const string *smallest(NULL);
+        for (size_t i = 0; i < readers.size(); ++i)
+            if (!readers[i]->done &&
+                (smallest == NULL || readers[i]->term < *smallest))
+                smallest = &readers[i]->term;
+        if (smallest == NULL)
+            break;
+
+        string term(*smallest);
+        uint64_t count(0), last_doc(0);
+        string gaps;
+        for (size_t i = 0; i < readers.size(); ++i) {
+            segment_reader &r(*readers[i]);
+            if (r.done || r.term != term)
+                continue;
+            if (count == 0) {
+                gaps = r.gaps;
+            } else {
+                uint64_t first;
+                size_t pos(decode_varint(r.gaps, 0, first));
+                append_varint(gaps, first - last_doc);
+                gaps.append(r.gaps, pos, string::npos);
+            }
+            count += r.count;
+            last_doc = r.last_doc;
+            r.next();
+        }
+
+        // Front-code our terms, which share long prefixes once sorted.
+        size_t shared(0);
+        while (shared < previous.size() && shared < term.size() &&
+               previous[shared] == term[shared])
+            ++shared;
+        write_varint(out, shared);
+        write_string(out, term.substr(shared));
+        write_varint(out, count);
+        write_string(out, gaps);
+        previous.swap(term);
+    }
+    write_varint(out, 0);
+    write_varint(out, 0);
+    out.close();
+    if (!out)
+        throw runtime_error("Could not write text index");
+
+    readers.clear();
+    for (size_t i = 0; i < m_segments.size(); ++i)
+        remove(m_segments[i]);
+    m_segments.clear();
+}
+
+void text_index_sink::end() {
+    write_segment();
+    merge_segments();
+}
+
+vector<string> text_index_lookup(istream &in, const string &term) {
+    char header[5];
+    in.read(header, sizeof(header));
+    if (!in || memcmp(header, index_magic, 4) != 0 ||
+        header[4] != index_version)
+        throw runtime_error("Not a text index");
+
+    uint64_t doc_count(read_varint(in));
+    vector<string> doc_ids;
+    for (uint64_t i = 0; i < doc_count; ++i)
+        doc_ids.push_back(read_bytes(in, read_varint(in)));
+
+    vector<string> result;
+    string current;
+    for (;;) {
+        uint64_t shared(read_varint(in)), suffix(read_varint(in));
+        if (shared == 0 && suffix == 0)
+            break;
+        if (shared > current.size())
+            throw runtime_error("Text index is corrupt");
+        current.resize(shared);
+        current += read_bytes(in, suffix);
+        uint64_t count(read_varint(in)), length(read_varint(in));
+
+        // Terms are sorted, so we can stop as soon as we've passed ours.
+        if (current < term) {
+            in.ignore(length);
+            continue;
+        } else if (current > term) {
+            break;
+        }
+
+        string gaps(read_bytes(in, length));
+        size_t pos(0);
+        uint64_t doc(0);
+        for (uint64_t i = 0; i < count; ++i) {
+            uint64_t gap;
+            pos = decode_varint(gaps, pos, gap);
+            doc = (i == 0) ? gap : doc + gap;
+            if (doc >= doc_ids.size())
+                throw runtime_error("Text index postings are corrupt");
+            result.push_back(doc_ids[doc]);
+        }
+        break;
+    }
+    return result;
+}
@@ -0,0 +1,102 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef TEXT_INDEX_H
+#define TEXT_INDEX_H
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <unordered_map>
+#include <cstdint>
+#include <boost/filesystem.hpp>
+
+#include "loadfile.h"
+
+/// The longest term we index, in bytes.  Anything longer is almost
+/// certainly an encoded blob rather than a word.
+const size_t max_term_length = 64;
+
+/// Split 'utf8' into index terms, appending them to 'terms'.  Terms are
+/// runs of letters and digits.  ASCII and Latin-1 letters are lowercased,
+/// and other non-ASCII characters are treated as letters unless they're
+/// punctuation or spaces.
+extern void split_terms(const std::string &utf8,
+                        std::vector<std::string> &terms);
+
+/// A loadfile_sink which builds an inverted index of each document's
+/// subject and text as it goes by, and writes it to text-index.bin in our
+/// output directory.
+///
+/// Postings are kept in memory as varint-encoded gaps between document
+/// numbers.  When they grow beyond 'segment_bytes', we write them to a
+/// sorted segment file, and when we're done, we merge all the segments
+/// into the final index.  The index looks like:
+///
+///   "PPTI" 0x01
+///   varint document count, and for each document, in order:
+///     varint DocID length, DocID
+///   for each term, in byte order:
+///     varint length shared with the previous term, varint suffix
+///     length, suffix, varint document count, varint postings length,
+///     postings (varint document number, then varint gaps)
+///   varint 0, varint 0
+class text_index_sink : public loadfile_sink {
+    struct posting_list {
+        uint32_t count;
+        uint32_t last_doc;
+        std::string gaps;
+
+        posting_list() : count(0), last_doc(0) {}
+    };
+    typedef std::unordered_map<std::string, posting_list> posting_map;
+
+    boost::filesystem::path m_out_dir;
+    size_t m_segment_bytes;
+    std::vector<std::string> m_doc_ids;
+    posting_map m_postings;
+    size_t m_bytes;
+    std::vector<boost::filesystem::path> m_segments;
+    std::vector<std::string> m_terms;
+
+    void add_term(const std::string &term, uint32_t doc);
+    void write_segment();
+    void merge_segments();
+
+public:
+    /// The name of the index we write.
+    static const char *filename;
+
+    explicit text_index_sink(const boost::filesystem::path &out_dir,
+                             size_t segment_bytes = 64 * 1024 * 1024)
+        : m_out_dir(out_dir), m_segment_bytes(segment_bytes), m_bytes(0) {}
+
+    virtual void output_document(const document &d,
+                                 const std::vector<loadfile_file> &files);
+    virtual void end();
+};
+
+/// Find the DocIDs of all the documents containing 'term' in the index
+/// 'in'.  'term' should already be split and lowercased by split_terms.
+extern std::vector<std::string> text_index_lookup(std::istream &in,
+                                                  const std::string &term);
+
+#endif // TEXT_INDEX_H
@@ -0,0 +1,130 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cassert>
+#include <fstream>
+
+#include "document.h"
+#include "text_index.h"
+
+using namespace std;
+using namespace boost::filesystem;
+
+namespace {
+    vector<string> terms_of(const string &utf8) {
+        vector<string> terms;
+        split_terms(utf8, terms);
+        return terms;
+    }
+
+    void index_document(text_index_sink &sink, const string &id,
+                        const string &subject, const string &text) {
+        document d;
+        d.set_id(id).set_type(document::message);
+        if (!subject.empty())
+            d.set_string("#Subject", subject);
+        if (!text.empty())
+            d.set_text(text);
+        sink.output_document(d, vector<loadfile_file>());
+    }
+
+    vector<string> lookup(const path &index, const string &term) {
+        ifstream in(index.file_string().c_str(),
+                    ios_base::in | ios_base::binary);
+        return text_index_lookup(in, term);
+    }
+
+    // Build a small index in 'out_dir', spilling a segment whenever our
+    // postings exceed 'segment_bytes'.
+    void build_index(const path &out_dir, size_t segment_bytes) {
+        remove_all(out_dir);
+        create_directory(out_dir);
+        text_index_sink sink(out_dir, segment_bytes);
+        sink.begin();
+        index_document(sink, "d0000001", "Fridge", "The fridge is empty.");
+        index_document(sink, "d0000002", "", "");
+        index_document(sink, "d0000003", "", "Buy milk for the FRIDGE");
+        index_document(sink, "d0000004", "Re: milk", "Caf\xC3\xA9\xE2\x80\x94"
+                       "CAF\xC3\x89 fridges");
+        sink.end();
+    }
+
+    void check_index(const path &index) {
+        vector<string> fridge(lookup(index, "fridge"));
+        assert(2 == fridge.size());
+        assert("d0000001" == fridge[0]);
+        assert("d0000003" == fridge[1]);
+
+        vector<string> milk(lookup(index, "milk"));
+        assert(2 == milk.size());
+        assert("d0000003" == milk[0]);
+        assert("d0000004" == milk[1]);
+
+        assert(1 == lookup(index, "caf\xC3\xA9").size());
+        assert(1 == lookup(index, "fridges").size());
+        assert(2 == lookup(index, "the").size());
+        assert(lookup(index, "nosuchterm").empty());
+        assert(lookup(index, "aaa").empty());
+        assert(lookup(index, "zzz").empty());
+    }
+}
+
+void split_terms_should_split_and_lowercase_words() {
+    vector<string> terms(terms_of("The quick-brown FOX, 42 times!"));
+    assert(6 == terms.size());
+    assert("the" == terms[0]);
+    assert("quick" == terms[1]);
+    assert("brown" == terms[2]);
+    assert("fox" == terms[3]);
+    assert("42" == terms[4]);
+    assert("times" == terms[5]);
+
+    terms = terms_of("\xC3\x89t\xC3\xA9\xE2\x80\x94\xC2\xABNa\xC3\xAFve\xC2\xBB");
+    assert(2 == terms.size());
+    assert("\xC3\xA9t\xC3\xA9" == terms[0]);
+    assert("na\xC3\xAFve" == terms[1]);
+
+    assert(terms_of(string(max_term_length + 1, 'x')).empty());
+    assert(1 == terms_of(string(max_term_length, 'x')).size());
+}
+
+void text_index_sink_should_write_searchable_index() {
+    path out_dir("text_index_spec_out");
+    build_index(out_dir, 64 * 1024 * 1024);
+    check_index(out_dir / text_index_sink::filename);
+    remove_all(out_dir);
+}
+
+void text_index_sink_should_merge_segments() {
+    // With a tiny segment size, every document gets its own segment.
+    path out_dir("text_index_spec_out");
+    build_index(out_dir, 1);
+    check_index(out_dir / text_index_sink::filename);
+    assert(!exists(out_dir / "text-index.0.tmp"));
+    remove_all(out_dir);
+}
+
+int text_index_spec(int argc, char **argv) {
+    split_terms_should_split_and_lowercase_words();
+    text_index_sink_should_write_searchable_index();
+    text_index_sink_should_merge_segments();
+    return 0;
+}
@@ -0,0 +1,285 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+#include <pstsdk/pst.h>
+
+#include "document.h"
+#include "header_fields.h"
+#include "thread_index.h"
+#include "trace.h"
+#include "utilities.h"
+
+using namespace std;
+using namespace pstsdk;
+
+namespace {
+    // We hash conversation index headers, whole conversation indices and
+    // Message-IDs separately, so that one kind of key can never match
+    // another.
+    enum key_kind {
+        header_kind = 1,
+        conversation_kind,
+        message_id_kind,
+        node_kind
+    };
+
+    // 64-bit FNV-1a with a splitmix64 finalizer.  We reserve 0 to mean
+    // "no key".
+    uint64_t hash_key(key_kind kind, const uint8_t *data, size_t size) {
+        uint64_t h(0xcbf29ce484222325ULL ^ kind);
+        for (size_t i = 0; i < size; ++i) {
+            h ^= data[i];
+            h *= 0x100000001b3ULL;
+        }
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+        return h == 0 ? 1 : h;
+    }
+
+    // Message-IDs and In-Reply-To fields may have surrounding whitespace,
+    // and In-Reply-To may be followed by comments or further IDs, so we
+    // only keep the first <...> if there is one.
+    uint64_t message_id_key(const string &id) {
+        string::size_type begin(id.find('<'));
+        string::size_type end(string::npos);
+        if (begin != string::npos)
+            end = id.find('>', begin);
+        if (end != string::npos) {
+            ++end;
+        } else {
+            begin = id.find_first_not_of(" \t\r\n");
+            if (begin == string::npos)
+                return 0;
+            end = id.find_last_not_of(" \t\r\n") + 1;
+        }
+        return hash_key(message_id_kind,
+                        reinterpret_cast<const uint8_t *>(id.data()) + begin,
+                        end - begin);
+    }
+
+    // Fill in whichever of 'message_id' and 'in_reply_to' are empty from
+    // the header block 'headers'.
+    void find_threading_fields(const string &headers, string &message_id,
+                               string &in_reply_to) {
+        header_tokenizer tokenizer(headers);
+        header_field field;
+        while (tokenizer.next(field)) {
+            if (message_id.empty() && field.is("Message-ID"))
+                message_id = field.unfolded();
+            else if (in_reply_to.empty() && field.is("In-Reply-To"))
+                in_reply_to = field.unfolded();
+        }
+    }
+
+    // Read a string property as UTF-8, straight from its raw bytes.
+    string read_utf8_prop(const property_bag &props, prop_id id) {
+        vector<byte> bytes(props.read_prop<vector<byte> >(id));
+        bool unicode(props.get_prop_type(id) == prop_type_unicode);
+        string utf8;
+        pst_string_to_utf8_append(utf8, bytes.data(), bytes.size(), unicode);
+        return utf8;
+    }
+
+    typedef pair<uint64_t, uint32_t> key_entry;
+    const uint32_t no_parent = 0xffffffff;
+}
+
+void thread_index::add(uint32_t node_id,
+                       const vector<uint8_t> &conversation_index,
+                       const string &message_id, const string &in_reply_to,
+                       bool has_attachments) {
+    entry e;
+    e.node_id = node_id;
+    e.has_attachments = has_attachments;
+    e.position = 0;
+    e.header_key = 0;
+    e.parent_keys[0] = e.parent_keys[1] = 0;
+    e.own_keys[0] = e.own_keys[1] = 0;
+
+    // Each reply appends a child block to its parent's conversation
+    // index, so the number of blocks is our depth, and removing the last
+    // block gives us our parent's conversation index.
+    size_t size(conversation_index.size());
+    if (size >= conversation_index_header_length) {
+        const uint8_t *data(&conversation_index[0]);
+        e.position = ((size - conversation_index_header_length) /
+                      conversation_index_child_length);
+        e.header_key = hash_key(header_kind, data,
+                                conversation_index_header_length);
+        e.own_keys[0] = hash_key(conversation_kind, data, size);
+        if (e.position > 0)
+            e.parent_keys[0] =
+                hash_key(conversation_kind, data,
+                         conversation_index_header_length +
+                         (e.position - 1) * conversation_index_child_length);
+    }
+
+    e.own_keys[1] = message_id_key(message_id);
+    e.parent_keys[1] = message_id_key(in_reply_to);
+    m_entries.push_back(e);
+}
+
+void thread_index::finish() {
+    trace_span span("link threads", "Messages", m_entries.size());
+    uint32_t count(m_entries.size());
+
+    vector<key_entry> keys;
+    for (uint32_t i = 0; i < count; ++i)
+        for (int k = 0; k < 2; ++k)
+            if (m_entries[i].own_keys[k] != 0)
+                keys.push_back(key_entry(m_entries[i].own_keys[k], i));
+    sort(keys.begin(), keys.end());
+
+    // Find each message's parent, preferring its conversation index to
+    // In-Reply-To.  The same message may be filed in several folders, so
+    // every copy of a parent has replies.
+    vector<uint32_t> parents(count, no_parent);
+    vector<bool> has_replies(count, false);
+    for (uint32_t i = 0; i < count; ++i) {
+        for (int k = 0; k < 2 && parents[i] == no_parent; ++k) {
+            uint64_t key(m_entries[i].parent_keys[k]);
+            if (key == 0)
+                continue;
+            vector<key_entry>::iterator found(
+                lower_bound(keys.begin(), keys.end(), key_entry(key, 0)));
+            for (; found != keys.end() && found->first == key; ++found) {
+                if (found->second == i)
+                    continue;
+                if (parents[i] == no_parent)
+                    parents[i] = found->second;
+                has_replies[found->second] = true;
+            }
+        }
+    }
+    vector<key_entry>().swap(keys);
+
+    // Walk up from each message to the first one whose thread we already
+    // know, then assign threads on the way back down.  Each message is
+    // only walked once, so this is linear.  Corrupt PSTs may contain
+    // cycles, which we break where we find them.
+    enum { unvisited, visiting, visited };
+    vector<uint8_t> states(count, unvisited);
+    vector<uint64_t> threads(count, 0);
+    vector<uint32_t> path;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t j(i);
+        while (j != no_parent && states[j] == unvisited) {
+            states[j] = visiting;
+            path.push_back(j);
+            j = parents[j];
+        }
+        if (j != no_parent && states[j] == visiting)
+            parents[path.back()] = no_parent;
+
+        for (; !path.empty(); path.pop_back()) {
+            uint32_t k(path.back());
+            entry &e(m_entries[k]);
+            uint32_t parent(parents[k]);
+            if (parent != no_parent) {
+                threads[k] = threads[parent];
+                if (e.header_key == 0)
+                    e.position = m_entries[parent].position + 1;
+            } else if (e.header_key != 0) {
+                threads[k] = e.header_key;
+            } else if (e.parent_keys[1] != 0) {
+                // We're a reply to a message we don't have, so we share a
+                // thread with any other replies to it.
+                threads[k] = e.parent_keys[1];
+                e.position = 1;
+            } else if (e.own_keys[1] != 0) {
+                threads[k] = e.own_keys[1];
+            } else {
+                threads[k] = hash_key(node_kind,
+                                      reinterpret_cast<uint8_t *>(&e.node_id),
+                                      sizeof(e.node_id));
+            }
+            states[k] = visited;
+        }
+    }
+
+    // A message is inclusive if no reply quotes it in full.  Replies
+    // normally drop attachments, so messages with attachments are always
+    // inclusive.
+    m_results.resize(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        result &r(m_results[i]);
+        r.node_id = m_entries[i].node_id;
+        r.position = m_entries[i].position;
+        r.thread_id = threads[i];
+        r.inclusive = !has_replies[i] || m_entries[i].has_attachments;
+    }
+    sort(m_results.begin(), m_results.end());
+    vector<entry>().swap(m_entries);
+}
+
+void thread_index::tag(uint32_t node_id, document &d) const {
+    result key;
+    key.node_id = node_id;
+    vector<result>::const_iterator found(
+        lower_bound(m_results.begin(), m_results.end(), key));
+    if (found == m_results.end() || found->node_id != node_id)
+        return;
+
+    ostringstream id;
+    id << hex << setw(16) << setfill('0') << found->thread_id;
+    d.set_string("#ThreadID", id.str());
+    d["#ThreadPosition"] = int32_t(found->position);
+    d["#InclusiveEmail"] = found->inclusive;
+}
+
+void build_thread_index(const pst &pst_file, thread_index &index) {
+    trace_span span("build thread index");
+    pst::message_iterator mi(pst_file.message_begin());
+    for (; mi != pst_file.message_end(); ++mi) {
+        message m(*mi);
+        property_bag props(m.get_property_bag());
+
+        vector<uint8_t> conversation_index;
+        if (props.prop_exists(0x0071)) // PidTagConversationIndex
+            conversation_index = props.read_prop<vector<byte> >(0x0071);
+
+        string message_id, in_reply_to;
+        if (props.prop_exists(0x1035)) // PidTagInternetMessageId
+            message_id = read_utf8_prop(props, 0x1035);
+        if (props.prop_exists(0x1042)) // PidTagInReplyToId
+            in_reply_to = read_utf8_prop(props, 0x1042);
+
+        // Messages received over SMTP may only have their IDs in their
+        // transport headers.  Reading those is expensive, so we only do
+        // it when we'd otherwise have nothing to thread by.  Most
+        // messages aren't replies, so a missing In-Reply-To alone
+        // doesn't count.
+        if (conversation_index.empty() && message_id.empty() &&
+            props.prop_exists(0x007d)) { // PidTagTransportMessageHeaders
+            string headers(read_utf8_prop(props, 0x007d));
+            find_threading_fields(headers, message_id, in_reply_to);
+        }
+
+        index.add(m.get_id(), conversation_index, message_id, in_reply_to,
+                  m.get_attachment_count() > 0);
+    }
+    index.finish();
+}
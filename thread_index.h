@@ -0,0 +1,94 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#ifndef THREAD_INDEX_H
+#define THREAD_INDEX_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <boost/utility.hpp>
+
+namespace pstsdk { class pst; }
+class document;
+
+/// The length of the header at the start of every PidTagConversationIndex,
+/// which is shared by every message in a conversation.
+const size_t conversation_index_header_length = 22;
+
+/// The length of each child block which a reply appends to its parent's
+/// PidTagConversationIndex.
+const size_t conversation_index_child_length = 5;
+
+/// Groups top-level messages into conversation threads.  We collect a few
+/// small keys for each message in a single pass over the PST, then link
+/// every message to its parent with one sort, so that we never compare
+/// messages pairwise.  Messages are threaded by PidTagConversationIndex
+/// where they have one, and by Message-ID and In-Reply-To otherwise.
+class thread_index : boost::noncopyable {
+    struct entry {
+        uint32_t node_id;
+        bool has_attachments;
+        uint32_t position;
+        uint64_t header_key;
+        uint64_t parent_keys[2];
+        uint64_t own_keys[2];
+    };
+
+    struct result {
+        uint32_t node_id;
+        uint32_t position;
+        uint64_t thread_id;
+        bool inclusive;
+
+        bool operator<(const result &other) const
+            { return node_id < other.node_id; }
+    };
+
+    std::vector<entry> m_entries;
+    std::vector<result> m_results;
+
+public:
+    /// Add the message with 'node_id'.  Any of 'conversation_index',
+    /// 'message_id' and 'in_reply_to' may be empty.
+    void add(uint32_t node_id, const std::vector<uint8_t> &conversation_index,
+             const std::string &message_id, const std::string &in_reply_to,
+             bool has_attachments);
+
+    /// Link each message to its parent and assign it to a thread.  Call
+    /// this once, after adding every message.
+    void finish();
+
+    /// The number of messages we've threaded.
+    size_t size() const { return m_results.size(); }
+
+    /// If we've threaded the message with 'node_id', tag 'd' with
+    /// #ThreadID, #ThreadPosition and #InclusiveEmail.
+    void tag(uint32_t node_id, document &d) const;
+};
+
+/// Add every top-level message in 'pst_file' to 'index' and finish it.
+/// We only read the properties we need for threading.
+extern void build_thread_index(const pstsdk::pst &pst_file,
+                               thread_index &index);
+
+#endif // THREAD_INDEX_H
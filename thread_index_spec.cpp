@@ -0,0 +1,157 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+#include <cassert>
+
+#include <boost/any.hpp>
+
+#include "document.h"
+#include "thread_index.h"
+
+using namespace std;
+using boost::any_cast;
+
+namespace {
+    // A conversation index with 'replies' child blocks, in the
+    // conversation identified by 'conversation'.
+    vector<uint8_t> conversation_index(uint8_t conversation, size_t replies,
+                                       uint8_t branch = 0) {
+        vector<uint8_t> index(conversation_index_header_length,
+                              conversation);
+        for (size_t i = 0; i < replies; ++i) {
+            for (size_t j = 0; j < conversation_index_child_length; ++j)
+                index.push_back(uint8_t(i + 1));
+            if (i + 1 == replies && branch != 0)
+                index.back() = 0x80 | branch;
+        }
+        return index;
+    }
+
+    document tagged(const thread_index &index, uint32_t node_id) {
+        document d;
+        d.set_id("d0000001").set_type(document::message);
+        index.tag(node_id, d);
+        return d;
+    }
+
+    string thread_of(const thread_index &index, uint32_t node_id) {
+        return to_std_string(
+            any_cast<tag_string>(tagged(index, node_id)["#ThreadID"]));
+    }
+
+    int32_t position_of(const thread_index &index, uint32_t node_id) {
+        return any_cast<int32_t>(tagged(index, node_id)["#ThreadPosition"]);
+    }
+
+    bool inclusive(const thread_index &index, uint32_t node_id) {
+        return any_cast<bool>(tagged(index, node_id)["#InclusiveEmail"]);
+    }
+}
+
+void thread_index_should_thread_by_conversation_index() {
+    thread_index index;
+    // Replies may be filed before the messages they reply to.
+    index.add(0x24, conversation_index(7, 2), "", "", false);
+    index.add(0x44, conversation_index(7, 1), "", "", false);
+    index.add(0x64, conversation_index(7, 0), "", "", false);
+    index.add(0x84, conversation_index(7, 1, 1), "", "", false);
+    index.add(0xa4, conversation_index(8, 0), "", "", false);
+    index.finish();
+    assert(5 == index.size());
+
+    string thread(thread_of(index, 0x64));
+    assert(16 == thread.size());
+    assert(thread == thread_of(index, 0x24));
+    assert(thread == thread_of(index, 0x44));
+    assert(thread == thread_of(index, 0x84));
+    assert(thread != thread_of(index, 0xa4));
+
+    assert(0 == position_of(index, 0x64));
+    assert(1 == position_of(index, 0x44));
+    assert(2 == position_of(index, 0x24));
+
+    // Only the ends of each branch are inclusive.
+    assert(!inclusive(index, 0x64));
+    assert(!inclusive(index, 0x44));
+    assert(inclusive(index, 0x24));
+    assert(inclusive(index, 0x84));
+    assert(inclusive(index, 0xa4));
+}
+
+void thread_index_should_fall_back_to_in_reply_to() {
+    thread_index index;
+    vector<uint8_t> none;
+    index.add(0x24, none, "<c@example.com>", " <b@example.com> ", false);
+    index.add(0x44, none, "<b@example.com>", "<a@example.com>", true);
+    index.add(0x64, none, "<a@example.com>", "", false);
+    index.add(0x84, none, "<e@example.com>", "<d@example.com>", false);
+    index.add(0xa4, none, "<f@example.com>", "<d@example.com> (reply)",
+              false);
+    index.add(0xc4, none, "", "", false);
+    index.finish();
+
+    string thread(thread_of(index, 0x64));
+    assert(thread == thread_of(index, 0x44));
+    assert(thread == thread_of(index, 0x24));
+    assert(0 == position_of(index, 0x64));
+    assert(1 == position_of(index, 0x44));
+    assert(2 == position_of(index, 0x24));
+
+    // Messages with attachments are always inclusive.
+    assert(!inclusive(index, 0x64));
+    assert(inclusive(index, 0x44));
+    assert(inclusive(index, 0x24));
+
+    // Replies to a message we don't have still share a thread.
+    assert(thread_of(index, 0x84) == thread_of(index, 0xa4));
+    assert(thread != thread_of(index, 0x84));
+    assert(1 == position_of(index, 0x84));
+
+    assert(thread != thread_of(index, 0xc4));
+    assert(0 == position_of(index, 0xc4));
+    assert(inclusive(index, 0xc4));
+}
+
+void thread_index_should_survive_reply_cycles() {
+    thread_index index;
+    vector<uint8_t> none;
+    index.add(0x24, none, "<a@example.com>", "<b@example.com>", false);
+    index.add(0x44, none, "<b@example.com>", "<a@example.com>", false);
+    index.finish();
+    assert(thread_of(index, 0x24) == thread_of(index, 0x44));
+}
+
+void thread_index_should_ignore_unknown_messages() {
+    thread_index index;
+    index.finish();
+    document d(tagged(index, 0x24));
+    assert(d["#ThreadID"].empty());
+    assert(d["#InclusiveEmail"].empty());
+}
+
+int thread_index_spec(int argc, char **argv) {
+    thread_index_should_thread_by_conversation_index();
+    thread_index_should_fall_back_to_in_reply_to();
+    thread_index_should_survive_reply_cycles();
+    thread_index_should_ignore_unknown_messages();
+    return 0;
+}
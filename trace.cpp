@@ -0,0 +1,121 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <stdexcept>
+
+#include "trace.h"
+
+using namespace std;
+using namespace boost::posix_time;
+
+tracer *tracer::s_current = NULL;
+
+tracer::tracer(ostream &out)
+    : m_out(out), m_start(microsec_clock::universal_time()),
+      m_first_event(true), m_closed(false), m_next_thread_id(1)
+{
+    if (s_current)
+        throw runtime_error("Only one tracer may be active at a time");
+    m_out << "{\"traceEvents\":[\n";
+    s_current = this;
+}
+
+tracer::~tracer() {
+    close();
+}
+
+int tracer::thread_id() {
+    // Called with m_mutex held.
+    if (!m_thread_id.get())
+        m_thread_id.reset(new int(m_next_thread_id++));
+    return *m_thread_id;
+}
+
+uint64_t tracer::now() {
+    return (microsec_clock::universal_time() - m_start).total_microseconds();
+}
+
+string tracer::doc_id() {
+    string *id(m_doc_id.get());
+    return id ? *id : string();
+}
+
+void tracer::set_doc_id(const string &doc_id) {
+    if (!m_doc_id.get())
+        m_doc_id.reset(new string);
+    *m_doc_id = doc_id;
+}
+
+void tracer::record(const char *name, uint64_t start, uint64_t end,
+                    const char *arg_name, uint64_t arg) {
+    // DocIDs are generated by us, but we quote them anyway, in case
+    // that ever changes.
+    string quoted_id;
+    string id(doc_id());
+    for (string::size_type i = 0; i < id.size(); ++i) {
+        if (id[i] == '"' || id[i] == '\\')
+            quoted_id += '\\';
+        quoted_id += id[i];
+    }
+
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    if (m_closed)
+        return;
+    if (!m_first_event)
+        m_out << ",\n";
+    m_first_event = false;
+    m_out << "{\"name\":\"" << name << "\",\"cat\":\"process-pst\""
+          << ",\"ph\":\"X\",\"ts\":" << start << ",\"dur\":" << (end - start)
+          << ",\"pid\":1,\"tid\":" << thread_id() << ",\"args\":{";
+    bool need_comma(false);
+    if (!id.empty()) {
+        m_out << "\"DocID\":\"" << quoted_id << "\"";
+        need_comma = true;
+    }
+    if (arg_name) {
+        if (need_comma)
+            m_out << ",";
+        m_out << "\"" << arg_name << "\":" << arg;
+    }
+    m_out << "}}";
+}
+
+void tracer::close() {
+    {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        if (m_closed)
+            return;
+        m_closed = true;
+        m_out << "\n]}\n";
+        m_out.flush();
+    }
+    if (s_current == this)
+        s_current = NULL;
+}
+
+trace_document::trace_document(const string &doc_id)
+    : m_tracer(tracer::current())
+{
+    if (m_tracer) {
+        m_previous = m_tracer->doc_id();
+        m_tracer->set_doc_id(doc_id);
+    }
+}
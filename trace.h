@@ -0,0 +1,133 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include <boost/utility.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+/// Records spans of time in Chrome's trace event format, so that a run
+/// can be loaded into chrome://tracing or a similar viewer.  At most one
+/// tracer may exist at a time.  When no tracer exists, trace_span and
+/// trace_document cost a single pointer comparison.
+class tracer : boost::noncopyable {
+    static tracer *s_current;
+
+    std::ostream &m_out;
+    boost::posix_time::ptime m_start;
+    boost::mutex m_mutex;
+    bool m_first_event;
+    bool m_closed;
+    int m_next_thread_id;
+
+    // Per-thread state: a small integer identifying the thread, and the
+    // DocID of the document it's working on, if any.
+    boost::thread_specific_ptr<int> m_thread_id;
+    boost::thread_specific_ptr<std::string> m_doc_id;
+
+    int thread_id();
+
+public:
+    /// Write trace events to 'out', and install ourselves as the current
+    /// tracer.
+    explicit tracer(std::ostream &out);
+    ~tracer();
+
+    /// The currently installed tracer, or NULL if tracing is disabled.
+    static tracer *current() { return s_current; }
+
+    /// Microseconds since we were created.
+    uint64_t now();
+
+    /// The DocID of the document this thread is working on.
+    std::string doc_id();
+    void set_doc_id(const std::string &doc_id);
+
+    /// Record a complete span on the current thread.  'name' must be a
+    /// plain ASCII string.  If 'arg_name' is non-NULL, we include it as an
+    /// extra numeric argument.
+    void record(const char *name, uint64_t start, uint64_t end,
+                const char *arg_name = NULL, uint64_t arg = 0);
+
+    /// Finish our JSON output and uninstall ourselves.  This is called
+    /// automatically by our destructor.
+    void close();
+};
+
+/// Records a span covering the lifetime of this object, if tracing is
+/// enabled.
+class trace_span : boost::noncopyable {
+    tracer *m_tracer;
+    const char *m_name;
+    const char *m_arg_name;
+    uint64_t m_arg;
+    uint64_t m_start;
+
+public:
+    explicit trace_span(const char *name, const char *arg_name = NULL,
+                        uint64_t arg = 0)
+        : m_tracer(tracer::current()), m_name(name),
+          m_arg_name(arg_name), m_arg(arg), m_start(0)
+    {
+        if (m_tracer)
+            m_start = m_tracer->now();
+    }
+
+    /// Set our extra numeric argument, if we didn't know it when we
+    /// started.
+    void set_arg(const char *arg_name, uint64_t arg)
+        { m_arg_name = arg_name; m_arg = arg; }
+
+    /// End our span now, instead of when we're destroyed.
+    void finish() {
+        if (m_tracer) {
+            m_tracer->record(m_name, m_start, m_tracer->now(),
+                             m_arg_name, m_arg);
+            m_tracer = NULL;
+        }
+    }
+
+    ~trace_span() { finish(); }
+};
+
+/// Tags all spans recorded on this thread with 'doc_id' for the lifetime
+/// of this object.
+class trace_document : boost::noncopyable {
+    tracer *m_tracer;
+    std::string m_previous;
+
+public:
+    explicit trace_document(const std::string &doc_id);
+    ~trace_document() {
+        if (m_tracer)
+            m_tracer->set_doc_id(m_previous);
+    }
+};
+
+#endif // TRACE_H
@@ -0,0 +1,96 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cassert>
+#include <sstream>
+
+#include <boost/thread/thread.hpp>
+
+#include "trace.h"
+
+using namespace std;
+
+namespace {
+    void record_span_on_other_thread() {
+        trace_span span("other");
+    }
+
+    size_t count(const string &s, const string &sub) {
+        size_t n = 0;
+        for (string::size_type i = s.find(sub); i != string::npos;
+             i = s.find(sub, i + 1))
+            ++n;
+        return n;
+    }
+}
+
+void trace_span_should_do_nothing_without_tracer() {
+    assert(NULL == tracer::current());
+    trace_span span("ignored");
+    trace_document doc("d0000001");
+}
+
+void tracer_should_write_chrome_trace_events() {
+    ostringstream out;
+    {
+        tracer t(out);
+        assert(&t == tracer::current());
+        {
+            trace_document doc("d0000001");
+            trace_span span("hash", "Size", 42);
+        }
+        trace_span span("write file");
+    }
+    assert(NULL == tracer::current());
+
+    string json(out.str());
+    assert(0 == json.find("{\"traceEvents\":[\n"));
+    assert("\n]}\n" == json.substr(json.size() - 4));
+    assert(2 == count(json, "\"ph\":\"X\""));
+    assert(string::npos !=
+           json.find("\"name\":\"hash\",\"cat\":\"process-pst\""));
+    assert(string::npos !=
+           json.find("\"args\":{\"DocID\":\"d0000001\",\"Size\":42}"));
+    // The DocID only applies while our trace_document is alive.
+    assert(string::npos != json.find("\"name\":\"write file\""));
+    assert(string::npos != json.find("\"args\":{}"));
+}
+
+void tracer_should_give_each_thread_its_own_id() {
+    ostringstream out;
+    {
+        tracer t(out);
+        trace_span span("main");
+        boost::thread other(record_span_on_other_thread);
+        other.join();
+    }
+    string json(out.str());
+    assert(1 == count(json, "\"tid\":1"));
+    assert(1 == count(json, "\"tid\":2"));
+}
+
+int trace_spec(int argc, char **argv) {
+    trace_span_should_do_nothing_without_tracer();
+    tracer_should_write_chrome_trace_events();
+    tracer_should_give_each_thread_its_own_id();
+
+    return 0;
+}
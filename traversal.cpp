@@ -0,0 +1,108 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <vector>
+#include <pstsdk/pst.h>
+
+#include "traversal.h"
+#include "trace.h"
+
+using namespace std;
+using namespace pstsdk;
+
+namespace {
+    // Opening a message only reads enough to find its properties, and
+    // we don't know its DocID yet, so we tag these spans with the PST's
+    // node ID instead.
+    message open_message(const pst::message_iterator &mi) {
+        trace_span span("open message");
+        message m(*mi);
+        span.set_arg("NodeID", m.get_id());
+        return m;
+    }
+
+    message open_message(const attachment &a) {
+        trace_span span("open message");
+        message m(a.open_as_message());
+        span.set_arg("NodeID", m.get_id());
+        return m;
+    }
+
+    // A message whose attachments we're still visiting.  This is all we
+    // keep for each level of nesting: the visitor has already finished
+    // with the message's own document.
+    struct pending_message {
+        message m;
+        message::attachment_iterator next;
+        message::attachment_iterator end;
+
+        explicit pending_message(const message &msg)
+            : m(msg), next(m.attachment_begin()), end(m.attachment_end()) {}
+    };
+
+    // Visit 'm' and everything attached to it.  Embedded messages can nest
+    // arbitrarily deeply, so we use an explicit stack instead of recursion.
+    void walk_message(const message &m, pst_visitor &visitor) {
+        vector<pending_message> stack;
+
+        visitor.begin_message(m, false);
+        if (m.get_attachment_count() > 0)
+            stack.push_back(pending_message(m));
+        else
+            visitor.end_message(m);
+
+        while (!stack.empty()) {
+            pending_message &top(stack.back());
+            if (top.next == top.end) {
+                message finished(top.m);
+                stack.pop_back();
+                visitor.end_message(finished);
+                continue;
+            }
+
+            attachment a(*top.next);
+            ++top.next;
+            if (!a.is_message()) {
+                visitor.file_attachment(a);
+                continue;
+            }
+
+            // Careful: pushing onto 'stack' invalidates 'top'.
+            message child(open_message(a));
+            visitor.begin_message(child, true);
+            if (child.get_attachment_count() > 0)
+                stack.push_back(pending_message(child));
+            else
+                visitor.end_message(child);
+        }
+    }
+}
+
+void walk_pst(const pst &pst_file, pst_visitor &visitor) {
+    pst::message_iterator mi(pst_file.message_begin());
+    for (; mi != pst_file.message_end(); ++mi) {
+        try {
+            walk_message(open_message(mi), visitor);
+        } catch (skip_message &e) {
+            visitor.skipped_message(e);
+        }
+    }
+}
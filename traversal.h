@@ -0,0 +1,67 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef TRAVERSAL_H
+#define TRAVERSAL_H
+
+#include <stdexcept>
+#include <string>
+
+namespace pstsdk {
+    class pst;
+    class message;
+    class attachment;
+}
+
+/// A visitor may throw this to abandon the rest of the current top-level
+/// message, including any attachments we haven't visited yet.
+class skip_message : public std::runtime_error {
+public:
+    explicit skip_message(const std::string &reason)
+        : std::runtime_error(reason) {}
+};
+
+/// Receives callbacks from walk_pst for each item in a PST.
+class pst_visitor {
+public:
+    virtual ~pst_visitor() {}
+
+    /// Called for each message, before any of its attachments.
+    /// 'embedded' is true if the message is attached to another message.
+    virtual void begin_message(const pstsdk::message &m, bool embedded) = 0;
+
+    /// Called for each attachment which is not itself a message.
+    virtual void file_attachment(const pstsdk::attachment &a) = 0;
+
+    /// Called after all of a message's attachments have been visited.
+    virtual void end_message(const pstsdk::message &m) {}
+
+    /// Called instead of end_message when a visitor method throws
+    /// skip_message.  We then move on to the next top-level message.
+    virtual void skipped_message(const skip_message &reason) {}
+};
+
+/// Visit every message in 'pst_file' exactly once, including messages
+/// embedded as attachments.  We only touch the metadata needed to find
+/// attachments; reading anything else is up to the visitor.
+extern void walk_pst(const pstsdk::pst &pst_file, pst_visitor &visitor);
+
+#endif // TRAVERSAL_H
@@ -19,12 +19,10 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <cstdlib>
+#include <cstring>
 #include <cctype>
-#include <sstream>
-#include <iomanip>
 #include <stdexcept>
 #include <vector>
-#include <iconv.h>
 
 #include "utilities.h"
 #include "md5.h"
@@ -60,86 +58,228 @@ string wstring_to_string(const wstring &wstr) {
 }
 
 namespace {
-    // This will need to be customized for various platforms.  Sadly,
-    // "WCHAR_T" does not appear to work as a source character set
-    // with GNU iconv.
-    const char *wchar_t_encoding = "UTF-32LE";
+    // Windows-1252 characters 0x80 through 0x9F.  The rest of the upper
+    // half matches ISO-8859-1.
+    const uint16_t cp1252_high[32] = {
+        0x20AC, 0xFFFD, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+        0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0xFFFD, 0x017D, 0xFFFD,
+        0xFFFD, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+        0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0xFFFD, 0x017E, 0x0178
+    };
+}
+
+/// Convert a byte in Windows code page 1252 to a Unicode code point.
+uint32_t cp1252_to_code_point(uint8_t c) {
+    if (c >= 0x80 && c < 0xA0)
+        return cp1252_high[c - 0x80];
+    return c;
+}
+
+/// Append the UTF-8 encoding of the code point 'c' to 'out'.  Anything
+/// which isn't a valid Unicode code point becomes U+FFFD.
+void code_point_to_utf8_append(string &out, uint32_t c) {
+    if ((c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF)
+        c = 0xFFFD;
+
+    if (c < 0x80) {
+        out += static_cast<char>(c);
+    } else if (c < 0x800) {
+        out += static_cast<char>(0xC0 | (c >> 6));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+    } else if (c < 0x10000) {
+        out += static_cast<char>(0xE0 | (c >> 12));
+        out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (c >> 18));
+        out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+    }
+}
+
+/// Append the UTF-8 encoding of 'wstr' to 'out'.  We handle both UTF-16
+/// and UTF-32 wchar_t, and replace anything which isn't a valid Unicode
+/// code point with U+FFFD.
+void wstring_to_utf8_append(string &out, const wstring &wstr) {
+    out.reserve(out.size() + wstr.size());
+    for (size_t i = 0; i < wstr.size(); ++i) {
+        uint32_t c(static_cast<uint32_t>(wstr[i]));
+        if (sizeof(wchar_t) == 2 && c >= 0xD800 && c <= 0xDBFF &&
+            i + 1 < wstr.size()) {
+            uint32_t low(static_cast<uint32_t>(wstr[i+1]));
+            if (low >= 0xDC00 && low <= 0xDFFF) {
+                c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                ++i;
+            }
+        }
+        code_point_to_utf8_append(out, c);
+    }
 }
 
 /// Convert from a wstring to a UTF-8 encoded string, regardless of the
 /// current locale's encoding.
 string wstring_to_utf8(const wstring &wstr) {
-    // Handle the empty string, which breaks iconv on some platforms.
-    if (wstr.empty())
-        return string();
-
-    // Open a conversion context.
-    //iconv_t cd(::iconv_open("UTF-8", "WCHAR_T"));
-    iconv_t cd(::iconv_open("UTF-8", const_cast<char *>(wchar_t_encoding)));
-    if (cd == (iconv_t)(-1))
-        throw std::runtime_error("Unable to convert a wstring to UTF-8");
-
-    // Allocate up to 4 UTF-8 bytes per Unicode character, which is all that
-    // is currently permitted by Unicode (and by Windows' UTF-16 encoding).
-    vector<char> utf8(wstr.size() * 4);
-    
-    // Attempt to perform the conversion.
-    const char *inbuf(reinterpret_cast<const char *>(wstr.c_str()));
-    size_t inbytesleft(wstr.size() * sizeof(wchar_t));
-    char *outbuf(&utf8[0]);
-    size_t outbytesleft(utf8.size());
-    size_t result = ::iconv(cd, const_cast<char **>(&inbuf), &inbytesleft,
-                            &outbuf, &outbytesleft);
-
-    // Close our conversion context.
-    ::iconv_close(cd);
-
-    // Check for conversion failure.
-    if (result == size_t(-1) || inbytesleft > 0) {
-        perror("wstring_to_utf8");
-        throw runtime_error("Error converting a wstring to UTF-8");
+    string utf8;
+    wstring_to_utf8_append(utf8, wstr);
+    return utf8;
+}
+
+/// Append 'size' bytes of little-endian UTF-16 to 'out' as UTF-8.  This is
+/// how PSTs store Unicode strings, so we can convert them without going
+/// through a wstring.  Unpaired surrogates become U+FFFD.
+void utf16le_to_utf8_append(string &out, const uint8_t *data, size_t size) {
+    out.reserve(out.size() + size / 2);
+    for (size_t i = 0; i + 1 < size; i += 2) {
+        uint32_t c(data[i] | (uint32_t(data[i+1]) << 8));
+        if (c >= 0xD800 && c <= 0xDBFF && i + 3 < size) {
+            uint32_t low(data[i+2] | (uint32_t(data[i+3]) << 8));
+            if (low >= 0xDC00 && low <= 0xDFFF) {
+                c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                i += 2;
+            }
+        }
+        code_point_to_utf8_append(out, c);
     }
-    
-    // Convert our output to a string and return it.
-    size_t output_size(utf8.size() - outbytesleft);
-    return string(utf8.begin(), utf8.begin() + output_size);
+}
+
+/// Append a string stored in a PST to 'out' as UTF-8.  Unicode strings
+/// are little-endian UTF-16, and 8-bit strings are normally Windows-1252.
+void pst_string_to_utf8_append(string &out, const uint8_t *data,
+                               size_t size, bool unicode) {
+    if (unicode) {
+        utf16le_to_utf8_append(out, data, size);
+    } else {
+        out.reserve(out.size() + size);
+        for (size_t i = 0; i < size; ++i)
+            code_point_to_utf8_append(out, cp1252_to_code_point(data[i]));
+    }
+}
+
+namespace {
+    // Every possible byte, as two lowercase hex digits.
+    struct hex_table {
+        char digits[256][2];
+
+        hex_table() {
+            const char *hex_chars("0123456789abcdef");
+            for (int i = 0; i < 256; ++i) {
+                digits[i][0] = hex_chars[i >> 4];
+                digits[i][1] = hex_chars[i & 0xf];
+            }
+        }
+    };
+
+    const hex_table hex_pairs;
+}
+
+/// Write 2*size hex digits to 'out'.  We don't NUL-terminate.
+void hex_encode(const uint8_t *data, size_t size, char *out) {
+    for (size_t i = 0; i < size; ++i, out += 2)
+        memcpy(out, hex_pairs.digits[data[i]], 2);
 }
 
 string bytes_to_hex_string(const vector<uint8_t> &v) {
-   // Convert to hexadecimal string.
-    ostringstream out;
-    out << hex;
-    for (size_t i = 0; i < v.size(); ++i)
-        out << setw(2) << setfill('0') << uint32_t(v[i]);
-    return out.str();
+    string result(v.size() * 2, '0');
+    if (!v.empty())
+        hex_encode(&v[0], v.size(), &result[0]);
+    return result;
 }
 
-string md5(const vector<uint8_t> &v) {
-    // Calculate the MD5 sum.
+md5_digest md5_bytes(const uint8_t *data, size_t size) {
     md5_state_s pms;
     md5_init(&pms);
-    md5_append(&pms, &v[0], v.size());
-    md5_byte_t digest[16];
-    md5_finish(&pms, digest);
+    md5_append(&pms, data, size);
+    md5_digest digest;
+    md5_finish(&pms, digest.data());
+    return digest;
+}
 
-    vector<uint8_t> digest_vector(digest, digest + 16);
-    return bytes_to_hex_string(digest_vector);
+string md5(const uint8_t *data, size_t size) {
+    return hex_digest(md5_bytes(data, size)).data();
 }
 
-/// Convert a string to UTF-8 and escape any XML metacharacters.
-string xml_quote(const wstring &wstr) {
-    string utf8(wstring_to_utf8(wstr));
-    string out;
-    for (string::const_iterator i = utf8.begin(); i != utf8.end(); ++i) {
-        char c(*i);
+string md5(const vector<uint8_t> &v) {
+    return md5(v.empty() ? NULL : &v[0], v.size());
+}
+
+namespace {
+    // We scan for characters which need escaping a machine word at a time,
+    // using the bit tricks from "Bit Twiddling Hacks":
+    // http://graphics.stanford.edu/~seander/bithacks.html#ZeroInWord
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t high_bits = 0x8080808080808080ULL;
+
+    inline uint64_t has_zero_byte(uint64_t v) {
+        return (v - ones) & ~v & high_bits;
+    }
+
+    inline uint64_t has_byte(uint64_t v, unsigned char c) {
+        return has_zero_byte(v ^ (ones * c));
+    }
+
+    inline uint64_t has_byte_less_than(uint64_t v, unsigned char n) {
+        return (v - ones * n) & ~v & high_bits;
+    }
+
+    inline bool word_needs_escaping(uint64_t v) {
+        return (has_byte(v, '<') | has_byte(v, '>') | has_byte(v, '&') |
+                has_byte(v, '\'') | has_byte(v, '"') |
+                has_byte_less_than(v, 0x20)) != 0;
+    }
+
+    // Append 'c' to 'out', escaped for use in an XML attribute value.
+    inline void xml_quote_char(string &out, char c) {
         switch (c) {
             case '<':  out += "&lt;"; break;
             case '>':  out += "&gt;"; break;
             case '\'': out += "&apos;"; break;
             case '"':  out += "&quot;"; break;
             case '&':  out += "&amp;"; break;
-            default:   out += c;
+            // These would be normalized to spaces by an XML parser.
+            case '\t': out += "&#9;"; break;
+            case '\n': out += "&#10;"; break;
+            case '\r': out += "&#13;"; break;
+            default:
+                // XML 1.0 doesn't allow other control characters at all,
+                // not even as character references.
+                if (static_cast<unsigned char>(c) < 0x20)
+                    out += "\xEF\xBF\xBD"; // U+FFFD
+                else
+                    out += c;
+        }
+    }
+}
+
+/// Append 'size' bytes of UTF-8 text to 'out', escaping anything which
+/// can't appear literally in an XML attribute value.  Runs of ordinary
+/// characters are copied in bulk.
+void xml_quote_append(string &out, const char *utf8, size_t size) {
+    const char *p(utf8);
+    const char *end(utf8 + size);
+    const char *run(p);
+    while (end - p >= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        if (!word_needs_escaping(word)) {
+            p += 8;
+            continue;
         }
+        out.append(run, p - run);
+        for (const char *word_end = p + 8; p != word_end; ++p)
+            xml_quote_char(out, *p);
+        run = p;
     }
+    out.append(run, p - run);
+    for (; p != end; ++p)
+        xml_quote_char(out, *p);
+}
+
+/// Convert a string to UTF-8 and escape any XML metacharacters.
+string xml_quote(const wstring &wstr) {
+    string utf8(wstring_to_utf8(wstr));
+    string out;
+    out.reserve(utf8.size());
+    xml_quote_append(out, utf8.data(), utf8.size());
     return out;
 }
@@ -23,12 +23,36 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
+#include <array>
 
 extern std::wstring string_to_wstring(const std::string &str);
 extern std::string wstring_to_string(const std::wstring &wstr);
+extern uint32_t cp1252_to_code_point(uint8_t c);
+extern void code_point_to_utf8_append(std::string &out, uint32_t c);
+extern void wstring_to_utf8_append(std::string &out, const std::wstring &wstr);
 extern std::string wstring_to_utf8(const std::wstring &wstr);
+extern void utf16le_to_utf8_append(std::string &out, const uint8_t *data,
+                                   size_t size);
+extern void pst_string_to_utf8_append(std::string &out, const uint8_t *data,
+                                      size_t size, bool unicode);
+extern void hex_encode(const uint8_t *data, size_t size, char *out);
 extern std::string bytes_to_hex_string(const std::vector<uint8_t> &v);
+
+/// A fixed-size, NUL-terminated hexadecimal representation of a digest.
+template <size_t N>
+std::array<char, 2*N+1> hex_digest(const std::array<uint8_t, N> &digest) {
+    std::array<char, 2*N+1> result;
+    hex_encode(digest.data(), N, result.data());
+    result[2*N] = '\0';
+    return result;
+}
+
+typedef std::array<uint8_t, 16> md5_digest;
+extern md5_digest md5_bytes(const uint8_t *data, size_t size);
+extern std::string md5(const uint8_t *data, size_t size);
 extern std::string md5(const std::vector<uint8_t> &v);
+extern void xml_quote_append(std::string &out, const char *utf8, size_t size);
 extern std::string xml_quote(const std::wstring &wstr);
 
 #endif // UTILITIES_H
@@ -38,6 +38,28 @@ void wstring_to_utf8_should_convert_to_utf8() {
     assert("text" == wstring_to_utf8(L"text"));
     assert(0x2014 == wstring(L"\u2014")[0]);
     assert("\xE2\x80\x94" == wstring_to_utf8(L"\u2014")); // em-dash
+    assert("\xC3\xA9\xF0\x9F\x98\x80" == wstring_to_utf8(L"\u00e9\U0001F600"));
+}
+
+void utf16le_to_utf8_append_should_convert_to_utf8() {
+    string out("x");
+    const uint8_t text[] = { 'a', 0, 0xe9, 0, 0x14, 0x20,
+                             0x3d, 0xd8, 0x00, 0xde };
+    utf16le_to_utf8_append(out, text, sizeof(text));
+    assert("xa\xC3\xA9\xE2\x80\x94\xF0\x9F\x98\x80" == out);
+
+    // An unpaired surrogate, and an odd trailing byte.
+    const uint8_t broken[] = { 0x3d, 0xd8, 'b', 0, 'c' };
+    out.clear();
+    utf16le_to_utf8_append(out, broken, sizeof(broken));
+    assert("\xEF\xBF\xBD" "b" == out);
+}
+
+void cp1252_to_code_point_should_convert_windows_characters() {
+    assert('a' == cp1252_to_code_point('a'));
+    assert(0x20AC == cp1252_to_code_point(0x80)); // euro sign
+    assert(0x2014 == cp1252_to_code_point(0x97)); // em-dash
+    assert(0xE9 == cp1252_to_code_point(0xE9));
 }
 
 void bytes_to_hex_string_should_convert_vector_to_hex() {
@@ -47,6 +69,20 @@ void bytes_to_hex_string_should_convert_vector_to_hex() {
     assert("00ff" == bytes_to_hex_string(v));
 }
 
+void hex_digest_should_format_fixed_size_arrays() {
+    std::array<uint8_t, 3> digest = {{ 0x01, 0x23, 0xef }};
+    std::array<char, 7> hex(hex_digest(digest));
+    assert(string("0123ef") == hex.data());
+}
+
+void md5_bytes_should_return_fixed_size_digest() {
+    string s("Data");
+    md5_digest digest(md5_bytes(reinterpret_cast<const uint8_t *>(s.data()),
+                                s.size()));
+    assert(0xf6 == digest[0]);
+    assert(0xee == digest[15]);
+}
+
 void md5_should_calculate_md5_hash_for_vector() {
     string s("Data");
     vector<uint8_t> v(s.begin(), s.end());
@@ -60,16 +96,45 @@ void xml_quote_should_convert_wstring_and_escape_metacharacters() {
     assert("&lt;&amp;&quot;&apos;&gt;" == xml_quote(L"<&\"'>"));
 }
 
+void xml_quote_should_escape_whitespace_and_replace_control_characters() {
+    assert("a&#9;b&#13;&#10;c" == xml_quote(L"a\tb\r\nc"));
+    assert("\xEF\xBF\xBD" == xml_quote(wstring(1, L'\x01')));
+}
+
+void xml_quote_append_should_escape_long_strings_into_buffer() {
+    // Make sure we find metacharacters at every position within a word.
+    string input("0123456789abcdefghijklmnopqrstuvwxyz");
+    for (size_t i = 0; i < input.size(); ++i) {
+        string s(input);
+        s[i] = '&';
+        string expected(input.substr(0, i) + "&amp;" + input.substr(i + 1));
+        string out("prefix:");
+        xml_quote_append(out, s.data(), s.size());
+        assert("prefix:" + expected == out);
+    }
+
+    string clean(1000, 'x');
+    string out;
+    xml_quote_append(out, clean.data(), clean.size());
+    assert(clean == out);
+}
+
 int utilities_spec(int argc, char **argv) {
     string_to_wstring_should_convert_native_8_bit_to_unicode();
     wstring_to_string_should_convert_unicode_to_native_8_bit();
 
     wstring_to_utf8_should_convert_to_utf8();
+    utf16le_to_utf8_append_should_convert_to_utf8();
+    cp1252_to_code_point_should_convert_windows_characters();
 
     bytes_to_hex_string_should_convert_vector_to_hex();
+    hex_digest_should_format_fixed_size_arrays();
+    md5_bytes_should_return_fixed_size_digest();
     md5_should_calculate_md5_hash_for_vector();
 
     xml_quote_should_convert_wstring_and_escape_metacharacters();
+    xml_quote_should_escape_whitespace_and_replace_control_characters();
+    xml_quote_append_should_escape_long_strings_into_buffer();
 
     return 0;
 }
@@ -0,0 +1,148 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+
+#include "watchdog.h"
+
+using namespace std;
+using namespace boost::posix_time;
+
+namespace {
+    bool slower(const message_record &a, const message_record &b) {
+        return a.seconds > b.seconds;
+    }
+
+    string json_quote(const string &utf8) {
+        string out("\"");
+        for (string::size_type i = 0; i < utf8.size(); ++i) {
+            unsigned char c(utf8[i]);
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (c < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            } else {
+                out += c;
+            }
+        }
+        return out + "\"";
+    }
+
+    void output_records(ostream &out, const vector<message_record> &records) {
+        out << "[";
+        for (size_t i = 0; i < records.size(); ++i) {
+            const message_record &r(records[i]);
+            out << (i == 0 ? "\n" : ",\n")
+                << "    {\"NodeID\": " << r.node_id
+                << ", \"DocID\": " << json_quote(r.doc_id)
+                << ", \"seconds\": " << r.seconds
+                << ", \"bytes\": " << r.bytes;
+            if (!r.reason.empty())
+                out << ", \"reason\": " << json_quote(r.reason);
+            out << "}";
+        }
+        out << (records.empty() ? "]" : "\n  ]");
+    }
+}
+
+message_watchdog::message_watchdog(double max_seconds, uint64_t max_bytes,
+                                   size_t slowest_count)
+    : m_max_seconds(max_seconds), m_max_bytes(max_bytes),
+      m_slowest_count(slowest_count), m_active(false), m_current(0, "") {
+}
+
+void message_watchdog::update_elapsed() {
+    time_duration elapsed(microsec_clock::universal_time() - m_start);
+    m_current.seconds = elapsed.total_microseconds() / 1000000.0;
+}
+
+void message_watchdog::begin_message(uint32_t node_id, const string &doc_id) {
+    m_active = true;
+    m_current = message_record(node_id, doc_id);
+    m_start = microsec_clock::universal_time();
+}
+
+void message_watchdog::check() {
+    if (!m_active || m_max_seconds <= 0)
+        return;
+    update_elapsed();
+    if (m_current.seconds > m_max_seconds) {
+        ostringstream reason;
+        reason << "Exceeded time budget of " << m_max_seconds << " seconds";
+        throw budget_exceeded(reason.str());
+    }
+}
+
+void message_watchdog::charge(uint64_t bytes) {
+    if (!m_active)
+        return;
+    if (m_max_bytes > 0 && m_current.bytes + bytes > m_max_bytes) {
+        ostringstream reason;
+        reason << "Exceeded memory budget of " << m_max_bytes << " bytes";
+        throw budget_exceeded(reason.str());
+    }
+    m_current.bytes += bytes;
+}
+
+void message_watchdog::end_message() {
+    if (!m_active)
+        return;
+    m_active = false;
+    update_elapsed();
+    if (m_slowest_count == 0)
+        return;
+    if (m_slowest.size() < m_slowest_count) {
+        m_slowest.push_back(m_current);
+        push_heap(m_slowest.begin(), m_slowest.end(), slower);
+    } else if (m_current.seconds > m_slowest.front().seconds) {
+        pop_heap(m_slowest.begin(), m_slowest.end(), slower);
+        m_slowest.back() = m_current;
+        push_heap(m_slowest.begin(), m_slowest.end(), slower);
+    }
+}
+
+void message_watchdog::skip_message(const string &reason) {
+    if (!m_active)
+        return;
+    update_elapsed();
+    m_current.reason = reason;
+    m_skipped.push_back(m_current);
+    end_message();
+}
+
+vector<message_record> message_watchdog::slowest() const {
+    vector<message_record> result(m_slowest);
+    sort(result.begin(), result.end(), slower);
+    return result;
+}
+
+void message_watchdog::output_report(ostream &out) const {
+    out << "{\n  \"skipped_messages\": ";
+    output_records(out, m_skipped);
+    out << ",\n  \"slowest_messages\": ";
+    output_records(out, slowest());
+    out << "\n}\n";
+}
@@ -0,0 +1,110 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/utility.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include "traversal.h"
+
+/// Thrown when a message exceeds its time or memory budget.
+class budget_exceeded : public skip_message {
+public:
+    explicit budget_exceeded(const std::string &reason)
+        : skip_message(reason) {}
+};
+
+/// What we know about one top-level message, for our report.
+struct message_record {
+    uint32_t node_id;
+    std::string doc_id;
+    double seconds;
+    uint64_t bytes;
+    std::string reason;
+
+    message_record(uint32_t n, const std::string &d)
+        : node_id(n), doc_id(d), seconds(0), bytes(0) {}
+};
+
+/// Keeps track of how much time and memory each top-level message
+/// (including its attachments and embedded messages) has used.  Our
+/// checks are cooperative: we can't interrupt a single slow call into
+/// pstsdk, but we can stop as soon as it returns, rather than going on to
+/// process the rest of the message.
+class message_watchdog : boost::noncopyable {
+    double m_max_seconds;
+    uint64_t m_max_bytes;
+    size_t m_slowest_count;
+
+    bool m_active;
+    message_record m_current;
+    boost::posix_time::ptime m_start;
+
+    std::vector<message_record> m_skipped;
+
+    // A min-heap on 'seconds', holding at most m_slowest_count records.
+    std::vector<message_record> m_slowest;
+
+    void update_elapsed();
+
+public:
+    /// A budget of 0 means "unlimited".
+    explicit message_watchdog(double max_seconds = 0, uint64_t max_bytes = 0,
+                              size_t slowest_count = 10);
+
+    void set_budget(double max_seconds, uint64_t max_bytes) {
+        m_max_seconds = max_seconds;
+        m_max_bytes = max_bytes;
+    }
+
+    /// Start timing a new top-level message.
+    void begin_message(uint32_t node_id, const std::string &doc_id);
+
+    /// Throw budget_exceeded if we've spent too long on this message.
+    void check();
+
+    /// Throw budget_exceeded if materializing 'bytes' more would exceed
+    /// our budget.  Otherwise, count them against the current message.
+    void charge(uint64_t bytes);
+
+    /// Finish timing the current message.
+    void end_message();
+
+    /// Record that we gave up on the current message.
+    void skip_message(const std::string &reason);
+
+    const std::vector<message_record> &skipped() const { return m_skipped; }
+
+    /// The slowest messages we've seen, slowest first.
+    std::vector<message_record> slowest() const;
+
+    /// Write our skipped and slowest messages to 'out' as JSON.
+    void output_report(std::ostream &out) const;
+};
+
+#endif // WATCHDOG_H
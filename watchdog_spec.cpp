@@ -0,0 +1,115 @@
+// -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil; -*-
+//
+// process-pst: Convert PST files to RCF822 *.eml files and load files
+// Copyright (c) 2010 Aranetic LLC
+// Look for the latest version at http://github.com/aranetic/process-pst
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU Affero General Public License (the "License")
+// as published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but it
+// is provided on an "AS-IS" basis and WITHOUT ANY WARRANTY; without even
+// the implied warranties of MERCHANTABILITY, FITNESS FOR A PARTICULAR
+// PURPOSE, OR NONINFRINGEMENT.  See the GNU Affero General Public License
+// for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+#include <cassert>
+#include <sstream>
+
+#include <boost/thread/thread.hpp>
+
+#include "watchdog.h"
+
+using namespace std;
+
+namespace {
+    bool charge_throws(message_watchdog &w, uint64_t bytes) {
+        try {
+            w.charge(bytes);
+            return false;
+        } catch (budget_exceeded &) {
+            return true;
+        }
+    }
+}
+
+void message_watchdog_should_enforce_memory_budget() {
+    message_watchdog w(0, 1000);
+    w.begin_message(0x200024, "d0000001");
+    assert(!charge_throws(w, 600));
+    assert(!charge_throws(w, 400));
+    assert(charge_throws(w, 1));
+    w.skip_message("too big");
+
+    assert(1 == w.skipped().size());
+    assert(0x200024 == w.skipped()[0].node_id);
+    assert("d0000001" == w.skipped()[0].doc_id);
+    assert(1000 == w.skipped()[0].bytes);
+    assert("too big" == w.skipped()[0].reason);
+}
+
+void message_watchdog_should_enforce_time_budget() {
+    message_watchdog w(0.001);
+    w.begin_message(1, "d0000001");
+    w.check();
+    boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+    bool caught_exception(false);
+    try {
+        w.check();
+    } catch (skip_message &) {
+        caught_exception = true;
+    }
+    assert(caught_exception);
+}
+
+void message_watchdog_should_ignore_budgets_between_messages() {
+    message_watchdog w(0, 10);
+    assert(!charge_throws(w, 100));
+    w.check();
+}
+
+void message_watchdog_should_keep_slowest_messages() {
+    message_watchdog w(0, 0, 2);
+    for (uint32_t i = 1; i <= 3; ++i) {
+        w.begin_message(i, "");
+        if (i != 2)
+            boost::this_thread::sleep(boost::posix_time::milliseconds(5 * i));
+        w.end_message();
+    }
+    vector<message_record> slowest(w.slowest());
+    assert(2 == slowest.size());
+    assert(3 == slowest[0].node_id);
+    assert(1 == slowest[1].node_id);
+}
+
+void message_watchdog_should_output_json_report() {
+    message_watchdog w(0, 10);
+    w.begin_message(7, "d0000003");
+    charge_throws(w, 11);
+    w.skip_message("Exceeded \"memory\" budget");
+
+    ostringstream out;
+    w.output_report(out);
+    string json(out.str());
+    assert(0 == json.find("{\n  \"skipped_messages\": [\n"));
+    assert(string::npos != json.find("\"NodeID\": 7, \"DocID\": \"d0000003\""));
+    assert(string::npos !=
+           json.find("\"reason\": \"Exceeded \\\"memory\\\" budget\"}"));
+    assert(string::npos != json.find("\"slowest_messages\": [\n"));
+}
+
+int watchdog_spec(int argc, char **argv) {
+    message_watchdog_should_enforce_memory_budget();
+    message_watchdog_should_enforce_time_budget();
+    message_watchdog_should_ignore_budgets_between_messages();
+    message_watchdog_should_keep_slowest_messages();
+    message_watchdog_should_output_json_report();
+
+    return 0;
+}
@@ -31,7 +31,7 @@ void xml_context::indent() {
 }
 
 xml_context::xml_context(ostream &out) : m_out(out), m_indent(0) {
-    m_out << "<?xml version='1.0' encoding='UTF-8'?>" << endl;
+    m_out << "<?xml version='1.0' encoding='UTF-8'?>\n";
 }
 
 xml_context &xml_context::lt(const string &tag_name) {
@@ -41,17 +41,34 @@ xml_context &xml_context::lt(const string &tag_name) {
 }
 
 xml_context &xml_context::attr(const string &name, const wstring &value) {
-    m_out << " " << name << "='" << xml_quote(value) << "'";
+    m_utf8.clear();
+    wstring_to_utf8_append(m_utf8, value);
+    return attr(name, m_utf8.data(), m_utf8.size());
+}
+
+/// Output an attribute whose value is already UTF-8.
+xml_context &xml_context::attr(const string &name, const string &utf8) {
+    return attr(name, utf8.data(), utf8.size());
+}
+
+/// Output an attribute whose value is already UTF-8.
+xml_context &xml_context::attr(const string &name, const char *utf8,
+                               size_t size) {
+    m_quoted.clear();
+    xml_quote_append(m_quoted, utf8, size);
+    m_out << " " << name << "='";
+    m_out.write(m_quoted.data(), m_quoted.size());
+    m_out << "'";
     return *this;
 }
 
 void xml_context::gt() {
-    m_out << ">" << endl;
+    m_out << ">\n";
     ++m_indent;
 }
 
 void xml_context::slash_gt() {
-    m_out << "/>" << endl;
+    m_out << "/>\n";
 }
 
 void xml_context::end_tag(const string &tag_name) {
@@ -59,5 +76,5 @@ void xml_context::end_tag(const string &tag_name) {
         throw runtime_error("Unbalanced tags in XML");
     --m_indent;
     indent();
-    m_out << "</" << tag_name << ">" << endl;
+    m_out << "</" << tag_name << ">\n";
 }
@@ -33,6 +33,11 @@ class xml_context : boost::noncopyable {
     std::ostream &m_out;
     int m_indent;
 
+    // Scratch buffers, reused for every attribute so that we don't need to
+    // allocate memory once they've grown large enough.
+    std::string m_utf8;
+    std::string m_quoted;
+
     void indent();
 
 public:
@@ -40,6 +45,8 @@ public:
 
     xml_context &lt(const std::string &tag_name);
     xml_context &attr(const std::string &name, const std::wstring &value);
+    xml_context &attr(const std::string &name, const std::string &utf8);
+    xml_context &attr(const std::string &name, const char *utf8, size_t size);
     void gt();
     void slash_gt();
 
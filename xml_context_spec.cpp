@@ -32,7 +32,7 @@ void xml_context_should_output_xml_document() {
     x.lt("Foo").gt();
     x  .lt("Bar").attr("Baz", L"& Moby").gt();
     x  .end_tag("Bar");
-    x  .lt("Quux").slash_gt();
+    x  .lt("Quux").attr("Name", string("Caf\xC3\xA9")).slash_gt();
     x.end_tag("Foo");
 
     const char *expected =
@@ -40,7 +40,7 @@ void xml_context_should_output_xml_document() {
         "<Foo>\n"
         "  <Bar Baz='&amp; Moby'>\n"
         "  </Bar>\n"
-        "  <Quux/>\n"
+        "  <Quux Name='Caf\xC3\xA9'/>\n"
         "</Foo>\n";
     assert(expected == out.str());
 }